@@ -0,0 +1,145 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** depth_bench.cpp
+**
+** Offline detect -> depth benchmark on a RealSense .bag recording
+**
+** 录像需要同时包含彩色和深度流，例如:
+**   rs-record -f target.bag -t 30
+**   ./depth_bench -b target.bag -W 640 -H 480 > depth.json
+** 每一帧先检测，再只在检测框内取深度，分别统计两部分的耗时和有深度的框的比例
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+#include "DepthLocator.h"
+#include "logger.h"
+#include "yolo.hpp"
+
+static double nowMs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	return sorted[std::min(sorted.size() - 1, (size_t)(sorted.size() * p))];
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "%s -b file.bag [-W width] [-H height] [-w depth width] [-h depth height] [-r fps] [-n frames] [-m modeldir]\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+	DepthLocatorParameters param;
+	param.m_streamColor = true;
+	unsigned long maxFrames = 0;
+	Net_config config = yolo_net;
+
+	int c = 0;
+	while ((c = getopt(argc, argv, "b:W:H:w:h:r:n:m:")) != -1)
+	{
+		switch (c)
+		{
+			case 'b': param.m_bagFile = optarg; break;
+			case 'W': param.m_colorWidth = atoi(optarg); break;
+			case 'H': param.m_colorHeight = atoi(optarg); break;
+			case 'w': param.m_width = atoi(optarg); break;
+			case 'h': param.m_height = atoi(optarg); break;
+			case 'r': param.m_fps = atoi(optarg); break;
+			case 'n': maxFrames = atol(optarg); break;
+			case 'm':
+				config.classesFile = std::string(optarg) + "/voc.names";
+				config.modelConfiguration = std::string(optarg) + "/yolo-fastest.cfg";
+				config.modelWeights = std::string(optarg) + "/yolo-fastest_last.weights";
+			break;
+			default: usage(argv[0]); return -1;
+		}
+	}
+	if (param.m_bagFile.empty())
+	{
+		usage(argv[0]);
+		return -1;
+	}
+
+	// results go to stdout as json, library logs and YOLO messages are sent to stderr
+	std::cout.rdbuf(std::cerr.rdbuf());
+
+	YOLO yolo(config);
+	DepthLocator* locator = DepthLocator::create(param);
+	if (locator == NULL)
+	{
+		fprintf(stderr, "Cannot play %s\n", param.m_bagFile.c_str());
+		return -1;
+	}
+
+	std::vector<double> detectTimes;
+	std::vector<double> depthTimes;
+	std::vector<Detection> detections;
+	std::vector<SharedDetection> shared;
+	unsigned long frames = 0;
+	unsigned long boxes = 0;
+	unsigned long located = 0;
+	cv::Mat color;
+	// non real time playback: frames come as fast as they are consumed, the end of the file times out
+	while ( ((maxFrames == 0) || (frames < maxFrames)) && locator->update(&color, 1000) )
+	{
+		if (color.empty())
+			continue;
+		double start = nowMs();
+		yolo.detect(color, detections);
+		double detected = nowMs();
+
+		shared.resize(detections.size());
+		for (size_t i = 0; i < detections.size(); ++i)
+		{
+			const cv::Rect& box = detections[i].box;
+			SharedDetection d = { detections[i].classId, detections[i].confidence, box.x, box.y, box.width, box.height, { 0, 0, 0 } };
+			shared[i] = d;
+		}
+		locator->locate(shared);
+		double end = nowMs();
+
+		detectTimes.push_back(detected - start);
+		depthTimes.push_back(end - detected);
+		frames++;
+		boxes += shared.size();
+		for (size_t i = 0; i < shared.size(); ++i)
+		{
+			if (shared[i].position[2] > 0)
+				located++;
+		}
+	}
+	delete locator;
+
+	std::sort(detectTimes.begin(), detectTimes.end());
+	std::sort(depthTimes.begin(), depthTimes.end());
+	printf("{\n");
+	printf("  \"bag\": \"%s\",\n", param.m_bagFile.c_str());
+	printf("  \"color\": \"%dx%d\",\n  \"depth\": \"%dx%d\",\n", param.m_colorWidth, param.m_colorHeight, param.m_width, param.m_height);
+	printf("  \"frames\": %lu,\n  \"boxes\": %lu,\n  \"boxes_with_depth\": %lu,\n", frames, boxes, located);
+	printf("  \"detect_ms\": { \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+	       percentile(detectTimes, 0.5), percentile(detectTimes, 0.9), percentile(detectTimes, 0.99), detectTimes.empty() ? 0 : detectTimes.back());
+	printf("  \"depth_ms\": { \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f }\n",
+	       percentile(depthTimes, 0.5), percentile(depthTimes, 0.9), percentile(depthTimes, 0.99), depthTimes.empty() ? 0 : depthTimes.back());
+	printf("}\n");
+	return 0;
+}
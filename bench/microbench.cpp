@@ -0,0 +1,345 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** microbench.cpp
+** 
+** Microbenchmarks of the capture, conversion and detection hot paths
+**
+** 用法: bench [--benchmark_filter=...]
+**   YOLO_DIR       模型目录，默认使用yolo.hpp里的路径
+**   BENCH_RECORDING V4l2Recorder录制的文件，额外测试录制数据的读取和转换
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <benchmark/benchmark.h>
+
+#include "opencv2/opencv.hpp"
+#include "V4l2Capture.h"
+#include "V4l2ConvertKernels.h"
+#include "logger.h"
+#include "yolo.hpp"
+
+// -----------------------------------------
+//    heap allocation counter (operator new, UMatData of the OpenCV allocator included)
+// -----------------------------------------
+static std::atomic<unsigned long> heapAllocations(0);
+
+void* operator new(size_t size)
+{
+	heapAllocations++;
+	void* p = malloc(size ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+// -----------------------------------------
+//    synthetic inputs
+// -----------------------------------------
+static cv::Mat syntheticImage(int width, int height)
+{
+	// gradients plus noise, closer to a camera image than pure noise for the jpeg encoder
+	cv::Mat image(height, width, CV_8UC3);
+	for (int y = 0; y < height; ++y)
+	{
+		cv::Vec3b* row = image.ptr<cv::Vec3b>(y);
+		for (int x = 0; x < width; ++x)
+		{
+			row[x][0] = x * 255 / width;
+			row[x][1] = y * 255 / height;
+			row[x][2] = (x + y) & 0xff;
+		}
+	}
+	cv::Mat noise(height, width, CV_8UC3);
+	cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(16));
+	image += noise;
+	return image;
+}
+
+static std::vector<uchar> syntheticFrame(unsigned int format, int width, int height)
+{
+	std::vector<uchar> raw;
+	if (format == V4L2_PIX_FMT_MJPEG)
+	{
+		cv::imencode(".jpg", syntheticImage(width, height), raw);
+	}
+	else
+	{
+		bool packed = (format == V4L2_PIX_FMT_YUYV) || (format == V4L2_PIX_FMT_UYVY);
+		size_t size = packed ? width * height * 2 : width * height * 3 / 2;
+		raw.resize(size);
+		cv::Mat wrap(1, size, CV_8UC1, raw.data());
+		cv::randu(wrap, cv::Scalar::all(0), cv::Scalar::all(255));
+	}
+	return raw;
+}
+
+static Net_config benchConfig()
+{
+	Net_config config = yolo_net;
+	const char* dir = getenv("YOLO_DIR");
+	if (dir)
+	{
+		config.classesFile = std::string(dir) + "/voc.names";
+		config.modelConfiguration = std::string(dir) + "/yolo-fastest.cfg";
+		config.modelWeights = std::string(dir) + "/yolo-fastest_last.weights";
+	}
+	return config;
+}
+
+// -----------------------------------------
+//    V4l2Capture::read conversions
+// -----------------------------------------
+static void BM_Convert(benchmark::State& state, unsigned int format)
+{
+	int width = state.range(0);
+	int height = state.range(1);
+	std::vector<uchar> raw = syntheticFrame(format, width, height);
+	V4l2Planes planes;
+	planes.m_count = 1;
+	planes.m_data[0] = (char*)raw.data();
+	planes.m_size[0] = raw.size();
+	// resolved once like V4l2Capture does at stream start
+	V4l2ConvertFunction converter = V4l2Converter::find(format);
+	cv::Mat image;
+	for (auto _ : state)
+	{
+		image.release();
+		converter(planes, width, height, image);
+		benchmark::DoNotOptimize(image.data);
+	}
+	state.SetBytesProcessed(state.iterations() * raw.size());
+}
+BENCHMARK_CAPTURE(BM_Convert, YUYV, V4L2_PIX_FMT_YUYV)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_Convert, UYVY, V4L2_PIX_FMT_UYVY)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_Convert, NV12, V4L2_PIX_FMT_NV12)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_Convert, YUV420, V4L2_PIX_FMT_YUV420)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_Convert, MJPEG, V4L2_PIX_FMT_MJPEG)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMicrosecond);
+
+// the cvtColor calls the registry kernels replaced, as a reference
+static void BM_ConvertOpenCV(benchmark::State& state, unsigned int format)
+{
+	int width = state.range(0);
+	int height = state.range(1);
+	std::vector<uchar> raw = syntheticFrame(format, width, height);
+	cv::Mat wrap = (format == V4L2_PIX_FMT_YUYV) ? cv::Mat(height, width, CV_8UC2, raw.data()) : cv::Mat(height * 3 / 2, width, CV_8UC1, raw.data());
+	int code = (format == V4L2_PIX_FMT_YUYV) ? cv::COLOR_YUV2BGR_YUYV : ((format == V4L2_PIX_FMT_NV12) ? cv::COLOR_YUV2BGR_NV12 : cv::COLOR_YUV2BGR_I420);
+	cv::Mat image;
+	for (auto _ : state)
+	{
+		image.release();
+		cv::cvtColor(wrap, image, code);
+		benchmark::DoNotOptimize(image.data);
+	}
+	state.SetBytesProcessed(state.iterations() * raw.size());
+}
+BENCHMARK_CAPTURE(BM_ConvertOpenCV, YUYV, V4L2_PIX_FMT_YUYV)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_ConvertOpenCV, NV12, V4L2_PIX_FMT_NV12)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_ConvertOpenCV, YUV420, V4L2_PIX_FMT_YUV420)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMicrosecond);
+
+// -----------------------------------------
+//    V4l2Relay conversions, into a buffer like the mmap one
+// -----------------------------------------
+static void BM_ConvertBGR(benchmark::State& state, unsigned int format)
+{
+	int width = state.range(0);
+	int height = state.range(1);
+	cv::Mat image = syntheticImage(width, height);
+	bool packed = (format == V4L2_PIX_FMT_YUYV);
+	std::vector<uchar> raw(packed ? width * height * 2 : width * height * 3 / 2);
+	V4l2Planes planes;
+	planes.m_count = 1;
+	planes.m_data[0] = (char*)raw.data();
+	planes.m_size[0] = raw.size();
+	for (auto _ : state)
+	{
+		if (packed)
+			convertBGRToYUYV(image, planes, width, height);
+		else
+			convertBGRToNV12(image, planes, width, height);
+		benchmark::DoNotOptimize(raw.data());
+	}
+	state.SetBytesProcessed(state.iterations() * image.total() * 3);
+}
+BENCHMARK_CAPTURE(BM_ConvertBGR, YUYV, V4L2_PIX_FMT_YUYV)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_ConvertBGR, NV12, V4L2_PIX_FMT_NV12)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMicrosecond);
+
+// OpenCV has no BGR to packed 4:2:2, I420 is the closest reference
+static void BM_ConvertBGROpenCV(benchmark::State& state)
+{
+	cv::Mat image = syntheticImage(state.range(0), state.range(1));
+	cv::Mat yuv;
+	for (auto _ : state)
+	{
+		cv::cvtColor(image, yuv, cv::COLOR_BGR2YUV_I420);
+		benchmark::DoNotOptimize(yuv.data);
+	}
+	state.SetBytesProcessed(state.iterations() * image.total() * 3);
+}
+BENCHMARK(BM_ConvertBGROpenCV)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMicrosecond);
+
+// -----------------------------------------
+//    preprocessing
+// -----------------------------------------
+static void BM_BlobFromImage(benchmark::State& state)
+{
+	cv::Mat frame = syntheticImage(state.range(0), state.range(1));
+	cv::Mat blob;
+	for (auto _ : state)
+	{
+		blobFromImage(frame, blob, 1 / 255.0, Size(320, 320), Scalar(0, 0, 0), true, false);
+		benchmark::DoNotOptimize(blob.data);
+	}
+}
+BENCHMARK(BM_BlobFromImage)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMicrosecond);
+
+static void BM_Preprocess(benchmark::State& state)
+{
+	YOLO yolo(benchConfig());
+	cv::Mat frame = syntheticImage(state.range(0), state.range(1));
+	cv::Mat blob;
+	for (auto _ : state)
+	{
+		yolo.preprocess(frame, blob);
+		benchmark::DoNotOptimize(blob.data);
+	}
+}
+BENCHMARK(BM_Preprocess)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMicrosecond);
+
+// -----------------------------------------
+//    inference
+// -----------------------------------------
+static void BM_Forward(benchmark::State& state)
+{
+	Net_config config = benchConfig();
+	Net net = readNetFromDarknet(config.modelConfiguration, config.modelWeights);
+	net.setPreferableBackend(DNN_BACKEND_OPENCV);
+	net.setPreferableTarget(DNN_TARGET_CPU);
+	std::vector<String> names = net.getUnconnectedOutLayersNames();
+
+	cv::Mat blob;
+	blobFromImage(syntheticImage(state.range(0), state.range(1)), blob, 1 / 255.0, Size(), Scalar(0, 0, 0), true, false);
+	std::vector<Mat> outs;
+	for (auto _ : state)
+	{
+		net.setInput(blob);
+		net.forward(outs, names);
+		benchmark::DoNotOptimize(outs.data());
+	}
+}
+// network input sizes: square legacy input, 4:3 and 16:9 letterboxed inputs
+BENCHMARK(BM_Forward)->Args({320, 320})->Args({320, 256})->Args({320, 192})->Unit(benchmark::kMillisecond);
+
+static void BM_Postprocess(benchmark::State& state)
+{
+	YOLO yolo(benchConfig());
+	cv::Mat frame = syntheticImage(state.range(0), state.range(1));
+	cv::Mat blob;
+	yolo.preprocess(frame, blob);
+
+	Net_config config = benchConfig();
+	Net net = readNetFromDarknet(config.modelConfiguration, config.modelWeights);
+	net.setInput(blob);
+	std::vector<Mat> outs;
+	net.forward(outs, net.getUnconnectedOutLayersNames());
+
+	std::vector<Detection> detections;
+	for (auto _ : state)
+	{
+		yolo.postprocess(outs, detections);
+	}
+}
+BENCHMARK(BM_Postprocess)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMicrosecond);
+
+// steady state detect(): allocs is the number of operator new per frame, all threads included
+static void BM_Detect(benchmark::State& state)
+{
+	YOLO yolo(benchConfig());
+	cv::Mat frame = syntheticImage(state.range(0), state.range(1));
+	std::vector<Detection> detections;
+	// first frame sizes the kept buffers
+	yolo.detect(frame, detections);
+	unsigned long before = heapAllocations;
+	for (auto _ : state)
+	{
+		yolo.detect(frame, detections);
+	}
+	state.counters["allocs"] = benchmark::Counter(heapAllocations - before, benchmark::Counter::kAvgIterations);
+	state.counters["arena_fallbacks"] = yolo.getArenaFallbacks();
+	state.counters["arena_kb"] = yolo.getArenaPeak() / 1024;
+}
+BENCHMARK(BM_Detect)->Args({640, 480})->Args({1280, 720})->Unit(benchmark::kMillisecond);
+
+static void BM_NMSBoxes(benchmark::State& state)
+{
+	cv::RNG rng(42);
+	std::vector<Rect> boxes;
+	std::vector<float> scores;
+	for (int i = 0; i < state.range(0); ++i)
+	{
+		int x = rng.uniform(0, 1200);
+		int y = rng.uniform(0, 640);
+		boxes.push_back(Rect(x, y, rng.uniform(10, 80), rng.uniform(10, 80)));
+		scores.push_back(rng.uniform(0.5f, 1.0f));
+	}
+	std::vector<int> indices;
+	for (auto _ : state)
+	{
+		NMSBoxes(boxes, scores, 0.5f, 0.4f, indices);
+		benchmark::DoNotOptimize(indices.data());
+	}
+}
+BENCHMARK(BM_NMSBoxes)->Arg(10)->Arg(100)->Arg(1000)->Unit(benchmark::kMicrosecond);
+
+// -----------------------------------------
+//    recorded input: replay + read(cv::Mat&)
+// -----------------------------------------
+static void BM_ReadRecording(benchmark::State& state, std::string path)
+{
+	V4L2DeviceParameters param(path.c_str(), 0, 0, 0, -1);
+	V4l2Capture* capture = V4l2Capture::create(param, V4l2Access::IOTYPE_REPLAY);
+	if (capture == NULL)
+	{
+		state.SkipWithError("cannot open recording");
+		return;
+	}
+	cv::Mat image;
+	for (auto _ : state)
+	{
+		if (capture->read(image) == -1)
+		{
+			// end of the recording, rewind outside of the measure
+			state.PauseTiming();
+			capture->start();
+			state.ResumeTiming();
+			continue;
+		}
+		benchmark::DoNotOptimize(image.data);
+	}
+	state.SetLabel(cv::format("%ux%u", capture->getWidth(), capture->getHeight()));
+	delete capture;
+}
+
+int main(int argc, char** argv)
+{
+	const char* recording = getenv("BENCH_RECORDING");
+	if (recording)
+	{
+		benchmark::RegisterBenchmark("BM_ReadRecording", BM_ReadRecording, std::string(recording))->Unit(benchmark::kMicrosecond);
+	}
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+	benchmark::RunSpecifiedBenchmarks();
+	return 0;
+}
@@ -0,0 +1,322 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** vivid_bench.cpp
+** 
+** End-to-end capture -> detect benchmark, headless
+**
+** 没有UVC摄像头时使用内核虚拟摄像头:
+**   sudo modprobe vivid n_devs=1 && v4l2-ctl --list-devices
+**   ./e2e_bench -d /dev/video0 -f YUYV -W 640 -H 480 -r 60 -t 30 > result.json
+** -w 并行检测的线程数，-q 最多同时在检测或等待按顺序交付的帧数
+** -l 每帧检测的延迟预算(ms)，输入大小在 256/320/416 之间切换
+** -d 也可以是V4l2Recorder录制的文件
+** -k 每隔这么多秒按一次vivid的 "Disconnect" 控制(模拟USB拔出，所有文件句柄关闭后恢复)，
+**    统计V4l2Supervisor从发现断开到重新拿到第一帧的时间；真实摄像头也可以不加-k，手动拔插
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+#include "V4l2Supervisor.h"
+#include "logger.h"
+#include "yolo_pool.hpp"
+
+static double nowMs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+static double cpuMs()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+}
+
+// quotes, backslashes and control characters escaped for a JSON string
+static std::string jsonEscape(const char* text)
+{
+	std::string escaped;
+	for (const char* ptr = text; *ptr; ++ptr)
+	{
+		unsigned char c = (unsigned char)*ptr;
+		if ( (c == '"') || (c == '\\') )
+		{
+			escaped += '\\';
+			escaped += (char)c;
+		}
+		else if (c < 0x20)
+		{
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", c);
+			escaped += code;
+		}
+		else
+		{
+			escaped += (char)c;
+		}
+	}
+	return escaped;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	return sorted[std::min(sorted.size() - 1, (size_t)(sorted.size() * p))];
+}
+
+struct CapturedFrame
+{
+	cv::Mat image;
+	double timestamp; // buffer timestamp, ms CLOCK_MONOTONIC
+	unsigned int sequence;
+};
+
+struct BenchState
+{
+	BenchState() : stop(false), ready(false), captured(0), sequenceDrops(0), pipelineDrops(0), errors(0) {}
+	std::atomic<bool> stop;
+	std::mutex lock;
+	std::condition_variable cond;
+	CapturedFrame latest;
+	bool ready;
+	unsigned long captured;
+	unsigned long sequenceDrops; // frames the driver skipped
+	unsigned long pipelineDrops; // frames replaced before detection picked them up
+	unsigned long errors;
+};
+
+// vivid error injection control, the id is the same after a reopen
+static bool findControl(V4l2Capture* capture, const char* name, unsigned int& id)
+{
+	std::list<V4l2Control> controls = capture->enumerateControls();
+	for (std::list<V4l2Control>::const_iterator it = controls.begin(); it != controls.end(); ++it)
+	{
+		if (it->m_name == name)
+		{
+			id = it->m_id;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void captureLoop(V4l2Supervisor* supervisor, BenchState* state, unsigned int disconnectId, double disconnectEvery)
+{
+	bool first = true;
+	unsigned int lastSequence = 0;
+	size_t recoveries = 0;
+	double nextDisconnect = (disconnectEvery > 0) ? nowMs() + disconnectEvery * 1000 : 0;
+	while (!state->stop)
+	{
+		if ( (nextDisconnect > 0) && (nowMs() >= nextDisconnect) && supervisor->isConnected() )
+		{
+			supervisor->getCapture()->setControl(disconnectId, 1);
+			nextDisconnect = nowMs() + disconnectEvery * 1000;
+		}
+		CapturedFrame frame;
+		int ret = supervisor->read(frame.image, 1000);
+		if (ret == -1)
+		{
+			state->errors++;
+			state->stop = true;
+			break;
+		}
+		if ( (ret == 0) || frame.image.empty() )
+			continue;
+		V4l2Capture* capture = supervisor->getCapture();
+		const timeval& ts = capture->getTimestamp();
+		frame.timestamp = ts.tv_sec * 1000.0 + ts.tv_usec / 1000.0;
+		frame.sequence = capture->getSequence();
+		if (supervisor->getRecoveries().size() != recoveries)
+		{
+			// the sequence restarts with the reopened stream, the outage is counted as recovery time
+			recoveries = supervisor->getRecoveries().size();
+			first = true;
+		}
+		if (!first && frame.sequence > lastSequence + 1)
+		{
+			state->sequenceDrops += frame.sequence - lastSequence - 1;
+		}
+		first = false;
+		lastSequence = frame.sequence;
+
+		std::lock_guard<std::mutex> guard(state->lock);
+		if (state->ready)
+			state->pipelineDrops++;
+		state->latest = frame;
+		state->ready = true;
+		state->captured++;
+		state->cond.notify_one();
+	}
+	state->cond.notify_one();
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "%s [-d device|recording] [-f fourcc] [-W width] [-H height] [-r fps] [-t seconds] [-m modeldir] [-w workers [-q frames]] [-l ms] [-k seconds]\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* device = "/dev/video0";
+	const char* fourcc = "YUYV";
+	unsigned int width = 640;
+	unsigned int height = 480;
+	int fps = 30;
+	double duration = 10;
+	Net_config config = yolo_net;
+	int workers = 1;
+	int maxInFlight = 0;
+	double disconnectEvery = 0;
+
+	int c = 0;
+	while ((c = getopt(argc, argv, "d:f:W:H:r:t:m:w:q:l:k:h")) != -1)
+	{
+		switch (c)
+		{
+			case 'd': device = optarg; break;
+			case 'f': fourcc = optarg; break;
+			case 'W': width = atoi(optarg); break;
+			case 'H': height = atoi(optarg); break;
+			case 'r': fps = atoi(optarg); break;
+			case 't': duration = atof(optarg); break;
+			case 'w': workers = std::max(1, atoi(optarg)); break;
+			case 'q': maxInFlight = atoi(optarg); break;
+			case 'k': disconnectEvery = atof(optarg); break;
+			case 'l':
+				config.latencyBudget = atof(optarg);
+				config.inputWidths = { 256, 416 };
+			break;
+			case 'm':
+				config.classesFile = std::string(optarg) + "/voc.names";
+				config.modelConfiguration = std::string(optarg) + "/yolo-fastest.cfg";
+				config.modelWeights = std::string(optarg) + "/yolo-fastest_last.weights";
+			break;
+			default: usage(argv[0]); return -1;
+		}
+	}
+	if (strlen(fourcc) != 4)
+	{
+		usage(argv[0]);
+		return -1;
+	}
+
+	// results go to stdout as json, library logs and YOLO messages are sent to stderr
+	std::cout.rdbuf(std::cerr.rdbuf());
+
+	struct stat sb;
+	bool replay = (stat(device, &sb) == 0) && S_ISREG(sb.st_mode);
+	V4L2DeviceParameters param(device, v4l2_fourcc(fourcc[0], fourcc[1], fourcc[2], fourcc[3]), width, height, fps);
+	V4l2Supervisor* supervisor = V4l2Supervisor::create(param, replay ? V4l2Access::IOTYPE_REPLAY : V4l2Access::IOTYPE_MMAP);
+	if (supervisor == NULL)
+	{
+		fprintf(stderr, "Cannot open %s\n", device);
+		return -1;
+	}
+	// the capture is replaced on each recovery, keep what the report needs
+	V4l2Capture* capture = supervisor->getCapture();
+	unsigned int format = capture->getFormat();
+	unsigned int capturedWidth = capture->getWidth();
+	unsigned int capturedHeight = capture->getHeight();
+	unsigned int disconnectId = 0;
+	if ( (disconnectEvery > 0) && !findControl(capture, "Disconnect", disconnectId) )
+	{
+		fprintf(stderr, "%s has no Disconnect control (vivid), -k ignored\n", device);
+		disconnectEvery = 0;
+	}
+
+	BenchState state;
+	std::vector<double> latencies;
+	latencies.reserve(duration * 240);
+	unsigned long detected = 0;
+	if (workers > 1)
+		cv::setNumThreads(1);
+	// results come in capture order, one callback at a time
+	YOLOPool pool(config, workers, maxInFlight > 0 ? maxInFlight : workers, [&latencies, &detected](const PoolResult& result) {
+		latencies.push_back(nowMs() - result.timestamp / 1000.0);
+		detected++;
+	});
+
+	std::thread captureThread(captureLoop, supervisor, &state, disconnectId, disconnectEvery);
+	double start = nowMs();
+	double cpuStart = cpuMs();
+	while (!state.stop && (nowMs() - start) < duration * 1000)
+	{
+		if (!pool.waitReady(100))
+			continue;
+		CapturedFrame frame;
+		{
+			std::unique_lock<std::mutex> guard(state.lock);
+			state.cond.wait_for(guard, std::chrono::milliseconds(100), [&state] { return state.ready || state.stop; });
+			if (!state.ready)
+				continue;
+			frame = state.latest;
+			state.latest.image.release();
+			state.ready = false;
+		}
+		pool.submit(frame.image, (uint64_t)(frame.timestamp * 1000), frame.sequence);
+	}
+	pool.stop();
+	double elapsed = (nowMs() - start) / 1000.0;
+	double cpu = cpuMs() - cpuStart;
+	state.stop = true;
+	captureThread.join();
+
+	std::sort(latencies.begin(), latencies.end());
+	const std::vector<V4l2Recovery>& recoveries = supervisor->getRecoveries();
+	std::vector<double> outages, reopens;
+	for (size_t i = 0; i < recoveries.size(); ++i)
+	{
+		outages.push_back(recoveries[i].m_outageMs);
+		reopens.push_back(recoveries[i].m_reopenMs);
+	}
+	std::sort(outages.begin(), outages.end());
+	std::sort(reopens.begin(), reopens.end());
+	capture = supervisor->getCapture();
+	printf("{\n");
+	printf("  \"device\": \"%s\",\n", jsonEscape(device).c_str());
+	printf("  \"format\": \"%c%c%c%c\",\n", format & 0xff, (format >> 8) & 0xff, (format >> 16) & 0xff, (format >> 24) & 0xff);
+	printf("  \"width\": %u,\n  \"height\": %u,\n  \"requested_fps\": %d,\n", capturedWidth, capturedHeight, fps);
+	printf("  \"duration_s\": %.3f,\n", elapsed);
+	printf("  \"captured_frames\": %lu,\n  \"detected_frames\": %lu,\n", state.captured, detected);
+	printf("  \"configured_fps\": %.2f,\n  \"camera_fps\": %.2f,\n", capture ? capture->getConfiguredFps() : 0, capture ? capture->getMeasuredFps() : 0);
+	printf("  \"capture_fps\": %.2f,\n  \"detect_fps\": %.2f,\n", state.captured / elapsed, detected / elapsed);
+	printf("  \"dropped_sequence\": %lu,\n  \"dropped_pipeline\": %lu,\n  \"errors\": %lu,\n", state.sequenceDrops, state.pipelineDrops, state.errors);
+	printf("  \"recoveries\": %zu,\n  \"connected\": %s,\n", recoveries.size(), supervisor->isConnected() ? "true" : "false");
+	printf("  \"recovery_ms\": { \"p50\": %.1f, \"max\": %.1f },\n", percentile(outages, 0.5), outages.empty() ? 0 : outages.back());
+	printf("  \"reopen_ms\": { \"p50\": %.1f, \"max\": %.1f },\n", percentile(reopens, 0.5), reopens.empty() ? 0 : reopens.back());
+	printf("  \"cpu_percent\": %.1f,\n", cpu / (elapsed * 10.0));
+	printf("  \"workers\": %d,\n", pool.size());
+	printf("  \"latency_budget_ms\": %.1f,\n  \"input\": \"%dx%d\",\n  \"input_switches\": %lu,\n", config.latencyBudget,
+	       pool.model(0).getInputSize().width, pool.model(0).getInputSize().height, pool.model(0).getInputSwitches());
+	printf("  \"arena_peak_kb\": %zu,\n  \"arena_fallbacks\": %lu,\n", pool.model(0).getArenaPeak() / 1024, pool.getArenaFallbacks());
+	printf("  \"latency_ms\": { \"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f }\n",
+	       percentile(latencies, 0), percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99), latencies.empty() ? 0 : latencies.back());
+	printf("}\n");
+
+	delete supervisor;
+	return 0;
+}
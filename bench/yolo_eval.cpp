@@ -0,0 +1,438 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** yolo_eval.cpp
+**
+** Accuracy (mAP, precision, recall) and latency/memory of each weights file
+**
+** 数据集使用darknet的格式: 列表文件每行一张图片，标注在同名的 .txt 中
+** (路径里的 images/JPEGImages 换成 labels)，每行 "class cx cy w h"，坐标已归一化。
+**   ./yolo_eval -l valid.txt -w yolo/yolo-fastest_10000.weights,yolo/yolo-fastest_last.weights -s 320,320x192 > eval.json
+**
+** 精度测试每个核一个YOLO实例并行跑完整个数据集；延迟和内存单独用一个实例、
+** 默认的OpenCV线程数顺序测试，与main.cpp里的用法一致。
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+#include "yolo.hpp"
+
+static double nowMs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// resident set size in MB
+static double rssMb()
+{
+	long pages = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm == NULL)
+		return 0;
+	if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+		resident = 0;
+	fclose(statm);
+	return resident * (double)sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	return sorted[std::min(sorted.size() - 1, (size_t)(sorted.size() * p))];
+}
+
+static std::vector<std::string> split(const std::string& list, char separator)
+{
+	std::vector<std::string> items;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, separator))
+	{
+		if (!item.empty())
+			items.push_back(item);
+	}
+	return items;
+}
+
+// -----------------------------------------
+//    dataset
+// -----------------------------------------
+struct GroundTruth
+{
+	int classId;
+	cv::Rect2f box; // normalised
+};
+
+struct Sample
+{
+	std::string image;
+	std::vector<GroundTruth> truths;
+};
+
+static std::string labelPath(const std::string& image)
+{
+	std::string path = image;
+	const char* dirs[][2] = { { "/images/", "/labels/" }, { "/JPEGImages/", "/labels/" } };
+	for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); ++i)
+	{
+		size_t pos = path.rfind(dirs[i][0]);
+		if (pos != std::string::npos)
+		{
+			path.replace(pos, strlen(dirs[i][0]), dirs[i][1]);
+			break;
+		}
+	}
+	size_t dot = path.rfind('.');
+	if (dot != std::string::npos && path.find('/', dot) == std::string::npos)
+		path.erase(dot);
+	path += ".txt";
+
+	struct stat sb;
+	if (stat(path.c_str(), &sb) != 0)
+	{
+		// labels next to the image
+		path = image.substr(0, image.rfind('.')) + ".txt";
+	}
+	return path;
+}
+
+static bool loadDataset(const char* listFile, std::vector<Sample>& samples)
+{
+	std::ifstream list(listFile);
+	if (!list)
+	{
+		fprintf(stderr, "Cannot read %s\n", listFile);
+		return false;
+	}
+	std::string line;
+	while (std::getline(list, line))
+	{
+		line.erase(line.find_last_not_of(" \t\r") + 1);
+		if (line.empty())
+			continue;
+		Sample sample;
+		sample.image = line;
+		std::ifstream labels(labelPath(line).c_str());
+		GroundTruth truth;
+		float cx, cy, w, h;
+		while (labels >> truth.classId >> cx >> cy >> w >> h)
+		{
+			truth.box = cv::Rect2f(cx - w / 2, cy - h / 2, w, h);
+			sample.truths.push_back(truth);
+		}
+		samples.push_back(sample);
+	}
+	return !samples.empty();
+}
+
+// -----------------------------------------
+//    VOC style average precision
+// -----------------------------------------
+struct ScoredDetection
+{
+	float confidence;
+	size_t sample;
+	cv::Rect2f box; // normalised
+};
+
+static bool higherConfidence(const ScoredDetection& a, const ScoredDetection& b)
+{
+	return a.confidence > b.confidence;
+}
+
+static float iou(const cv::Rect2f& a, const cv::Rect2f& b)
+{
+	float inter = (a & b).area();
+	float total = a.area() + b.area() - inter;
+	return total > 0 ? inter / total : 0;
+}
+
+struct ClassResult
+{
+	ClassResult() : truths(0), ap(0), tp(0), fp(0) {}
+	unsigned long truths;
+	double ap;
+	unsigned long tp; // at the operating threshold
+	unsigned long fp;
+};
+
+static ClassResult evaluateClass(int classId, const std::vector<Sample>& samples, std::vector<ScoredDetection>& detections, float iouThreshold, float operatingThreshold)
+{
+	ClassResult result;
+	std::vector< std::vector<bool> > matched(samples.size());
+	for (size_t s = 0; s < samples.size(); ++s)
+	{
+		matched[s].resize(samples[s].truths.size(), false);
+		for (size_t t = 0; t < samples[s].truths.size(); ++t)
+		{
+			if (samples[s].truths[t].classId == classId)
+				result.truths++;
+		}
+	}
+
+	std::sort(detections.begin(), detections.end(), higherConfidence);
+	std::vector<double> precision, recall;
+	unsigned long tp = 0, fp = 0;
+	for (size_t d = 0; d < detections.size(); ++d)
+	{
+		const ScoredDetection& det = detections[d];
+		const std::vector<GroundTruth>& truths = samples[det.sample].truths;
+		float best = 0;
+		int bestIndex = -1;
+		for (size_t t = 0; t < truths.size(); ++t)
+		{
+			if (truths[t].classId != classId)
+				continue;
+			float overlap = iou(det.box, truths[t].box);
+			if (overlap > best)
+			{
+				best = overlap;
+				bestIndex = t;
+			}
+		}
+		// each ground truth matches once, duplicates are false positives
+		if (bestIndex >= 0 && best >= iouThreshold && !matched[det.sample][bestIndex])
+		{
+			matched[det.sample][bestIndex] = true;
+			tp++;
+		}
+		else
+		{
+			fp++;
+		}
+		if (det.confidence >= operatingThreshold)
+		{
+			result.tp = tp;
+			result.fp = fp;
+		}
+		precision.push_back((double)tp / (tp + fp));
+		recall.push_back(result.truths ? (double)tp / result.truths : 0);
+	}
+
+	// area under the monotone precision envelope (all points, VOC2010+)
+	for (size_t i = precision.size(); i-- > 1; )
+		precision[i - 1] = std::max(precision[i - 1], precision[i]);
+	double previousRecall = 0;
+	for (size_t i = 0; i < precision.size(); ++i)
+	{
+		result.ap += (recall[i] - previousRecall) * precision[i];
+		previousRecall = recall[i];
+	}
+	return result;
+}
+
+// -----------------------------------------
+//    runs
+// -----------------------------------------
+static void evalWorker(Net_config config, const std::vector<Sample>* samples, std::vector< std::vector<Detection> >* results, std::vector<cv::Size>* sizes, std::atomic<size_t>* next)
+{
+	YOLO yolo(config);
+	size_t index;
+	while ((index = (*next)++) < samples->size())
+	{
+		cv::Mat image = cv::imread((*samples)[index].image, cv::IMREAD_COLOR);
+		if (image.empty())
+		{
+			fprintf(stderr, "Cannot read %s\n", (*samples)[index].image.c_str());
+			continue;
+		}
+		(*sizes)[index] = image.size();
+		yolo.detect(image, (*results)[index]);
+	}
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "%s -l list [-w weights,...] [-c cfg] [-n names] [-s W[xH],...] [-j jobs] [-i iou] [-t conf] [-k latencyFrames] [-L]\n", name);
+	fprintf(stderr, "\t -s 320x192 : network input size, W alone is square, Wx0 follows the image aspect\n");
+	fprintf(stderr, "\t -t conf    : operating threshold for precision/recall (default from yolo.hpp)\n");
+	fprintf(stderr, "\t -L         : keep the letterbox of yolo.hpp off (stretch the image)\n");
+}
+
+int main(int argc, char* argv[])
+{
+	const char* listFile = NULL;
+	Net_config config = yolo_net;
+	std::vector<std::string> weights;
+	std::vector<std::string> inputs;
+	unsigned int jobs = std::max(1u, std::thread::hardware_concurrency());
+	float iouThreshold = 0.5f;
+	float operatingThreshold = yolo_net.confThreshold;
+	size_t latencyFrames = 200;
+
+	int c = 0;
+	while ((c = getopt(argc, argv, "l:w:c:n:s:j:i:t:k:Lh")) != -1)
+	{
+		switch (c)
+		{
+			case 'l': listFile = optarg; break;
+			case 'w': weights = split(optarg, ','); break;
+			case 'c': config.modelConfiguration = optarg; break;
+			case 'n': config.classesFile = optarg; break;
+			case 's': inputs = split(optarg, ','); break;
+			case 'j': jobs = std::max(1, atoi(optarg)); break;
+			case 'i': iouThreshold = atof(optarg); break;
+			case 't': operatingThreshold = atof(optarg); break;
+			case 'k': latencyFrames = atoi(optarg); break;
+			case 'L': config.keepAspect = false; break;
+			default: usage(argv[0]); return -1;
+		}
+	}
+	if (listFile == NULL)
+	{
+		usage(argv[0]);
+		return -1;
+	}
+	if (weights.empty())
+		weights.push_back(config.modelWeights);
+	if (inputs.empty())
+		inputs.push_back(std::to_string(config.inpWidth) + "x" + std::to_string(config.inpHeight));
+
+	// results go to stdout as json, YOLO messages are sent to stderr
+	std::cout.rdbuf(std::cerr.rdbuf());
+
+	std::vector<Sample> samples;
+	if (!loadDataset(listFile, samples))
+	{
+		fprintf(stderr, "No image in %s\n", listFile);
+		return -1;
+	}
+	std::vector<std::string> classes;
+	{
+		std::ifstream names(config.classesFile.c_str());
+		std::string line;
+		while (std::getline(names, line))
+			classes.push_back(line);
+	}
+	int defaultThreads = cv::getNumThreads();
+
+	printf("{\n  \"images\": %zu,\n  \"iou_threshold\": %.2f,\n  \"operating_threshold\": %.3f,\n  \"jobs\": %u,\n  \"runs\": [\n",
+	       samples.size(), iouThreshold, operatingThreshold, jobs);
+	bool firstRun = true;
+	for (size_t w = 0; w < weights.size(); ++w)
+	{
+		for (size_t s = 0; s < inputs.size(); ++s)
+		{
+			Net_config run = config;
+			run.modelWeights = weights[w];
+			run.inpWidth = atoi(inputs[s].c_str());
+			size_t x = inputs[s].find('x');
+			run.inpHeight = (x == std::string::npos) ? run.inpWidth : atoi(inputs[s].c_str() + x + 1);
+
+			// latency and memory: one instance, sequential, OpenCV threads and threshold as in production,
+			// at 0.005 the candidates and the NMS would cost far more than at the operating threshold
+			cv::setNumThreads(defaultThreads);
+			double rssBefore = rssMb();
+			std::vector<double> latencies;
+			double rssModel = 0;
+			{
+				Net_config timed = run;
+				timed.confThreshold = operatingThreshold;
+				YOLO yolo(timed);
+				std::vector<Detection> detections;
+				size_t frames = std::min(samples.size(), latencyFrames + 5);
+				for (size_t i = 0; i < frames; ++i)
+				{
+					cv::Mat image = cv::imread(samples[i].image, cv::IMREAD_COLOR);
+					if (image.empty())
+						continue;
+					double start = nowMs();
+					yolo.detect(image, detections);
+					// the first frames allocate the layers
+					if (i >= 5 || frames <= 5)
+						latencies.push_back(nowMs() - start);
+				}
+				rssModel = rssMb() - rssBefore;
+			}
+			std::sort(latencies.begin(), latencies.end());
+
+			// accuracy: one single threaded instance per job, every candidate kept for the precision/recall curve
+			run.confThreshold = 0.005f;
+			cv::setNumThreads(1);
+			std::vector< std::vector<Detection> > results(samples.size());
+			std::vector<cv::Size> sizes(samples.size());
+			std::atomic<size_t> next(0);
+			double start = nowMs();
+			std::vector<std::thread> workers;
+			for (unsigned int j = 0; j < jobs; ++j)
+				workers.push_back(std::thread(evalWorker, run, &samples, &results, &sizes, &next));
+			for (size_t j = 0; j < workers.size(); ++j)
+				workers[j].join();
+			double elapsed = nowMs() - start;
+
+			std::vector< std::vector<ScoredDetection> > perClass(classes.size());
+			for (size_t i = 0; i < samples.size(); ++i)
+			{
+				if (sizes[i].area() == 0)
+					continue;
+				for (size_t d = 0; d < results[i].size(); ++d)
+				{
+					const Detection& det = results[i][d];
+					if (det.classId < 0 || det.classId >= (int)classes.size())
+						continue;
+					ScoredDetection scored;
+					scored.confidence = det.confidence;
+					scored.sample = i;
+					scored.box = cv::Rect2f((float)det.box.x / sizes[i].width, (float)det.box.y / sizes[i].height,
+					                        (float)det.box.width / sizes[i].width, (float)det.box.height / sizes[i].height);
+					perClass[det.classId].push_back(scored);
+				}
+			}
+
+			printf("%s    {\n", firstRun ? "" : ",\n");
+			firstRun = false;
+			printf("      \"weights\": \"%s\",\n      \"input\": \"%dx%d\",\n", run.modelWeights.c_str(), run.inpWidth, run.inpHeight);
+			printf("      \"latency_ms\": { \"frames\": %zu, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+			       latencies.size(), latencies.empty() ? 0 : std::accumulate(latencies.begin(), latencies.end(), 0.0) / latencies.size(),
+			       percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99), latencies.empty() ? 0 : latencies.back());
+			printf("      \"model_rss_mb\": %.1f,\n      \"eval_images_per_s\": %.1f,\n      \"classes\": [\n", rssModel, samples.size() * 1000.0 / elapsed);
+
+			double sumAp = 0;
+			unsigned int evaluated = 0;
+			unsigned long tp = 0, fp = 0, truths = 0;
+			for (size_t k = 0; k < classes.size(); ++k)
+			{
+				ClassResult result = evaluateClass(k, samples, perClass[k], iouThreshold, operatingThreshold);
+				if (result.truths)
+				{
+					sumAp += result.ap;
+					evaluated++;
+				}
+				tp += result.tp;
+				fp += result.fp;
+				truths += result.truths;
+				printf("        { \"class\": \"%s\", \"ground_truths\": %lu, \"ap\": %.4f, \"precision\": %.4f, \"recall\": %.4f }%s\n",
+				       classes[k].c_str(), result.truths, result.ap,
+				       (result.tp + result.fp) ? (double)result.tp / (result.tp + result.fp) : 0,
+				       result.truths ? (double)result.tp / result.truths : 0,
+				       (k + 1 < classes.size()) ? "," : "");
+			}
+			printf("      ],\n      \"map\": %.4f,\n      \"precision\": %.4f,\n      \"recall\": %.4f\n    }",
+			       evaluated ? sumAp / evaluated : 0, (tp + fp) ? (double)tp / (tp + fp) : 0, truths ? (double)tp / truths : 0);
+			fflush(stdout);
+		}
+	}
+	printf("\n  ]\n}\n");
+	return 0;
+}
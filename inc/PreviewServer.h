@@ -0,0 +1,98 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** PreviewServer.h
+**
+** MJPEG over HTTP preview of the processed frames
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef PREVIEW_SERVER
+#define PREVIEW_SERVER
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "opencv2/core/core.hpp"
+
+/*
+ * 浏览器或者 ffplay/curl 打开 http://127.0.0.1:port/ 即可看到 multipart/x-mixed-replace 的MJPEG流。
+ *
+ * 处理线程只调用 publish:
+ *   - 没有客户端连接或者还没到下一帧预览的时间时直接返回，不拷贝也不编码
+ *   - 否则只拷贝一次图像并唤醒服务线程
+ * 服务线程对每帧只编码一次，所有客户端共享同一个缓存；上一帧还没发完的慢客户端跳过这一帧。
+ */
+class PreviewServer
+{
+	protected:
+		PreviewServer(int listenFd, int wakeFd, double fps, int quality);
+
+	public:
+		/**
+		 * @brief create 监听 address:port
+		 * @param fps 预览帧率上限，与处理帧率无关
+		 * @param quality jpeg质量
+		 * @param address 默认只监听本机
+		 */
+		static PreviewServer* create(unsigned short port, double fps = 10, int quality = 80, const std::string & address = "127.0.0.1");
+		virtual ~PreviewServer();
+
+		/**
+		 * @brief wantsFrame 有客户端并且到了下一帧预览的时间
+		 */
+		bool wantsFrame() const;
+		/**
+		 * @brief publish 提交一帧BGR图像，不需要时立即返回
+		 */
+		void publish(const cv::Mat & image);
+
+		unsigned int getClients() const { return m_clients; }
+		unsigned long getSkipped() const { return m_skipped; }
+
+	private:
+		PreviewServer(const PreviewServer&);
+		PreviewServer & operator=(const PreviewServer&);
+
+	protected:
+		typedef std::shared_ptr< const std::vector<unsigned char> > Payload;
+		struct Client
+		{
+			int fd;
+			std::string request;  // HTTP request until the empty line
+			bool streaming;
+			Payload payload;      // part being sent, shared by all the clients
+			size_t sent;
+		};
+		void serverLoop();
+		void acceptClient();
+		bool readRequest(Client & client);
+		bool flush(Client & client);
+		void broadcast();
+		void closeClient(size_t index);
+
+	protected:
+		int m_listenFd;
+		int m_wakeFd;
+		int64_t m_period;                    // us between two preview frames
+		int m_quality;
+		std::vector<Client> m_clientList;    // server thread only
+		std::atomic<unsigned int> m_clients; // streaming clients
+		std::atomic<int64_t> m_nextFrame;    // steady clock us
+		std::atomic<unsigned long> m_skipped;
+		std::atomic<bool> m_stop;
+		std::mutex m_mutex;
+		cv::Mat m_pending;
+		bool m_hasPending;
+		std::thread m_server;
+};
+
+#endif
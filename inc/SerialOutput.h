@@ -0,0 +1,95 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** SerialOutput.h
+**
+** Compact CRC checked detection frames sent to the control board over a UART
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef SERIAL_OUTPUT
+#define SERIAL_OUTPUT
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "SharedResults.h"
+
+/*
+ * 每帧一个数据包，多字节字段都是小端:
+ *   0xAA 0x55           同步字
+ *   uint8  version      SERIAL_OUTPUT_VERSION
+ *   uint8  count        检测框个数
+ *   uint32 sequence     V4L2帧序号
+ *   uint32 timestamp    采集时间 CLOCK_MONOTONIC 的低32位，单位us
+ *   count 个 { uint8 classId(voc.names中的行号), uint8 score(confidence*255), int16 x, y, width, height,
+ *              int16 X, Y, Z 相机坐标系下的位置，单位mm，Z为0表示没有深度 }
+ *   uint16 crc          CRC-16/CCITT-FALSE，从version到最后一个检测框
+ *
+ * send 只在调用线程里打包，写串口在单独的线程。串口来不及发送时只保留最新的一包，
+ * 旧的直接丢弃(getDropped)，控制板总是拿到最新的结果。
+ */
+#define SERIAL_OUTPUT_VERSION   2
+#define SERIAL_OUTPUT_SYNC0     0xAA
+#define SERIAL_OUTPUT_SYNC1     0x55
+
+class SerialOutput
+{
+	protected:
+		SerialOutput(const std::string & device, int fd, unsigned int maxDetections);
+
+	public:
+		/**
+		 * @brief create 打开串口(或者pty)，设置为raw模式
+		 * @param baud 波特率，例如 115200, 921600
+		 * @param maxDetections 每包最多的检测框，按置信度排序后截断
+		 */
+		static SerialOutput* create(const std::string & device, unsigned int baud = 115200, unsigned int maxDetections = 16);
+		virtual ~SerialOutput();
+
+		/**
+		 * @brief send 打包一帧的检测结果交给写线程，不会阻塞
+		 * @param timestamp 采集时间，us
+		 */
+		void send(uint32_t sequence, uint64_t timestamp, const std::vector<SharedDetection> & detections);
+
+		unsigned long getSent() const { return m_sent; }
+		unsigned long getDropped() const { return m_dropped; }
+
+		/**
+		 * @brief encode 打包一帧，方便接收端测试
+		 */
+		static void encode(uint32_t sequence, uint64_t timestamp, const std::vector<SharedDetection> & detections, unsigned int maxDetections, std::vector<unsigned char> & packet);
+		static uint16_t crc16(const unsigned char* data, size_t size);
+
+	private:
+		SerialOutput(const SerialOutput&);
+		SerialOutput & operator=(const SerialOutput&);
+
+	protected:
+		void writerLoop();
+
+	protected:
+		std::string m_device;
+		int m_fd;
+		unsigned int m_maxDetections;
+		std::vector<unsigned char> m_pending;  // latest packet not taken by the writer yet
+		std::vector<unsigned char> m_packet;   // packet built by send, swapped with m_pending
+		bool m_hasPending;
+		std::atomic<bool> m_stop;
+		std::atomic<unsigned long> m_sent;
+		std::atomic<unsigned long> m_dropped;
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::thread m_writer;
+};
+
+#endif
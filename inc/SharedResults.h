@@ -0,0 +1,162 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** SharedResults.h
+**
+** Detections and frames published to other processes through POSIX shared memory
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef SHARED_RESULTS
+#define SHARED_RESULTS
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+/*
+ * /dev/shm/<name> 的布局:
+ *   SharedResultsHeader
+ *   slotCount 个槽，每个槽 slotSize 字节: SharedResultSlot + maxDetections 个 SharedDetection + 图像数据
+ *
+ * 每个槽是一个seqlock: 写之前 sequence 置为奇数，写完置为偶数，最后更新 header.latest。
+ * 写进程从不等待读进程；读进程先读 sequence，拷贝检测结果，再确认 sequence 没有变化。
+ * 图像不拷贝，读进程直接使用共享内存中的数据，用完后调用 SharedSubscriber::valid 确认
+ * 这段时间里槽没有被覆盖(环形缓存有 slotCount 帧的余量)。
+ */
+#define SHARED_RESULTS_MAGIC    0x53455234 /* "4RES" */
+#define SHARED_RESULTS_VERSION  2
+
+struct SharedDetection
+{
+	int32_t classId;
+	float confidence;
+	int32_t x;
+	int32_t y;
+	int32_t width;
+	int32_t height;
+	float position[3];   // target in the colour camera frame, metres, z = 0 when the depth is unknown
+};
+
+struct SharedResultsHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slotCount;
+	uint32_t maxDetections;
+	uint64_t frameCapacity;  // bytes of image per slot, 0 = detections only
+	uint64_t slotSize;
+	uint64_t latest;         // last complete frame id + 1, 0 = nothing published yet
+	uint32_t writerPid;
+	uint32_t reserved[7];
+};
+
+struct SharedResultSlot
+{
+	uint64_t sequence;       // 2 * frameId + 1 while writing, 2 * frameId + 2 when complete
+	uint64_t frameId;
+	uint64_t timestamp;      // CLOCK_MONOTONIC us
+	double inferenceTime;    // ms
+	uint32_t count;          // detections
+	uint32_t width;          // image, 0 when the slot has no image
+	uint32_t height;
+	uint32_t type;           // cv::Mat type
+	uint64_t step;
+};
+
+// -----------------------------------------
+//    writer side
+// -----------------------------------------
+class SharedPublisher
+{
+	protected:
+		SharedPublisher(const std::string & name, char* memory, size_t size);
+
+	public:
+		/**
+		 * @brief create 创建(或者重建) /dev/shm/name
+		 * @param slotCount 环形缓存的帧数，读进程可以持有图像的时间
+		 * @param frameCapacity 每帧图像的最大字节数，0表示只发布检测结果
+		 */
+		static SharedPublisher* create(const std::string & name, unsigned int slotCount = 4, unsigned int maxDetections = 64, size_t frameCapacity = 0);
+		virtual ~SharedPublisher();
+
+		/**
+		 * @brief publish 发布一帧的检测结果，frame为空或者超过frameCapacity时不带图像
+		 * @return 帧号
+		 */
+		uint64_t publish(const std::vector<SharedDetection> & detections, double inferenceTime, const cv::Mat & frame = cv::Mat());
+
+	private:
+		SharedPublisher(const SharedPublisher&);
+		SharedPublisher & operator=(const SharedPublisher&);
+
+	protected:
+		std::string m_name;
+		char* m_memory;
+		size_t m_size;
+		SharedResultsHeader* m_header;
+		uint64_t m_frameId;
+};
+
+// -----------------------------------------
+//    reader side
+// -----------------------------------------
+struct SharedResult
+{
+	SharedResult() : frameId(0), timestamp(0), inferenceTime(0), slot(NULL), sequence(0) {}
+
+	uint64_t frameId;
+	uint64_t timestamp;
+	double inferenceTime;
+	std::vector<SharedDetection> detections;
+	cv::Mat frame;           // points into the shared memory, check valid() after using it
+	const SharedResultSlot* slot;
+	uint64_t sequence;
+};
+
+class SharedSubscriber
+{
+	protected:
+		SharedSubscriber(char* memory, size_t size);
+
+	public:
+		static SharedSubscriber* open(const std::string & name);
+		virtual ~SharedSubscriber();
+
+		/**
+		 * @brief latest 最新完成的帧号+1，0表示还没有发布过，可以用来自旋等待
+		 */
+		uint64_t latest() const;
+		/**
+		 * @brief read 读取最新的一帧
+		 * @return 还没有发布过或者写进程正在覆盖这个槽时返回false
+		 */
+		bool read(SharedResult & result);
+		/**
+		 * @brief wait 等到有比 frameId 新的结果，timeoutMs 内没有时返回false
+		 * @param frameId 上一次读到的帧号，第一次读取时传 (uint64_t)-1
+		 */
+		bool wait(uint64_t frameId, SharedResult & result, int timeoutMs);
+		/**
+		 * @brief valid 图像数据是否仍然是 read 时的那一帧
+		 */
+		bool valid(const SharedResult & result) const;
+
+	private:
+		SharedSubscriber(const SharedSubscriber&);
+		SharedSubscriber & operator=(const SharedSubscriber&);
+
+	protected:
+		char* m_memory;
+		size_t m_size;
+		const SharedResultsHeader* m_header;
+};
+
+#endif
@@ -0,0 +1,79 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** ThreadTuning.h
+** 
+** CPU affinity, real-time scheduling and memory locking helpers
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef THREAD_TUNING
+#define THREAD_TUNING
+
+#include <list>
+#include <vector>
+#include <string>
+#include <time.h>
+
+// ---------------------------------
+// Thread placement parameters
+// ---------------------------------
+struct ThreadTuning
+{
+	ThreadTuning() : m_fifoPriority(0), m_lockMemory(false), m_baselineFrames(300) {}
+
+	bool enabled() const { return !m_captureCpus.empty() || !m_inferenceCpus.empty() || m_fifoPriority || m_lockMemory; }
+
+	std::list<int> m_captureCpus;   // 采集线程绑定的核, 空表示不绑定
+	std::list<int> m_inferenceCpus; // 推理线程以及opencv工作线程绑定的核
+	int m_fifoPriority;             // 采集线程SCHED_FIFO优先级, 0表示保持SCHED_OTHER
+	bool m_lockMemory;              // mlockall锁住帧缓存和堆, 避免缺页
+	unsigned int m_baselineFrames;  // 调优生效前先统计多少帧的抖动作为对比
+};
+
+/**
+ * @brief parseCpuList 解析 "0-1,3" 形式的核列表
+ */
+std::list<int> parseCpuList(const char* cpus);
+/**
+ * @brief pinCurrentThread 将当前线程绑定到指定的核，之后创建的线程继承该亲和性
+ */
+bool pinCurrentThread(const std::list<int>& cpus);
+/**
+ * @brief getThreadCpus 当前线程允许运行的核，用于绑核之后恢复
+ */
+std::list<int> getThreadCpus();
+/**
+ * @brief setRealtimePriority 当前线程切换到SCHED_FIFO，需要CAP_SYS_NICE或rtprio限制允许
+ */
+bool setRealtimePriority(int priority);
+/**
+ * @brief lockMemory 锁住当前以及以后映射的所有内存(包括V4L2 mmap缓存)
+ */
+bool lockMemory();
+
+// ---------------------------------
+// Inter-arrival jitter statistics
+// ---------------------------------
+class JitterStats
+{
+	public:
+		JitterStats(const std::string & name, unsigned int window = 300);
+
+		void tick();
+		void reset();
+		unsigned int count() { return m_samples.size(); }
+		void report(const char* tag);
+
+	protected:
+		std::string m_name;
+		unsigned int m_window;
+		struct timespec m_last;
+		bool m_started;
+		std::vector<double> m_samples; // 帧间隔 ms
+};
+
+#endif
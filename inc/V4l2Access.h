@@ -21,7 +21,8 @@ class V4l2Access
 		enum IoType
 		{
 			IOTYPE_READWRITE,
-			IOTYPE_MMAP
+			IOTYPE_MMAP,
+			IOTYPE_REPLAY
 		};
 		
 		V4l2Access(V4l2Device* device);
@@ -32,7 +33,21 @@ class V4l2Access
 		unsigned int getFormat()     { return m_device->getFormat();     }
 		unsigned int getWidth()      { return m_device->getWidth();      }
 		unsigned int getHeight()     { return m_device->getHeight();     }
+		unsigned int getPlaneCount() { return m_device->getPlaneCount(); }
+		unsigned int getBytesPerLine(unsigned int plane = 0) { return m_device->getBytesPerLine(plane); }
+		const timeval & getTimestamp() { return m_device->getTimestamp(); }
+		unsigned int getSequence()   { return m_device->getSequence();   }
+		const std::list<V4l2Mode> & getSupportedModes() { return m_device->getSupportedModes(); }
 		void queryFormat()  { m_device->queryFormat();          }
+		double getConfiguredFps()    { return m_device->getConfiguredFps(); }
+		double getMeasuredFps()      { return m_device->getMeasuredFps();   }
+
+		std::list<V4l2Control> enumerateControls()                 { return m_device->enumerateControls();         }
+		bool queryControl(unsigned int id, V4l2Control & control) { return m_device->queryControl(id, control);   }
+		bool getControl(unsigned int id, int & value)             { return m_device->getControl(id, value);       }
+		bool setControl(unsigned int id, int value)               { return m_device->setControl(id, value);       }
+		bool setControls(const V4l2ControlValues & values)        { return m_device->setControls(values);         }
+		bool lockExposure(double dutyCycle = 0.8)                 { return m_device->lockExposure(dutyCycle);     }
 
 		int isReady()       { return m_device->isReady();       }
 		int start()         { return m_device->start();         }
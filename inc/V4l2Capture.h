@@ -13,9 +13,15 @@
 #ifndef V4L2_CAPTURE
 #define V4L2_CAPTURE
 
+#include <vector>
+
 #include "V4l2Access.h"
+#include "V4l2Converter.h"
 #include "opencv2/core/core.hpp"
 
+class V4l2FrameSink;
+class V4l2H264Decoder;
+
 
 // ---------------------------------
 // V4L2 Capture
@@ -34,7 +40,7 @@ class V4l2Capture : public V4l2Access
              * 图像帧格式。
              * V4L2_PIX_FMT_MJPEG （MJPEG）
             使用范例 V4L2DeviceParameters param("/dev/video0", V4L2_PIX_FMT_MJPEG , 1920, 1080, 30, 0,verbose);
-         * @param iotype
+         * @param iotype IOTYPE_REPLAY 时 param.m_devName 为V4l2Recorder录制的文件，param.m_fps 0按原始时间 >0固定帧率 <0尽可能快
          * @return
          */
 		static V4l2Capture* create(const V4L2DeviceParameters & param, IoType iotype = V4l2Access::IOTYPE_MMAP);
@@ -43,10 +49,26 @@ class V4l2Capture : public V4l2Access
         size_t read(char* buffer, size_t bufferSize);
         /**
          * @brief read 读取图像
-         * @param readImage 获取的图像
-         * @return
+         * @param readImage 获取的BGR图像
+         * @return 0 得到一帧图像，1 缓存读到了但没有图像(H264在第一个IDR之前以及解码出错时，没有转换函数时)，-1 出错
          */
         int read(cv::Mat &readImage);
+        /**
+         * @brief setLayout 选择read(cv::Mat&)输出的图像布局，默认BGR
+         * @return 当前格式没有对应的转换函数时返回false，read得到空图像
+         */
+        bool setLayout(V4l2Converter::Layout layout);
+        /**
+         * @brief convert 用V4l2Converter登记的函数把一帧原始数据转换为BGR图像，每次都查表，逐帧调用请直接用V4l2Converter::find
+         * @param buffer 原始数据
+         * @param size 原始数据的实际长度
+         */
+        static void convert(const char* buffer, size_t size, unsigned int format, unsigned int width, unsigned int height, cv::Mat &readImage);
+        /**
+         * @brief convert 直接转换mmap缓存的各个平面(NV12M/YUV420M等)，按bytesperline处理行对齐
+         * @param planes startRead得到的平面
+         */
+        static void convert(const V4l2Planes& planes, unsigned int format, unsigned int width, unsigned int height, cv::Mat &readImage);
         /**
          * @brief isReadable 判断是都可读取图像
          * @param tv 等待的时间
@@ -63,7 +85,20 @@ class V4l2Capture : public V4l2Access
          * @return
          */
         const char * getBusInfo();
+        /**
+         * @brief setSink 每次read(cv::Mat&)读到的原始数据同时交给sink(V4l2Recorder, V4l2PassthroughSink)，传入NULL停止
+         * @param sink 由调用者负责释放
+         */
+        void setSink(V4l2FrameSink* sink) { m_sink = sink; }
+
+    protected:
+        bool convertFrame(const V4l2Planes& planes, cv::Mat &readImage);
 
+    protected:
+        V4l2FrameSink* m_sink;
+        std::vector<char> m_sinkBuffer; // multi-planar frames concatenated for the sink
+        V4l2ConvertFunction m_converter; // resolved from the format when the capture is created
+        V4l2H264Decoder* m_decoder;      // H264 only, reused for the whole stream
 };
 
 
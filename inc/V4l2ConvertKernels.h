@@ -0,0 +1,43 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2ConvertKernels.h
+**
+** Vectorised YUV to BGR/GRAY kernels used by V4l2Converter, BGR to YUV for V4l2Relay
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef V4L2_CONVERT_KERNELS
+#define V4L2_CONVERT_KERNELS
+
+#include "V4l2Converter.h"
+
+// BT.601 limited range, same coefficients as cv::COLOR_YUV2BGR_*
+void convertYUYVToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+void convertUYVYToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+void convertYVYUToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+void convertVYUYToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+void convertNV12ToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+void convertNV21ToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+void convertI420ToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+void convertYV12ToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+void convertYUV422PToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+void convertGREYToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+// I420 full range (YUVJ420P, H264 video_full_range_flag), JPEG coefficients
+void convertJ420ToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+
+// luma only
+void convertYUYVToGRAY(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+void convertUYVYToGRAY(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+void convertLumaToGRAY(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+
+// BGR (CV_8UC3, width x height) written into the planes of an output buffer, BT.601 limited range
+void convertBGRToYUYV(const cv::Mat & image, const V4l2Planes & planes, unsigned int width, unsigned int height);
+void convertBGRToUYVY(const cv::Mat & image, const V4l2Planes & planes, unsigned int width, unsigned int height);
+void convertBGRToNV12(const cv::Mat & image, const V4l2Planes & planes, unsigned int width, unsigned int height);
+void convertBGRToNV21(const cv::Mat & image, const V4l2Planes & planes, unsigned int width, unsigned int height);
+
+#endif
@@ -0,0 +1,59 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2Converter.h
+**
+** Registry of the raw frame to cv::Mat converters
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef V4L2_CONVERTER
+#define V4L2_CONVERTER
+
+#include <list>
+
+#include "opencv2/core/core.hpp"
+#include "V4l2Device.h"
+
+// converts one frame, the planes may point to the driver mmap buffers
+typedef void (*V4l2ConvertFunction)(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image);
+
+/*
+ * 以 (fourcc, 输出布局) 为key登记转换函数。
+ * V4l2Capture 在开始采集时查一次，之后每帧直接调用，不再逐帧判断格式。
+ * 常用的YUV格式使用手写的向量化kernel，并按行分给opencv的线程池。
+ */
+class V4l2Converter
+{
+	public:
+		enum Layout
+		{
+			LAYOUT_BGR,  // CV_8UC3
+			LAYOUT_GRAY  // CV_8UC1, 只取亮度
+		};
+
+		/**
+		 * @brief registerConverter 登记或替换一个转换函数
+		 */
+		static void registerConverter(unsigned int format, Layout layout, V4l2ConvertFunction function);
+		/**
+		 * @brief find 查找转换函数
+		 * @return 不支持的格式返回NULL
+		 */
+		static V4l2ConvertFunction find(unsigned int format, Layout layout = LAYOUT_BGR);
+		/**
+		 * @brief formats 支持转换到layout的所有格式
+		 */
+		static std::list<unsigned int> formats(Layout layout = LAYOUT_BGR);
+		/**
+		 * @brief setParallel 向量化kernel是否按行分给opencv的线程池，默认true；
+		 *        推理绑核时关掉，采集线程只在自己的核上转换，不占用(也不会先创建)推理用的线程池
+		 */
+		static void setParallel(bool parallel);
+		static bool isParallel();
+};
+
+#endif
@@ -15,8 +15,17 @@
 
 #include <string>
 #include <list>
+#include <vector>
 #include <linux/videodev2.h>
 #include <fcntl.h>
+#include <sys/time.h>
+
+#include "V4l2ProbeCache.h"
+
+class V4l2ModeSelector;
+
+// four character code of a pixel format, e.g. "YUYV"
+std::string fourcc(unsigned int format);
 
 #ifndef V4L2_PIX_FMT_VP8
 #define V4L2_PIX_FMT_VP8  v4l2_fourcc('V', 'P', '8', '0')
@@ -76,7 +85,7 @@ struct V4L2DeviceParameters
      * @param openFlags
      */
     V4L2DeviceParameters(const char* devname, const std::list<unsigned int> & formatList, unsigned int width, unsigned int height, int fps,unsigned int input_index = 0, int verbose = 0, int openFlags = O_RDWR | O_NONBLOCK) :
-        m_devName(devname), m_inputIndex(input_index), m_formatList(formatList), m_width(width), m_height(height), m_fps(fps), m_verbose(verbose), m_openFlags(openFlags) {}
+        m_devName(devname), m_inputIndex(input_index), m_formatList(formatList), m_width(width), m_height(height), m_fps(fps), m_verbose(verbose), m_openFlags(openFlags), m_probeCache(true), m_modeSelector(NULL), m_lockExposure(false) {}
     /**
      * @brief V4L2DeviceParameters
      * @param devname
@@ -89,7 +98,7 @@ struct V4L2DeviceParameters
      * @param openFlags
      */
     V4L2DeviceParameters(const char* devname, unsigned int format, unsigned int width, unsigned int height, int fps,unsigned int input_index = 0, int verbose = 0, int openFlags = O_RDWR | O_NONBLOCK) :
-        m_devName(devname), m_inputIndex(input_index), m_width(width), m_height(height), m_fps(fps), m_verbose(verbose), m_openFlags(openFlags) {
+        m_devName(devname), m_inputIndex(input_index), m_width(width), m_height(height), m_fps(fps), m_verbose(verbose), m_openFlags(openFlags), m_probeCache(true), m_modeSelector(NULL), m_lockExposure(false) {
 			if (format) {
 				m_formatList.push_back(format);
 			}
@@ -103,6 +112,49 @@ struct V4L2DeviceParameters
 	int m_fps;			
 	int m_verbose;
 	int m_openFlags;
+	bool m_probeCache; // 使用V4l2ProbeCache跳过输入/格式/分辨率/帧率的枚举
+	V4l2ModeSelector* m_modeSelector; // 不为NULL时从枚举的模式中自动选择格式/分辨率/帧率，只在打开设备时使用
+	bool m_lockExposure;              // 打开设备后调用 lockExposure，保证帧率不被自动曝光拉低
+};
+
+// ---------------------------------
+// camera control (VIDIOC_QUERYCTRL)
+// ---------------------------------
+struct V4l2Control
+{
+	unsigned int m_id;       // V4L2_CID_*
+	std::string m_name;
+	unsigned int m_type;     // V4L2_CTRL_TYPE_*
+	int m_minimum;
+	int m_maximum;
+	int m_step;
+	int m_default;
+	unsigned int m_flags;    // V4L2_CTRL_FLAG_*
+	std::list< std::pair<int, std::string> > m_menu; // V4L2_CTRL_TYPE_MENU items
+};
+
+// controls applied together, in this order when the driver has no extended controls
+typedef std::vector< std::pair<unsigned int, int> > V4l2ControlValues;
+
+// ---------------------------------
+// planes of a dequeued buffer, single planar formats have one plane
+// ---------------------------------
+struct V4l2Planes
+{
+	V4l2Planes() : m_count(0)
+	{
+		for (unsigned int i = 0; i < VIDEO_MAX_PLANES; ++i)
+		{
+			m_data[i] = NULL;
+			m_size[i] = 0;
+			m_stride[i] = 0;
+		}
+	}
+
+	unsigned int m_count;
+	char* m_data[VIDEO_MAX_PLANES];          // 指向驱动的mmap缓存，endRead/endWrite之后失效
+	size_t m_size[VIDEO_MAX_PLANES];         // bytesused, startWrite时为缓存的大小
+	unsigned int m_stride[VIDEO_MAX_PLANES]; // bytesperline
 };
 
 // ---------------------------------
@@ -118,9 +170,13 @@ class V4l2Device
 	
         int initdevice(const char *dev_name , unsigned int mandatoryCapabilities );
 		int checkCapabilities(int fd, unsigned int mandatoryCapabilities);
+		int enumerateInputs(int fd);
+		void enumerateModes(int fd);
 		int configureFormat(int fd);
 		int configureFormat(int fd, unsigned int format, unsigned int width, unsigned int height);
 		int configureParam(int fd);
+		void setFormat(const struct v4l2_format & fmt);
+		void frameDequeued(const timeval & timestamp, unsigned int sequence);
 
         virtual bool init(unsigned int mandatoryCapabilities);
 		virtual size_t writeInternal(char*, size_t) { return -1; }
@@ -128,6 +184,11 @@ class V4l2Device
 		virtual size_t writePartialInternal(char*, size_t) { return -1; }
 		virtual bool endPartialWrite(void)          { return false; }
 		virtual size_t readInternal(char*, size_t)  { return -1; }
+		virtual bool hasStartRead(void)             { return false; }
+		virtual bool startRead(V4l2Planes&)         { return false; }
+		virtual bool endRead(void)                  { return false; }
+		virtual bool startWrite(V4l2Planes&)        { return false; }
+		virtual bool endWrite(size_t)               { return false; }
 	
 	public:
 		V4l2Device(const V4L2DeviceParameters&  params, v4l2_buf_type deviceType);		
@@ -141,10 +202,42 @@ class V4l2Device
 		unsigned int getFormat()     { return m_format;     }
 		unsigned int getWidth()      { return m_width;      }
 		unsigned int getHeight()     { return m_height;     }
+		unsigned int getPlaneCount() { return m_planeCount; }
+		unsigned int getBytesPerLine(unsigned int plane = 0) { return m_bytesPerLine[plane]; }
+		bool isMultiPlanar()         { return (m_deviceType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) || (m_deviceType == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE); }
         unsigned char *getBusInfo() { return  bus_info;    }
+		const timeval & getTimestamp() { return m_timestamp; }
+		const std::list<V4l2Mode> & getSupportedModes() { return m_modes; }
+		unsigned int getSequence()   { return m_sequence;   }
 		int getFd()         { return m_fd;         }
 		void queryFormat();	
 
+		/**
+		 * @brief getConfiguredFps 驱动接受的帧率(VIDIOC_S_PARM 返回的 timeperframe)，0表示未知
+		 */
+		double getConfiguredFps()    { return m_configuredFps; }
+		/**
+		 * @brief getMeasuredFps 根据缓存的时间戳和序号统计的实际帧率，约每秒更新一次
+		 */
+		double getMeasuredFps()      { return m_measuredFps; }
+
+		/**
+		 * @brief enumerateControls 枚举设备支持的控制项，不包括禁用的控制项和控制类
+		 */
+		std::list<V4l2Control> enumerateControls();
+		bool queryControl(unsigned int id, V4l2Control & control);
+		bool getControl(unsigned int id, int & value);
+		bool setControl(unsigned int id, int value);
+		/**
+		 * @brief setControls 用 VIDIOC_S_EXT_CTRLS 一次设置多个控制项，驱动不支持时逐个设置
+		 */
+		bool setControls(const V4l2ControlValues & values);
+		/**
+		 * @brief lockExposure 手动曝光，曝光时间不超过帧间隔的 dutyCycle，自动曝光原来更长时用增益补偿亮度
+		 * @param dutyCycle 曝光时间占帧间隔的比例
+		 */
+		bool lockExposure(double dutyCycle = 0.8);
+
 	protected:
 		V4L2DeviceParameters m_params;
 		int m_fd;
@@ -154,6 +247,19 @@ class V4l2Device
 		unsigned int m_format;
 		unsigned int m_width;
 		unsigned int m_height;	
+		unsigned int m_planeCount;                     // 1 unless the device uses the multi-planar API
+		unsigned int m_bytesPerLine[VIDEO_MAX_PLANES];
+
+		timeval m_timestamp;     // capture time of the last frame read (CLOCK_MONOTONIC)
+		unsigned int m_sequence; // driver sequence number of the last frame read
+
+		double m_configuredFps;
+		double m_measuredFps;
+		timeval m_fpsStart;              // first frame of the current measurement window
+		unsigned int m_fpsStartSequence;
+		unsigned int m_fpsFrames;        // frames read in the window, when the driver gives no sequence
+
+		std::list<V4l2Mode> m_modes; // from the probe cache or enumerated at init
 
 		struct v4l2_buffer m_partialWriteBuf;
 		bool m_partialWriteInProgress;
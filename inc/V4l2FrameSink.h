@@ -0,0 +1,30 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2FrameSink.h
+** 
+** Consumer of the raw frames read by V4l2Capture
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef V4L2_FRAME_SINK
+#define V4L2_FRAME_SINK
+
+#include <stddef.h>
+#include <sys/time.h>
+
+class V4l2FrameSink
+{
+	public:
+		virtual ~V4l2FrameSink() {}
+
+		/**
+		 * @brief write 在采集线程中调用，buffer可能直接指向驱动的mmap缓存，返回后即失效
+		 */
+		virtual bool write(const char* buffer, size_t size, const timeval & timestamp, unsigned int sequence) = 0;
+};
+
+#endif
@@ -0,0 +1,82 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2H264Decoder.h
+**
+** Low latency H.264 decoding of V4L2 access units (libavcodec)
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef V4L2_H264_DECODER
+#define V4L2_H264_DECODER
+
+#include <stddef.h>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+
+/*
+ * 每个V4L2缓存是一个完整的access unit，直接送给解码器:
+ *   - AV_CODEC_FLAG_LOW_DELAY，不等B帧重排
+ *   - 只开slice多线程，frame多线程会多出 thread_count 帧的延迟
+ *   - 解码器上下文在整个采集过程中复用
+ * 在收到SPS/PPS和IDR之前的数据直接丢弃；IDR前面没有SPS/PPS时补上最近一次收到的。
+ * 没有libavcodec(HAVE_LIBAVCODEC)时 create 返回NULL。
+ */
+class V4l2H264Decoder
+{
+	public:
+		/**
+		 * @brief create 创建解码器
+		 * @param threads slice线程数，0由libavcodec决定
+		 */
+		static V4l2H264Decoder* create(int threads = 0);
+		virtual ~V4l2H264Decoder();
+
+		/**
+		 * @brief decode 解码一个access unit
+		 * @param image 解码得到的BGR图像
+		 * @return 得到一帧图像时返回true
+		 */
+		bool decode(const char* data, size_t size, cv::Mat & image);
+		/**
+		 * @brief reset 丢弃解码器中的状态，从下一个IDR重新开始
+		 */
+		void reset();
+
+		/**
+		 * @brief nextStartCode 查找 00 00 01 / 00 00 00 01
+		 * @param codeLength 起始码的长度
+		 * @return 起始码的位置，没有找到时返回size
+		 */
+		static size_t nextStartCode(const unsigned char* data, size_t size, size_t from, size_t* codeLength);
+		/**
+		 * @brief parseSpsSize 从SPS读出裁剪后的图像大小，不需要libavcodec
+		 * @param nal SPS NAL单元，从NAL头开始，不含起始码
+		 * @return SPS不完整或者无法解析时返回false
+		 */
+		static bool parseSpsSize(const unsigned char* nal, size_t size, unsigned int & width, unsigned int & height);
+
+	protected:
+		V4l2H264Decoder();
+		bool init(int threads);
+		bool scanParameterSets(const unsigned char* data, size_t size, bool & hasParameterSets);
+
+	protected:
+		AVCodecContext* m_context;
+		AVFrame* m_frame;
+		AVPacket* m_packet;
+		std::vector<unsigned char> m_sps;
+		std::vector<unsigned char> m_pps;
+		std::vector<unsigned char> m_buffer; // access unit with padding, and SPS/PPS if they were missing
+		bool m_waitKeyframe;
+};
+
+#endif
@@ -25,6 +25,11 @@ class V4l2MmapDevice : public V4l2Device
 		size_t writePartialInternal(char*, size_t);
 		bool endPartialWrite(void);
 		size_t readInternal(char* buffer, size_t bufferSize);
+		bool hasStartRead(void) { return true; }
+		bool startRead(V4l2Planes& planes);
+		bool endRead(void);
+		bool startWrite(V4l2Planes& planes);
+		bool endWrite(size_t bytesused);
 			
 	public:
 		V4l2MmapDevice(const V4L2DeviceParameters & params, v4l2_buf_type deviceType);		
@@ -35,15 +40,24 @@ class V4l2MmapDevice : public V4l2Device
 		virtual bool start();
 		virtual bool stop();
 	
+	protected:
+		void initBuffer(struct v4l2_buffer & buf, struct v4l2_plane * planes);
+		unsigned int planeCount() { return this->isMultiPlanar() ? m_planeCount : 1; }
+
 	protected:
 		unsigned int  n_buffers;
 	
+		// one mapping per plane, single planar devices only use plane 0
 		struct buffer 
 		{
-			void *                  start;
-			size_t                  length;
+			void *                  start[VIDEO_MAX_PLANES];
+			size_t                  length[VIDEO_MAX_PLANES];
 		};
 		buffer m_buffer[V4L2MMAP_NBBUFFER];
+
+		struct v4l2_buffer m_readBuf;
+		struct v4l2_plane  m_readPlanes[VIDEO_MAX_PLANES];
+		bool m_readInProgress;
 };
 
 #endif
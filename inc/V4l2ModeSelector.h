@@ -0,0 +1,76 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2ModeSelector.h
+**
+** Choose the capture format/size/fps from the enumerated modes
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef V4L2_MODE_SELECTOR
+#define V4L2_MODE_SELECTOR
+
+#include <list>
+#include <map>
+
+#include "V4l2ProbeCache.h"
+
+// ---------------------------------
+// what the pipeline needs from the camera
+// ---------------------------------
+struct V4l2ModeConstraints
+{
+	V4l2ModeConstraints(unsigned int targetWidth = 320, unsigned int targetHeight = 0, double minFps = 30) :
+		m_targetWidth(targetWidth), m_targetHeight(targetHeight), m_minFps(minFps),
+		m_busBandwidth(0), m_underscaleCost(2.0), m_latencyCost(1.0), m_calibrate(false) {}
+
+	unsigned int m_targetWidth;   // 网络输入大小
+	unsigned int m_targetHeight;  // 0: 高度随摄像头宽高比 (letterbox)
+	double m_minFps;
+	double m_busBandwidth;        // bytes/s left on a shared bus (USB2 isochronous max is 24576000), 0 = trust the advertised modes
+	double m_underscaleCost;      // cost of a frame smaller than the network input, per missing scale unit
+	double m_latencyCost;         // cost of one frame period, in seconds
+	bool m_calibrate;             // 在本机上实测每种格式的转换耗时
+	std::map<unsigned int, double> m_decodeCost; // ns per pixel, overrides the defaults
+};
+
+/*
+ * 代价 = 转换占用的CPU(核/秒) + 分辨率低于网络输入的惩罚 + 帧间隔带来的延迟。
+ * 帧率不够或者超出总线带宽的模式直接排除。
+ * 这样不会为了最后缩到320x320而去解码720p的MJPEG。
+ */
+class V4l2ModeSelector
+{
+	public:
+		V4l2ModeSelector(const V4l2ModeConstraints & constraints) : m_constraints(constraints) {}
+
+		/**
+		 * @brief select 从枚举的模式里选代价最小的
+		 * @param modes 设备支持的模式
+		 * @param best 选中的模式
+		 * @return 没有可用的模式时返回false
+		 */
+		bool select(const std::list<V4l2Mode> & modes, V4l2Mode & best);
+		/**
+		 * @brief cost 计算一个模式的代价
+		 * @return 不可用的模式返回负数
+		 */
+		double cost(const V4l2Mode & mode) const;
+		/**
+		 * @brief calibrate 用V4l2Capture::convert实测每种格式每像素的耗时
+		 */
+		void calibrate(const std::list<V4l2Mode> & modes);
+
+		double decodeCost(unsigned int format) const;
+
+		static double defaultDecodeCost(unsigned int format);
+		static double bytesPerPixel(unsigned int format);
+
+	protected:
+		V4l2ModeConstraints m_constraints;
+};
+
+#endif
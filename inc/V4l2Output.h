@@ -32,6 +32,15 @@ class V4l2Output : public V4l2Access
 		bool   startPartialWrite(void);
 		size_t writePartial(char* buffer, size_t bufferSize);
 		bool   endPartialWrite(void);
+		/**
+		 * @brief startWrite 取一个空闲的mmap缓存，直接在planes指向的内存里写一帧，不经过中间缓存
+		 * @return 没有空闲缓存(O_NONBLOCK)或者不是MMAP设备时返回false
+		 */
+		bool   startWrite(V4l2Planes & planes);
+		/**
+		 * @brief endWrite 把startWrite得到的缓存交给驱动
+		 */
+		bool   endWrite(size_t bytesused);
 };
 
 #endif
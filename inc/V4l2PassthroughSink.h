@@ -0,0 +1,96 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2PassthroughSink.h
+** 
+** Records the camera payload (MJPEG...) as is, without decode/re-encode
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef V4L2_PASSTHROUGH_SINK
+#define V4L2_PASSTHROUGH_SINK
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "V4l2FrameSink.h"
+
+/*
+ * path      : 原始数据依次拼接, MJPEG时即为可以直接播放的 .mjpeg 流
+ * path.idx  : V4l2PassthroughIndexHeader + 每帧一个 V4l2PassthroughIndexEntry
+ *
+ * 采集线程只把数据拷贝进对齐的大块缓存，写满的块由写线程用O_DIRECT整块写入，
+ * 磁盘变慢时丢帧(getDropped)而不是阻塞采集线程。
+ */
+struct V4l2PassthroughIndexHeader
+{
+	uint32_t magic;      // "4IDX"
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+};
+
+struct V4l2PassthroughIndexEntry
+{
+	uint64_t timestamp;  // capture time in us
+	uint64_t offset;     // payload offset in the data file
+	uint32_t size;
+	uint32_t sequence;
+};
+
+class V4l2PassthroughSink : public V4l2FrameSink
+{
+	protected:
+		V4l2PassthroughSink(const std::string & path, int fd, FILE* index, size_t chunkSize, const std::vector<char*> & buffers);
+
+	public:
+		/**
+		 * @brief create
+		 * @param chunkSize 每次写盘的大小，会向上对齐到4096
+		 * @param nbChunks 缓存块数，决定能吸收多长时间的磁盘抖动
+		 */
+		static V4l2PassthroughSink* create(const std::string & path, unsigned int format, unsigned int width, unsigned int height, size_t chunkSize = 4 << 20, unsigned int nbChunks = 8);
+		virtual ~V4l2PassthroughSink();
+
+		bool write(const char* buffer, size_t size, const timeval & timestamp, unsigned int sequence);
+		unsigned long getDropped() { return m_dropped; }
+
+	private:
+		V4l2PassthroughSink(const V4l2PassthroughSink&);
+		V4l2PassthroughSink & operator=(const V4l2PassthroughSink&);
+
+	protected:
+		struct Chunk
+		{
+			char* data;
+			size_t fill;
+			std::vector<V4l2PassthroughIndexEntry> index; // frames starting in this chunk
+		};
+		void seal();
+		void writerLoop();
+
+	protected:
+		std::string m_path;
+		int m_fd;
+		FILE* m_index;
+		size_t m_chunkSize;
+		std::vector<Chunk> m_chunks;
+		uint64_t m_offset;               // bytes accepted so far
+		std::atomic<unsigned long> m_sealed;  // chunks handed to the writer
+		std::atomic<unsigned long> m_written; // chunks on disk
+		std::atomic<bool> m_stop;
+		unsigned long m_dropped;
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::thread m_writer;
+};
+
+#endif
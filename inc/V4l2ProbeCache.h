@@ -0,0 +1,54 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2ProbeCache.h
+** 
+** Persistent cache of the capture modes enumerated on a device
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef V4L2_PROBE_CACHE
+#define V4L2_PROBE_CACHE
+
+#include <string>
+#include <list>
+#include <linux/videodev2.h>
+
+// ---------------------------------
+// one enumerated format/size/interval
+// ---------------------------------
+struct V4l2Mode
+{
+	V4l2Mode(unsigned int format = 0, unsigned int width = 0, unsigned int height = 0, unsigned int numerator = 0, unsigned int denominator = 0) :
+		m_format(format), m_width(width), m_height(height), m_numerator(numerator), m_denominator(denominator) {}
+
+	double fps() const { return m_numerator ? (double)m_denominator / m_numerator : 0; }
+
+	unsigned int m_format;
+	unsigned int m_width;
+	unsigned int m_height;
+	unsigned int m_numerator;   // frame interval m_numerator/m_denominator seconds
+	unsigned int m_denominator;
+};
+
+/*
+ * 以 driver/card/bus_info/驱动版本/capabilities 为key，把枚举结果存到
+ * $V4L2CPP_CACHE_DIR (默认 /tmp/v4l2cpp) 下的一个文本文件。
+ * 同一个摄像头重新插拔或者进程重启后不再需要逐个ioctl枚举。
+ */
+class V4l2ProbeCache
+{
+	public:
+		static std::string key(const struct v4l2_capability & cap);
+		static bool load(const std::string & key, std::list<V4l2Mode> & modes);
+		static bool store(const std::string & key, const std::list<V4l2Mode> & modes);
+		static void invalidate(const std::string & key);
+
+	protected:
+		static std::string path(const std::string & key);
+};
+
+#endif
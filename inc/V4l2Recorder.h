@@ -0,0 +1,94 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2Recorder.h
+** 
+** Raw V4L2 frame recorder
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef V4L2_RECORDER
+#define V4L2_RECORDER
+
+#include <stdint.h>
+#include <string>
+#include <sys/time.h>
+
+#include "V4l2FrameSink.h"
+
+// ---------------------------------
+// Recording container layout
+// ---------------------------------
+/*
+ * header | frame header | payload | pad to 8 bytes | frame header | payload | ...
+ * 所有字段为小端，文件可以直接mmap后顺序解析
+ */
+#define V4L2REC_MAGIC   0x43455234 /* "4REC" */
+#define V4L2REC_VERSION 1
+
+struct V4l2RecordingHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t format;     // V4L2 fourcc
+	uint32_t width;
+	uint32_t height;
+	uint32_t bufferSize; // largest payload in the file
+	uint32_t nbFrames;
+	uint32_t reserved;
+};
+
+struct V4l2RecordingFrame
+{
+	uint64_t timestamp;  // capture time in us
+	uint32_t sequence;   // driver sequence number
+	uint32_t size;       // payload bytes following this header
+};
+
+// ---------------------------------
+// V4L2 Recorder
+// ---------------------------------
+/*
+ * 文件按 V4L2REC_WINDOW 大小的窗口mmap，采集线程只做memcpy，不调用write，
+ * 写盘由内核的回写线程完成。进入下一个窗口之前先用fallocate分配好磁盘空间，
+ * 写满磁盘时在这里失败，而不是访问映射时收到SIGBUS。结束时截断到实际长度并更新头。
+ */
+#define V4L2REC_WINDOW (64 << 20)
+
+class V4l2Recorder : public V4l2FrameSink
+{
+	protected:
+		V4l2Recorder(int fd, const std::string & path, unsigned int format, unsigned int width, unsigned int height);
+
+	public:
+		/**
+		 * @brief create 创建录制文件，写入的是摄像头原始数据(YUYV/MJPEG...)，不做解码
+		 * @return 失败返回NULL
+		 */
+		static V4l2Recorder* create(const std::string & path, unsigned int format, unsigned int width, unsigned int height);
+		virtual ~V4l2Recorder();
+
+		bool write(const char* buffer, size_t size, const timeval & timestamp, unsigned int sequence);
+		unsigned int getFrameCount() { return m_header.nbFrames; }
+
+	private:
+		V4l2Recorder(const V4l2Recorder&);
+		V4l2Recorder & operator=(const V4l2Recorder&);
+
+	protected:
+		bool append(const void* data, size_t size);
+		bool mapWindow(uint64_t offset);
+
+	protected:
+		int m_fd;
+		std::string m_path;
+		V4l2RecordingHeader m_header;
+		char* m_window;          // mapping of [m_windowOffset, m_windowOffset + V4L2REC_WINDOW)
+		uint64_t m_windowOffset;
+		uint64_t m_offset;       // bytes recorded
+};
+
+#endif
@@ -0,0 +1,70 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2Relay.h
+**
+** Publishes BGR images on a V4L2 output device (v4l2loopback)
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef V4L2_RELAY
+#define V4L2_RELAY
+
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "V4l2Output.h"
+
+typedef void (*V4l2RelayConvertFunction)(const cv::Mat & image, const V4l2Planes & planes, unsigned int width, unsigned int height);
+
+/*
+ * 画好框的图像发布到一个V4L2输出设备，一般是v4l2loopback，ffplay/OBS/浏览器等普通工具都可以直接打开。
+ * MMAP时颜色转换直接写进驱动的缓存(startWrite/endWrite)，中间没有拷贝。
+ * 驱动同时持有 V4L2MMAP_NBBUFFER 个缓存，write 先用零超时的select确认有一个已经被消费，
+ * 设备用O_NONBLOCK打开，VIDIOC_DQBUF也不会等待；没有空闲缓存时丢掉这一帧(getDropped)，调用线程从不阻塞。
+ * READWRITE设备先转换到自己的缓存再write。
+ */
+class V4l2Relay
+{
+	protected:
+		V4l2Relay(V4l2Output* output, V4l2RelayConvertFunction convert, bool zeroCopy);
+
+	public:
+		/**
+		 * @brief create 打开输出设备，设置格式和大小，驱动不接受时返回NULL
+		 * @param format V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_NV12 或 V4L2_PIX_FMT_NV21
+		 */
+		static V4l2Relay* create(const std::string & device, unsigned int width, unsigned int height, unsigned int format = V4L2_PIX_FMT_YUYV, int fps = 30, V4l2Access::IoType iotype = V4l2Access::IOTYPE_MMAP);
+		virtual ~V4l2Relay();
+
+		/**
+		 * @brief write 转换并交给驱动，大小和设备不同时先缩放；没有空闲缓存时丢帧，返回false
+		 */
+		bool write(const cv::Mat & image);
+		unsigned int getWidth()     { return m_width;   }
+		unsigned int getHeight()    { return m_height;  }
+		unsigned long getWritten()  { return m_written; }
+		unsigned long getDropped()  { return m_dropped; }
+
+	private:
+		V4l2Relay(const V4l2Relay&);
+		V4l2Relay & operator=(const V4l2Relay&);
+
+	protected:
+		V4l2Output* m_output;
+		V4l2RelayConvertFunction m_convert;
+		bool m_zeroCopy;
+		unsigned int m_width;
+		unsigned int m_height;
+		size_t m_frameSize;
+		std::vector<char> m_buffer;   // READWRITE only
+		cv::Mat m_scaled;
+		unsigned long m_written;
+		unsigned long m_dropped;
+};
+
+#endif
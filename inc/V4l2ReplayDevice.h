@@ -0,0 +1,63 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2ReplayDevice.h
+** 
+** V4L2 source replaying a V4l2Recorder file
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef V4L2_REPLAY_DEVICE
+#define V4L2_REPLAY_DEVICE
+
+#include <vector>
+#include <stdint.h>
+
+#include "V4l2Device.h"
+
+/*
+ * m_devName 为V4l2Recorder录制的文件，或者H.264裸码流(.h264，按access unit切分，按30fps计时)
+ * m_fps 决定回放节奏:
+ *    0 按录制时的时间戳
+ *   >0 固定帧率
+ *   <0 尽可能快
+ * getFd() 返回一个timerfd，下一帧到期时可读，所以isReadable/select的用法与真实设备一致
+ */
+class V4l2ReplayDevice : public V4l2Device
+{
+	protected:
+		size_t readInternal(char* buffer, size_t bufferSize);
+
+	public:
+		V4l2ReplayDevice(const V4L2DeviceParameters & params);
+		virtual ~V4l2ReplayDevice();
+
+		virtual bool init(unsigned int mandatoryCapabilities);
+		virtual bool start();
+
+	protected:
+		bool armTimer();
+		bool indexRecording();
+		bool indexElementaryStream();
+
+	protected:
+		struct Frame
+		{
+			size_t       offset;    // payload offset in m_data
+			size_t       size;
+			uint64_t     timestamp; // us
+			unsigned int sequence;
+		};
+
+		char*  m_data;
+		size_t m_dataSize;
+		std::vector<Frame> m_frames;
+		size_t m_current;
+		struct timespec m_startTime;
+		uint64_t m_firstTimestamp;
+};
+
+#endif
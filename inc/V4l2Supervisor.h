@@ -0,0 +1,96 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2Supervisor.h
+**
+** Capture that survives camera disconnects and stream errors
+**
+** -------------------------------------------------------------------------*/
+
+
+#ifndef V4L2_SUPERVISOR
+#define V4L2_SUPERVISOR
+
+#include <string>
+#include <vector>
+
+#include "V4l2Capture.h"
+
+// one outage, from the failed read to the first frame of the reopened device
+struct V4l2Recovery
+{
+	std::string m_reason;
+	std::string m_devName;  // node that was reopened, may differ after a replug
+	double m_outageMs;      // failure detected -> first frame
+	double m_reopenMs;      // device found -> first frame, the part spent in open/format/STREAMON
+};
+
+/*
+ * 读帧出错(VIDIOC_DQBUF失败、select出错)或者超过timeout没有新帧时，认为摄像头断开:
+ *   - 立即关闭设备，内核才能释放这个节点，重新插上时通常还是原来的编号
+ *   - 用inotify监视/dev，新的video节点出现或者udev改完权限时马上尝试打开，另外每 RETRY_MS 重试一次
+ *   - 重新插拔后节点编号可能变化，按 VIDIOC_QUERYCAP 的 bus_info 找回同一个摄像头
+ *   - 用第一次协商好的格式/分辨率/帧率打开，不再自动选择模式，模式的枚举由probe缓存跳过
+ * 恢复期间 read 按时返回空图像，调用者(推理、显示、输出)照常运行。
+ * 只能在一个线程里使用；getCapture 在恢复期间为NULL，恢复后是新的对象。
+ * 回放文件不监视，读完或出错时 read 返回-1。
+ */
+class V4l2Supervisor
+{
+	protected:
+		V4l2Supervisor(const V4L2DeviceParameters & param, V4l2Access::IoType iotype, V4l2Capture* capture, unsigned int timeoutMs);
+
+	public:
+		static const unsigned int RETRY_MS = 250;
+
+		/**
+		 * @brief create 打开设备，第一次打开失败时返回NULL
+		 * @param timeoutMs 超过这么长时间没有帧就重新打开设备
+		 */
+		static V4l2Supervisor* create(const V4L2DeviceParameters & param, V4l2Access::IoType iotype = V4l2Access::IOTYPE_MMAP, unsigned int timeoutMs = 1000);
+		virtual ~V4l2Supervisor();
+
+		/**
+		 * @brief read 最多等待waitMs读一帧，出错时关闭设备并在之后的调用中恢复
+		 * @return 1 读到一帧图像，0 超时、正在恢复或者这个缓存没有图像(H264在IDR之前)，-1 回放结束
+		 */
+		int read(cv::Mat & image, unsigned int waitMs);
+		V4l2Capture* getCapture()     { return m_capture; }
+		bool isConnected()            { return (m_capture != NULL) && (m_failure == 0); }
+		const std::string & getBusInfo() { return m_busInfo; }
+		const std::vector<V4l2Recovery> & getRecoveries() { return m_recoveries; }
+		/**
+		 * @brief setSink 转发给当前以及之后重新打开的V4l2Capture
+		 */
+		void setSink(V4l2FrameSink* sink);
+
+	private:
+		V4l2Supervisor(const V4l2Supervisor&);
+		V4l2Supervisor & operator=(const V4l2Supervisor&);
+
+	protected:
+		void disconnect(const std::string & reason);
+		bool reconnect(unsigned int waitMs);
+		bool reopen();
+		std::string findDevice();
+		bool waitForDevice(unsigned int timeoutMs);
+
+	protected:
+		V4L2DeviceParameters m_params;   // the negotiated mode, without mode selection
+		V4l2Access::IoType m_iotype;
+		V4l2Capture* m_capture;
+		V4l2FrameSink* m_sink;
+		std::string m_busInfo;
+		unsigned int m_timeoutMs;
+		int m_inotify;
+		double m_lastFrame;              // ms CLOCK_MONOTONIC
+		double m_failure;                // failure detected, 0 when connected
+		double m_found;                  // reopened, waiting for the first frame
+		double m_nextAttempt;
+		std::string m_reason;
+		std::vector<V4l2Recovery> m_recoveries;
+};
+
+#endif
@@ -18,6 +18,7 @@
 #include "log4cpp/PatternLayout.hh"
 
 #define LOG(__level)  log4cpp::Category::getRoot() << log4cpp::Priority::__level << __FILE__ << ":" << __LINE__ << "\n\t" 
+#define LOG_EVERY_MS(__level, __ms) LOG(__level)
 
 inline void initLogger(int verbose)
 {
@@ -45,6 +46,12 @@ inline void initLogger(int verbose)
 }
 #else
 
+#include <stdint.h>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <atomic>
+
 typedef enum {EMERG  = 0,
                       FATAL  = 0,
                       ALERT  = 100,
@@ -57,12 +64,119 @@ typedef enum {EMERG  = 0,
                       NOTSET = 800
 } PriorityLevel;
 
-#include <iostream>
 extern int LogLevel;
-#define LOG(__level) if (__level<=LogLevel) std::cout << "\n[" << #__level << "] " << __FILE__ << ":" << __LINE__ << "\n\t"
 
-//#define LOG(__level) if (__level<=LogLevel) std::cout << "\n[" << #__level << "] " << __FILE__ << ":" << __LINE__ << "\n\t"
-//#define LOG(__level) if (__level<=LogLevel) std::cout<< "\n"
+/*
+ * LOG 不在调用线程格式化和输出：参数按类型编码成定长的二进制记录放入无锁队列，
+ * 由后台线程格式化后写到std::cout，队列满时丢弃并计数，调用线程永远不会阻塞。
+ *
+ * 编译时用 -DLOG_ACTIVE_LEVEL=WARN 之类的定义可以把更低级别的LOG整体优化掉。
+ * 热路径里可能反复出现的消息用 LOG_EVERY_MS(level, ms)，每个调用点ms毫秒内最多输出一条，
+ * 被抑制的条数附加在下一条输出里。
+ */
+#ifndef LOG_ACTIVE_LEVEL
+#define LOG_ACTIVE_LEVEL DEBUG
+#endif
+
+#define LOG_IS_ON(__level) ((__level) <= LOG_ACTIVE_LEVEL && (__level) <= LogLevel)
+
+// expression form so that "if (x) LOG(...) << ...; else ..." keeps its meaning
+#define LOG(__level) !LOG_IS_ON(__level) ? (void)0 : LogVoidify() & LogStream(#__level, __FILE__, __LINE__)
+
+#define LOG_EVERY_MS(__level, __ms) \
+	for (LogRateLimiter* __limiter = &LOG_CALL_SITE_LIMITER(); __limiter && LOG_IS_ON(__level) && __limiter->allow(__ms); __limiter = NULL) \
+		LogStream(#__level, __FILE__, __LINE__) << LogSuppressed(__limiter->suppressed())
+
+// one limiter per call site, each lambda has its own static
+#define LOG_CALL_SITE_LIMITER() []() -> LogRateLimiter& { static LogRateLimiter limiter; return limiter; }()
+
+#define LOG_RECORD_SIZE 256
+
+struct LogRecord
+{
+	const char*  level;  // string literals, stored as pointers
+	const char*  file;
+	int          line;
+	uint16_t     used;
+	char         payload[LOG_RECORD_SIZE - 2 * sizeof(const char*) - sizeof(int) - sizeof(uint16_t)];
+};
+
+struct LogSuppressed
+{
+	explicit LogSuppressed(unsigned long count) : m_count(count) {}
+	unsigned long m_count;
+};
+
+class LogRateLimiter
+{
+	public:
+		LogRateLimiter() : m_next(0), m_suppressed(0) {}
+		bool allow(int ms);
+		unsigned long suppressed() { return m_suppressed.exchange(0); }
+
+	private:
+		std::atomic<int64_t> m_next;
+		std::atomic<unsigned long> m_suppressed;
+};
+
+class LogStream;
+struct LogVoidify
+{
+	// lower precedence than <<, turns the whole chain into void
+	void operator&(const LogStream &) {}
+};
+
+// ---------------------------------
+// one log statement, the record is queued in the destructor
+// ---------------------------------
+class LogStream
+{
+	public:
+		LogStream(const char* level, const char* file, int line);
+		~LogStream();
+
+		LogStream& operator<<(bool value);
+		LogStream& operator<<(char value);
+		LogStream& operator<<(short value)              { return this->putSigned(value);   }
+		LogStream& operator<<(int value)                { return this->putSigned(value);   }
+		LogStream& operator<<(long value)               { return this->putSigned(value);   }
+		LogStream& operator<<(long long value)          { return this->putSigned(value);   }
+		LogStream& operator<<(unsigned char value)      { return this->putUnsigned(value); }
+		LogStream& operator<<(unsigned short value)     { return this->putUnsigned(value); }
+		LogStream& operator<<(unsigned int value)       { return this->putUnsigned(value); }
+		LogStream& operator<<(unsigned long value)      { return this->putUnsigned(value); }
+		LogStream& operator<<(unsigned long long value) { return this->putUnsigned(value); }
+		LogStream& operator<<(float value)              { return this->putDouble(value);   }
+		LogStream& operator<<(double value)             { return this->putDouble(value);   }
+		LogStream& operator<<(const char* value);
+		LogStream& operator<<(char* value)              { return *this << (const char*)value; }
+		LogStream& operator<<(const unsigned char* value) { return *this << (const char*)value; }
+		LogStream& operator<<(const std::string & value);
+		LogStream& operator<<(const void* value);
+		LogStream& operator<<(std::ios_base& (*manip)(std::ios_base&));
+		LogStream& operator<<(std::ostream& (*manip)(std::ostream&));
+		LogStream& operator<<(const LogSuppressed & value);
+
+		// anything else is formatted on the calling thread
+		template<typename T> LogStream& operator<<(const T & value)
+		{
+			std::ostringstream os;
+			os << value;
+			return *this << os.str();
+		}
+
+	private:
+		LogStream(const LogStream&);
+		LogStream & operator=(const LogStream&);
+
+		LogStream& putSigned(long long value);
+		LogStream& putUnsigned(unsigned long long value);
+		LogStream& putDouble(double value);
+		LogStream& putString(const char* value, size_t length);
+		bool reserve(size_t size);
+
+		LogRecord m_record;
+};
 
 inline void initLogger(int verbose)
 {
@@ -74,10 +188,8 @@ inline void initLogger(int verbose)
 
         }
     std::cout << "log level:" << LogLevel << std::endl;
+}
 
 #endif
 	
 #endif
-
-
-}
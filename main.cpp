@@ -8,31 +8,342 @@
  */
 #include <V4l2Device.h>
 #include <V4l2Capture.h>
+#include "V4l2Supervisor.h"
 #include "logger.h"
-#include "yolo.hpp"
+#include "yolo_pool.hpp"
+#include "ThreadTuning.h"
+#include "V4l2Recorder.h"
+#include "V4l2PassthroughSink.h"
+#include "V4l2ModeSelector.h"
+#include "PreviewServer.h"
+#include "SharedResults.h"
+#include "SerialOutput.h"
+#include "DepthLocator.h"
+#include "V4l2Relay.h"
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <opencv2/dnn.hpp>
 #include <algorithm>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <getopt.h>
+#include <signal.h>
 
 #include "opencv2/opencv.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/core/core.hpp>
-#include <librealsense2/rs.hpp>
-#include <librealsense2/rsutil.h>
 #include <opencv2/highgui/highgui_c.h>
 
 using namespace cv;
 using namespace std;
 
-int main()
+static atomic<int> stop(0);
+static atomic<int> reloadRequested(0);
+
+static void onReload(int)
+{
+   reloadRequested = 1;
+}
+
+// 模型和阈值的配置文件，每行 key = value: cfg, weights, conf, nms,
+// sizes(可以切换的输入宽度，例如 256,320,416), budget(每帧检测的延迟预算，ms)
+static vector<int> parseWidths(const char *list)
+{
+   vector<int> widths;
+   stringstream ss(list);
+   string item;
+   while (getline(ss, item, ','))
+   {
+      int width = atoi(item.c_str());
+      if (width > 0)
+         widths.push_back(width);
+   }
+   return widths;
+}
+
+static bool readNetConfig(const char *path, Net_config &config)
+{
+   ifstream ifs(path);
+   if (!ifs)
+   {
+      LOG(ERROR) << "Cannot read " << path;
+      return false;
+   }
+   string line;
+   while (getline(ifs, line))
+   {
+      size_t equal = line.find('=');
+      if (line.empty() || line[0] == '#' || equal == string::npos)
+         continue;
+      string key = line.substr(0, equal);
+      string value = line.substr(equal + 1);
+      key.erase(key.find_last_not_of(" \t") + 1);
+      key.erase(0, key.find_first_not_of(" \t"));
+      value.erase(value.find_last_not_of(" \t\r") + 1);
+      value.erase(0, value.find_first_not_of(" \t"));
+      if (key == "cfg")
+         config.modelConfiguration = value;
+      else if (key == "weights")
+         config.modelWeights = value;
+      else if (key == "conf")
+         config.confThreshold = atof(value.c_str());
+      else if (key == "nms")
+         config.nmsThreshold = atof(value.c_str());
+      else if (key == "sizes")
+         config.inputWidths = parseWidths(value.c_str());
+      else if (key == "budget")
+         config.latencyBudget = atof(value.c_str());
+      else
+         LOG(WARN) << path << ": unknown key " << key;
+   }
+   return true;
+}
+
+// 采集线程与推理线程之间只保留最新的一帧
+struct FrameSlot
 {
-   YOLO yolo_model(yolo_net);
+   FrameSlot() : timestamp(0), sequence(0), ready(false) {}
+   mutex lock;
+   condition_variable cond;
+   Mat frame;
+   uint64_t timestamp; // 采集时间 CLOCK_MONOTONIC us
+   unsigned int sequence;
+   bool ready;
+};
+
+// 推理线程交给显示线程的最新一帧和检测结果，显示线程来不及时直接覆盖
+struct OverlaySlot
+{
+   OverlaySlot() : inferenceTime(0), ready(false) {}
+   mutex lock;
+   condition_variable cond;
+   Mat frame;
+   vector<Detection> detections;
+   double inferenceTime;
+   bool ready;
+};
+
+// 摄像头断开或者读帧出错时由V4l2Supervisor重新打开，这段时间里推理和显示线程只是等不到新帧
+static void captureLoop(V4l2Supervisor *supervisor, const ThreadTuning &tuning, FrameSlot *slot)
+{
+   JitterStats jitter("capture", max(tuning.m_baselineFrames, 300u));
+   bool tuned = !tuning.enabled();
+   size_t recoveries = 0;
+   while (!stop)
+   {
+      if (!tuned && jitter.count() >= tuning.m_baselineFrames)
+      {
+         // 先统计未调优时的抖动，再绑核/实时调度，方便对比
+         jitter.report("before");
+         pinCurrentThread(tuning.m_captureCpus);
+         setRealtimePriority(tuning.m_fifoPriority);
+         jitter.reset();
+         tuned = true;
+      }
+      else if (tuned && jitter.count() >= 300)
+      {
+         jitter.report(tuning.enabled() ? "after" : "untuned");
+         // 实际帧率就是整个流程的上限，达不到设置值时多半是自动曝光在拉长曝光时间
+         V4l2Capture *videoCapture = supervisor->getCapture();
+         double configured = videoCapture ? videoCapture->getConfiguredFps() : 0;
+         double measured = videoCapture ? videoCapture->getMeasuredFps() : 0;
+         if (configured > 0 && measured < configured * 0.9)
+            LOG(WARN) << "camera fps:" << measured << " configured:" << configured << ", try -e";
+         else
+            LOG(NOTICE) << "camera fps:" << measured;
+         jitter.reset();
+      }
+
+      Mat v4l2Mat;
+      int ret = supervisor->read(v4l2Mat, 1000);
+      if (ret == -1) // 回放结束
+      {
+         LOG(NOTICE) << "stop";
+         stop = 1;
+      }
+      else if (ret == 1 && !v4l2Mat.empty())
+      {
+         if (supervisor->getRecoveries().size() != recoveries)
+         {
+            // 断开的这段时间不算进帧间隔的统计
+            recoveries = supervisor->getRecoveries().size();
+            jitter.reset();
+         }
+         jitter.tick();
+         V4l2Capture *videoCapture = supervisor->getCapture();
+         lock_guard<mutex> guard(slot->lock);
+         const timeval &ts = videoCapture->getTimestamp();
+         slot->frame = v4l2Mat;
+         slot->timestamp = (uint64_t)ts.tv_sec * 1000000 + ts.tv_usec;
+         slot->sequence = videoCapture->getSequence();
+         slot->ready = true;
+      }
+      slot->cond.notify_one();
+   }
+}
+
+// 画框、预览编码、转发到输出设备和imshow都在这里，最多maxFps帧每秒，推理线程只做一次交换
+static void displayLoop(const YOLO *yolo, OverlaySlot *slot, PreviewServer *preview, V4l2Relay *relay, bool display, double maxFps)
+{
+   chrono::microseconds period(maxFps > 0 ? (long)(1000000 / maxFps) : 0);
+   Mat frame;
+   vector<Detection> detections;
+   double inferenceTime = 0;
+   while (!stop)
+   {
+      {
+         unique_lock<mutex> guard(slot->lock);
+         slot->cond.wait_for(guard, chrono::seconds(1), [slot] { return slot->ready || stop; });
+         if (!slot->ready)
+            continue;
+         // 推理线程不再使用这一帧，直接在上面画
+         swap(frame, slot->frame);
+         swap(detections, slot->detections);
+         inferenceTime = slot->inferenceTime;
+         slot->frame.release();
+         slot->ready = false;
+      }
+      if (!display && !relay && !preview->wantsFrame())
+         continue;
+      chrono::steady_clock::time_point next = chrono::steady_clock::now() + period;
+
+      if (display)
+         cv::imshow("origin image", frame);
+      yolo->draw(frame, detections, inferenceTime);
+      if (preview)
+         preview->publish(frame);
+      if (relay)
+         relay->write(frame);
+      if (display)
+      {
+         imshow("yolo", frame);
+         cv::waitKey(1);
+      }
+      // 这段时间内到达的帧只保留最新的一帧
+      this_thread::sleep_until(next);
+   }
+}
+
+static void usage(const char *name)
+{
+   cout << name << " [-c cpus] [-i cpus] [-f priority] [-m] [-r file|-s file] [-P file [-F fps]] [-n fps] [-a] [-p port [-R fps]] [-x] [-D fps] [-S name [-B]] [-u device [-U baud]] [-z] [-e] [-C file] [-l ms] [-w workers [-q frames]] [-o device]" << endl;
+   cout << "\t -c cpus     : pin the capture thread, ex: 0 or 0-1,3" << endl;
+   cout << "\t -i cpus     : pin the inference thread and the OpenCV worker pool" << endl;
+   cout << "\t -f priority : SCHED_FIFO priority of the capture thread" << endl;
+   cout << "\t -m          : mlockall frame buffers and heap" << endl;
+   cout << "\t -r file     : record the raw camera frames" << endl;
+   cout << "\t -s file     : record the camera payload as is (MJPEG) with a .idx timestamp index" << endl;
+   cout << "\t -P file     : replay a recording or an H.264 elementary stream instead of the camera" << endl;
+   cout << "\t -F fps      : replay rate, 0 original timing, <0 as fast as possible" << endl;
+   cout << "\t -n fps      : minimum capture rate for the automatic mode selection (default 30)" << endl;
+   cout << "\t -a          : measure the conversion cost of each format before selecting the mode" << endl;
+   cout << "\t -p port     : serve the detections as MJPEG on http://127.0.0.1:port/" << endl;
+   cout << "\t -R fps      : preview rate (default 10)" << endl;
+   cout << "\t -x          : show the frames in local windows (imshow)" << endl;
+   cout << "\t -D fps      : maximum overlay rendering rate of the display thread (default 30)" << endl;
+   cout << "\t -S name     : publish the detections in the shared memory /dev/shm/name" << endl;
+   cout << "\t -B          : publish the frames with the detections" << endl;
+   cout << "\t -u device   : send the detections to the control board on this serial port" << endl;
+   cout << "\t -U baud     : serial baud rate (default 115200)" << endl;
+   cout << "\t -z          : 3D position of the detections from the RealSense depth stream" << endl;
+   cout << "\t -e          : manual exposure shorter than the frame period, gain compensates" << endl;
+   cout << "\t -C file     : model and thresholds (cfg=, weights=, conf=, nms=), kill -HUP reloads it live" << endl;
+   cout << "\t -l ms       : detection latency budget, the input size moves between 256, inpWidth and 416 to hold it" << endl;
+   cout << "\t -w workers  : detect consecutive frames in parallel on this many threads (default 1)" << endl;
+   cout << "\t -q frames   : frames detected or waiting for their turn, bounds the latency (default workers)" << endl;
+   cout << "\t -o device   : publish the annotated frames as YUYV on a V4L2 output (v4l2loopback), ex: /dev/video10" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+   ThreadTuning tuning;
+   const char *recordFile = NULL;
+   const char *passthroughFile = NULL;
+   const char *replayFile = NULL;
+   int replayFps = 0;
+   int previewPort = 0;
+   double previewFps = 10;
+   bool display = false;
+   double displayFps = 30;
+   const char *sharedName = NULL;
+   bool sharedFrames = false;
+   const char *serialDevice = NULL;
+   unsigned int serialBaud = 115200;
+   bool depth = false;
+   bool lockExposure = false;
+   const char *netConfigFile = NULL;
+   float latencyBudget = 0;
+   int workers = 1;
+   int maxInFlight = 0;
+   const char *relayDevice = NULL;
+   V4l2ModeConstraints constraints(yolo_net.inpWidth, yolo_net.inpHeight, 30);
+   int c = 0;
+   while ((c = getopt(argc, argv, "c:i:f:mr:s:P:F:n:ap:R:xD:S:Bu:U:zeC:l:w:q:o:h")) != -1)
+   {
+      switch (c)
+      {
+      case 'c': tuning.m_captureCpus = parseCpuList(optarg); break;
+      case 'i': tuning.m_inferenceCpus = parseCpuList(optarg); break;
+      case 'f': tuning.m_fifoPriority = atoi(optarg); break;
+      case 'm': tuning.m_lockMemory = true; break;
+      case 'r': recordFile = optarg; break;
+      case 's': passthroughFile = optarg; break;
+      case 'P': replayFile = optarg; break;
+      case 'F': replayFps = atoi(optarg); break;
+      case 'n': constraints.m_minFps = atof(optarg); break;
+      case 'a': constraints.m_calibrate = true; break;
+      case 'p': previewPort = atoi(optarg); break;
+      case 'R': previewFps = atof(optarg); break;
+      case 'x': display = true; break;
+      case 'D': displayFps = atof(optarg); break;
+      case 'S': sharedName = optarg; break;
+      case 'B': sharedFrames = true; break;
+      case 'u': serialDevice = optarg; break;
+      case 'U': serialBaud = atoi(optarg); break;
+      case 'z': depth = true; break;
+      case 'e': lockExposure = true; break;
+      case 'C': netConfigFile = optarg; break;
+      case 'l': latencyBudget = atof(optarg); break;
+      case 'w': workers = max(1, atoi(optarg)); break;
+      case 'q': maxInFlight = atoi(optarg); break;
+      case 'o': relayDevice = optarg; break;
+      default: usage(argv[0]); return -1;
+      }
+   }
+
+   if (!tuning.m_inferenceCpus.empty())
+   {
+      setNumThreads(tuning.m_inferenceCpus.size());
+      // 线程池只给推理用，采集线程的颜色转换不分出去
+      V4l2Converter::setParallel(false);
+   }
+   if (workers > 1)
+   {
+      // 多帧并行时每帧只用一个核，比单帧内的并行更能用满所有核
+      setNumThreads(1);
+   }
+   Net_config netConfig = yolo_net;
+   if (netConfigFile && !readNetConfig(netConfigFile, netConfig))
+   {
+      return -1;
+   }
+   if (latencyBudget > 0)
+   {
+      netConfig.latencyBudget = latencyBudget;
+      if (netConfig.inputWidths.empty())
+         netConfig.inputWidths = { 256, 416 };
+   }
+   if (netConfigFile)
+   {
+      // 换模型/改阈值不用重启，也不用重新打开摄像头
+      signal(SIGHUP, onReload);
+   }
    int verbose = 0;
-   int stop = 0;
    const char *in_devname = "/dev/video2"; /* V4L2_PIX_FMT_YUYV V4L2_PIX_FMT_MJPEG*/
    /*
      *使用说明，我们读取UVC免驱的摄像头时，应该避免直接使用opencv的videocpature，
@@ -40,92 +351,216 @@ int main()
      * 图像帧格式。
      * V4L2_PIX_FMT_MJPEG （MJPEG）
      */
-   V4L2DeviceParameters param(in_devname, V4L2_PIX_FMT_MJPEG, 1280, 720, 60, 0, verbose);
-   V4l2Capture *videoCapture = V4l2Capture::create(param, V4l2Access::IOTYPE_MMAP);
-   if (videoCapture == NULL)
+   V4l2Supervisor *supervisor = NULL;
+   if (replayFile)
+   {
+      V4L2DeviceParameters rparam(replayFile, 0, 0, 0, replayFps, 0, verbose);
+      supervisor = V4l2Supervisor::create(rparam, V4l2Access::IOTYPE_REPLAY);
+   }
+   else
+   {
+      // 一次打开即可: 总线信息和支持的模式都在这次open里拿到(有probe缓存时不再枚举)
+      // 格式/分辨率/帧率按网络输入大小自动选择，没有满足条件的模式时才用YUYV 640x480@120
+      V4l2ModeSelector selector(constraints);
+      V4L2DeviceParameters mparam(in_devname, V4L2_PIX_FMT_YUYV, 640, 480, 120, 0, verbose);
+      mparam.m_modeSelector = &selector;
+      mparam.m_lockExposure = lockExposure;
+      // 之后断开重连时用这次选好的模式，按总线信息找回同一个摄像头
+      supervisor = V4l2Supervisor::create(mparam, V4l2Access::IOTYPE_MMAP);
+      if (supervisor == NULL)
+      {
+         LOG(WARN) << "Cannot create V4L2 capture interface for device:"
+                   << in_devname;
+         return -1;
+      }
+      LOG(NOTICE) << "USB bus:" << supervisor->getBusInfo();
+      LOG(NOTICE) << "Start Uncompressing " << in_devname;
+   }
+   if (supervisor == NULL)
    {
-      LOG(WARN) << "Cannot create V4L2 capture interface for device:"
-                << "/dev/video2";
       return -1;
    }
-   timeval tv;
-   LOG(NOTICE) << "USB bus:" << videoCapture->getBusInfo();
-   LOG(NOTICE) << "Start Uncompressing " << in_devname;
+   // 只在采集线程启动前使用，重连后是新的对象
+   V4l2Capture *videoCapture = supervisor->getCapture();
+   V4l2FrameSink *sink = NULL;
+   if (passthroughFile)
+   {
+      sink = V4l2PassthroughSink::create(passthroughFile, videoCapture->getFormat(), videoCapture->getWidth(), videoCapture->getHeight());
+   }
+   else if (recordFile)
+   {
+      sink = V4l2Recorder::create(recordFile, videoCapture->getFormat(), videoCapture->getWidth(), videoCapture->getHeight());
+   }
+   supervisor->setSink(sink);
+   if (tuning.m_lockMemory)
+   {
+      lockMemory();
+   }
+
+   // 默认的Mat分配器只能在其他线程开始创建Mat之前替换(YOLO的frame arena)
+   ArenaMatAllocator::instance();
+
+   // 预览在自己的线程里编码发送，推理循环不再做GUI工作
+   PreviewServer *preview = NULL;
+   if (previewPort > 0)
+   {
+      preview = PreviewServer::create(previewPort, previewFps);
+   }
+
+   // 其他进程(控制程序)通过共享内存读取结果
+   SharedPublisher *publisher = NULL;
+   if (sharedName)
+   {
+      size_t frameCapacity = sharedFrames ? (size_t)videoCapture->getWidth() * videoCapture->getHeight() * 3 : 0;
+      publisher = SharedPublisher::create(sharedName, 4, 64, frameCapacity);
+   }
+   SerialOutput *serial = NULL;
+   if (serialDevice)
+   {
+      serial = SerialOutput::create(serialDevice, serialBaud);
+   }
+   // 只在检测框内查深度，不对齐整帧
+   DepthLocator *depthLocator = NULL;
+   if (depth)
+   {
+      DepthLocatorParameters dparam;
+      dparam.m_colorWidth = videoCapture->getWidth();
+      dparam.m_colorHeight = videoCapture->getHeight();
+      depthLocator = DepthLocator::create(dparam);
+   }
+   // 画好框的画面给ffplay/OBS等工具，输出设备满了就丢帧，不影响检测
+   V4l2Relay *relay = NULL;
+   if (relayDevice)
+   {
+      relay = V4l2Relay::create(relayDevice, videoCapture->getWidth(), videoCapture->getHeight());
+   }
+   vector<SharedDetection> sharedDetections;
 
-   /*while (!stop)
+   // 没有预览、转发也不显示时不画框
+   OverlaySlot overlay;
+   bool overlayEnabled = display || preview || relay;
+   JitterStats jitter("inference");
+   // 检测结果按采集顺序到这里，同一时刻只有一个线程在执行
+   auto onResult = [&](const PoolResult &result)
    {
-      tv.tv_sec = 1;
-      tv.tv_usec = 0;
-      int ret = videoCapture->isReadable(&tv);
-      if (ret == 1)
+      const vector<Detection> &detections = result.detections;
+      jitter.tick();
+      if (jitter.count() >= 300)
       {
-         cv::Mat v4l2Mat;
-         ret = videoCapture->read(v4l2Mat);
+         jitter.report("detect");
+         jitter.reset();
+      }
 
-         if (ret != 0)
+      if (publisher || serial)
+      {
+         sharedDetections.resize(detections.size());
+         for (size_t i = 0; i < detections.size(); ++i)
          {
-            LOG(NOTICE) << "stop ";
-            stop = 1;
+            const Rect &box = detections[i].box;
+            SharedDetection shared = { detections[i].classId, detections[i].confidence, box.x, box.y, box.width, box.height, { 0, 0, 0 } };
+            sharedDetections[i] = shared;
          }
-         else
+         if (depthLocator)
          {
-            cv::imwrite("test.jpg", v4l2Mat);
+            // 不等待，深度帧没到时用上一帧
+            depthLocator->update();
+            depthLocator->locate(sharedDetections);
          }
       }
-      else if (ret == -1) //返回错误
+      // 先发串口，控制板的延迟最关键
+      if (serial)
+         serial->send(result.sequence, result.timestamp, sharedDetections);
+      if (publisher)
+         publisher->publish(sharedDetections, result.inferenceTime, sharedFrames ? result.frame : Mat());
+      if (overlayEnabled)
       {
-         LOG(NOTICE) << "stop " << strerror(errno);
-         stop = 1;
+         lock_guard<mutex> guard(overlay.lock);
+         overlay.frame = result.frame;
+         overlay.detections = detections;
+         overlay.inferenceTime = result.inferenceTime;
+         overlay.ready = true;
+         overlay.cond.notify_one();
       }
-      else if (ret == 0) // 返回超时
-      {
-      }
-      break;
-   }*/
-   delete videoCapture;
-   V4L2DeviceParameters mparam(in_devname, V4L2_PIX_FMT_YUYV, 640, 480, 120, 0, verbose);
-   videoCapture = V4l2Capture::create(mparam, V4l2Access::IOTYPE_MMAP);
+   };
+   auto onWorkerStart = [&tuning](int)
+   {
+      if (!tuning.m_inferenceCpus.empty())
+         pinCurrentThread(tuning.m_inferenceCpus);
+   };
+   // opencv的工作线程在第一次parallel_for_时创建，继承调用线程的亲和性，加载网络时不会创建:
+   // 主线程绑到推理的核上，加载网络并空跑一次parallel_for_把线程池建好，
+   // 之后恢复，采集、显示线程不继承推理的核，"before"的抖动也是未调优的
+   list<int> mainCpus = getThreadCpus();
+   pinCurrentThread(tuning.m_inferenceCpus);
+   YOLOPool pool(netConfig, workers, maxInFlight > 0 ? maxInFlight : workers, onResult, onWorkerStart);
+   parallel_for_(Range(0, getNumThreads()), [](const Range &) {});
+   pinCurrentThread(mainCpus);
+
+   FrameSlot slot;
+   thread captureThread(captureLoop, supervisor, tuning, &slot);
+   thread displayThread;
+   if (overlayEnabled)
+   {
+      displayThread = thread(displayLoop, &pool.model(0), &overlay, preview, relay, display, displayFps);
+   }
    while (!stop)
    {
-      tv.tv_sec = 1;
-      tv.tv_usec = 0;
-      int ret = videoCapture->isReadable(&tv);
-      if (ret == -1) //返回错误
-      {
-         LOG(NOTICE) << "stop " << strerror(errno);
-         stop = 1;
-      }
-      else if (ret == 0) // 返回超时
-      {
-      }
-      else if (ret == 1)
+      if (reloadRequested)
       {
-         cv::Mat v4l2Mat;
-         ret = videoCapture->read(v4l2Mat);
-
-         if (ret != 0)
+         reloadRequested = 0;
+         Net_config config = netConfig;
+         if (readNetConfig(netConfigFile, config))
          {
-            LOG(NOTICE) << "stop ";
-            stop = 1;
-         }
-         else
-         //** 前面的一堆if else都是v4l2读取摄像头的判断条件，可以选择性忽视， 真正的代码在这个else里面写****/
-         {
-            //cv::imwrite("test.jpg", v4l2Mat);
-            cv::imshow("origin image", v4l2Mat);
-            //cout << v4l2Mat.channels() << endl;
-            Mat src;
-            cvtColor(v4l2Mat, src, COLOR_BGRA2BGR);
-
-            yolo_model.detect(src);
-
-            imshow("yolo", src);
-
-            cv::waitKey(1);
+            pool.setThresholds(config.confThreshold, config.nmsThreshold);
+            // 输入大小在启动时准备好，重新加载只改预算
+            pool.setLatencyBudget(config.latencyBudget);
+            // 新模型在后台加载，加载完成前继续用旧模型，不丢帧
+            if ((config.modelConfiguration != netConfig.modelConfiguration || config.modelWeights != netConfig.modelWeights)
+                && !pool.reloadAsync(config.modelConfiguration, config.modelWeights))
+            {
+               config.modelConfiguration = netConfig.modelConfiguration;
+               config.modelWeights = netConfig.modelWeights;
+            }
+            netConfig = config;
          }
       }
-
+      // 先等到可以提交，再取最新的一帧，帧不会在队列里变旧
+      if (!pool.waitReady(1000))
+         continue;
+      Mat v4l2Mat;
+      uint64_t timestamp = 0;
+      unsigned int sequence = 0;
+      {
+         unique_lock<mutex> guard(slot.lock);
+         slot.cond.wait_for(guard, chrono::seconds(1), [&slot] { return slot.ready || stop; });
+         if (!slot.ready)
+            continue;
+         v4l2Mat = slot.frame;
+         timestamp = slot.timestamp;
+         sequence = slot.sequence;
+         slot.frame.release();
+         slot.ready = false;
+      }
+      //** 前面的都是v4l2读取摄像头的判断条件，可以选择性忽视， 真正的代码在这里写****/
+      //cv::imwrite("test.jpg", v4l2Mat);
+      // V4l2Capture直接输出BGR，不再需要BGRA2BGR
+      pool.submit(v4l2Mat, timestamp, sequence);
+   }
+   captureThread.join();
+   // 之后不再有回调，下面可以释放输出
+   pool.stop();
+   if (displayThread.joinable())
+   {
+      overlay.cond.notify_one();
+      displayThread.join();
    }
+   delete preview;
+   delete relay;
+   delete publisher;
+   delete serial;
+   delete depthLocator;
+   delete supervisor;
+   delete sink;
 
    return 0;
 }
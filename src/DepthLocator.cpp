@@ -0,0 +1,287 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** DepthLocator.cpp
+**
+** 3D position of the detections from the RealSense depth stream (librealsense2)
+**
+** -------------------------------------------------------------------------*/
+
+#include <math.h>
+
+#include <algorithm>
+
+#ifdef HAVE_REALSENSE
+#include <librealsense2/rs.hpp>
+#include <librealsense2/rsutil.h>
+#endif
+
+#include "logger.h"
+#include "DepthLocator.h"
+
+#ifdef HAVE_REALSENSE
+struct DepthLocatorContext
+{
+	rs2::pipeline pipeline;
+	rs2::frame depth;               // latest depth frame, keeps its buffer alive
+	rs2_intrinsics depthIntrinsics;
+	rs2_intrinsics colorIntrinsics;
+	rs2_extrinsics colorToDepth;
+	float depthScale;               // metres per depth unit
+};
+
+// the colour frames come from V4L2, take the calibration of the matching colour profile
+static bool findColorProfile(const rs2::device & device, int width, int height, rs2::video_stream_profile & profile)
+{
+	std::vector<rs2::sensor> sensors = device.query_sensors();
+	for (size_t s = 0; s < sensors.size(); ++s)
+	{
+		std::vector<rs2::stream_profile> profiles = sensors[s].get_stream_profiles();
+		for (size_t p = 0; p < profiles.size(); ++p)
+		{
+			if ( (profiles[p].stream_type() == RS2_STREAM_COLOR) && profiles[p].is<rs2::video_stream_profile>() )
+			{
+				rs2::video_stream_profile video = profiles[p].as<rs2::video_stream_profile>();
+				if ( (video.width() == width) && (video.height() == height) )
+				{
+					profile = video;
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+#else
+struct DepthLocatorContext
+{
+};
+#endif
+
+// -----------------------------------------
+//    create locator
+// -----------------------------------------
+DepthLocator* DepthLocator::create(const DepthLocatorParameters & params)
+{
+#ifdef HAVE_REALSENSE
+	DepthLocatorContext* context = new DepthLocatorContext();
+	try
+	{
+		rs2::config config;
+		if (!params.m_bagFile.empty())
+		{
+			config.enable_device_from_file(params.m_bagFile, false);
+		}
+		config.enable_stream(RS2_STREAM_DEPTH, params.m_width, params.m_height, RS2_FORMAT_Z16, params.m_fps);
+		if (params.m_streamColor)
+		{
+			config.enable_stream(RS2_STREAM_COLOR, params.m_colorWidth, params.m_colorHeight, RS2_FORMAT_BGR8, params.m_fps);
+		}
+		rs2::pipeline_profile profile = context->pipeline.start(config);
+		rs2::device device = profile.get_device();
+		if (!params.m_bagFile.empty() && device.is<rs2::playback>())
+		{
+			// offline: every recorded frame, as fast as it is consumed
+			device.as<rs2::playback>().set_real_time(false);
+		}
+
+		rs2::video_stream_profile depthProfile = profile.get_stream(RS2_STREAM_DEPTH).as<rs2::video_stream_profile>();
+		rs2::video_stream_profile colorProfile;
+		if (params.m_streamColor)
+		{
+			colorProfile = profile.get_stream(RS2_STREAM_COLOR).as<rs2::video_stream_profile>();
+		}
+		else if (!findColorProfile(device, params.m_colorWidth, params.m_colorHeight, colorProfile))
+		{
+			LOG(ERROR) << "No RealSense colour profile " << params.m_colorWidth << "x" << params.m_colorHeight;
+			context->pipeline.stop();
+			delete context;
+			return NULL;
+		}
+		context->depthIntrinsics = depthProfile.get_intrinsics();
+		context->colorIntrinsics = colorProfile.get_intrinsics();
+		context->colorToDepth = colorProfile.get_extrinsics_to(depthProfile);
+		context->depthScale = device.first<rs2::depth_sensor>().get_depth_scale();
+
+		LOG(NOTICE) << "RealSense depth " << depthProfile.width() << "x" << depthProfile.height() << "@" << depthProfile.fps()
+			<< " scale:" << context->depthScale << (params.m_bagFile.empty() ? "" : " from ") << params.m_bagFile;
+	}
+	catch (const rs2::error & e)
+	{
+		LOG(ERROR) << "Cannot start RealSense depth: " << e.what();
+		delete context;
+		return NULL;
+	}
+	return new DepthLocator(params, context);
+#else
+	(void)params;
+	LOG(ERROR) << "Depth needs librealsense2 (HAVE_REALSENSE)";
+	return NULL;
+#endif
+}
+
+DepthLocator::DepthLocator(const DepthLocatorParameters & params, DepthLocatorContext* context)
+	: m_params(params), m_context(context)
+{
+	m_samples.reserve(m_params.m_maxSamples + 64);
+}
+
+DepthLocator::~DepthLocator()
+{
+#ifdef HAVE_REALSENSE
+	try
+	{
+		m_context->pipeline.stop();
+	}
+	catch (const rs2::error & e)
+	{
+		LOG(WARN) << "RealSense stop: " << e.what();
+	}
+#endif
+	delete m_context;
+}
+
+// -----------------------------------------
+//    latest depth frame
+// -----------------------------------------
+bool DepthLocator::update(cv::Mat* color, unsigned int timeoutMs)
+{
+#ifdef HAVE_REALSENSE
+	rs2::frameset frames;
+	try
+	{
+		bool received = timeoutMs ? m_context->pipeline.try_wait_for_frames(&frames, timeoutMs) : m_context->pipeline.poll_for_frames(&frames);
+		if (!received)
+		{
+			return false;
+		}
+	}
+	catch (const rs2::error & e)
+	{
+		LOG_EVERY_MS(ERROR, 1000) << "RealSense frames: " << e.what();
+		return false;
+	}
+	rs2::depth_frame depth = frames.get_depth_frame();
+	if (depth)
+	{
+		m_context->depth = depth;
+	}
+	if (color)
+	{
+		rs2::video_frame frame = frames.get_color_frame();
+		if (frame)
+		{
+			cv::Mat(frame.get_height(), frame.get_width(), CV_8UC3, (void*)frame.get_data(), frame.get_stride_in_bytes()).copyTo(*color);
+		}
+		else
+		{
+			color->release();
+		}
+	}
+	return depth;
+#else
+	(void)color; (void)timeoutMs;
+	return false;
+#endif
+}
+
+// -----------------------------------------
+//    boxes
+// -----------------------------------------
+// colour box corners seen from the depth camera, assuming the target is at depth metres
+cv::Rect DepthLocator::depthRoi(const cv::Rect & colorBox, float depth)
+{
+#ifdef HAVE_REALSENSE
+	float dx = colorBox.width * m_params.m_shrink;
+	float dy = colorBox.height * m_params.m_shrink;
+	float corners[2][2] = { { colorBox.x + dx, colorBox.y + dy }, { colorBox.x + colorBox.width - dx, colorBox.y + colorBox.height - dy } };
+	float minX = 1e9f, minY = 1e9f, maxX = -1e9f, maxY = -1e9f;
+	for (int i = 0; i < 2; ++i)
+	{
+		float colorPoint[3], depthPoint[3], pixel[2];
+		rs2_deproject_pixel_to_point(colorPoint, &m_context->colorIntrinsics, corners[i], depth);
+		rs2_transform_point_to_point(depthPoint, &m_context->colorToDepth, colorPoint);
+		rs2_project_point_to_pixel(pixel, &m_context->depthIntrinsics, depthPoint);
+		minX = std::min(minX, pixel[0]);
+		minY = std::min(minY, pixel[1]);
+		maxX = std::max(maxX, pixel[0]);
+		maxY = std::max(maxY, pixel[1]);
+	}
+	cv::Rect roi(cv::Point((int)floorf(minX), (int)floorf(minY)), cv::Point((int)ceilf(maxX) + 1, (int)ceilf(maxY) + 1));
+	return roi & cv::Rect(0, 0, m_context->depthIntrinsics.width, m_context->depthIntrinsics.height);
+#else
+	(void)colorBox; (void)depth;
+	return cv::Rect();
+#endif
+}
+
+float DepthLocator::medianDepth(const cv::Rect & roi)
+{
+#ifdef HAVE_REALSENSE
+	if ( !m_context->depth || (roi.area() <= 0) )
+	{
+		return 0;
+	}
+	rs2::depth_frame depth = m_context->depth.as<rs2::depth_frame>();
+	const uint16_t* data = (const uint16_t*)depth.get_data();
+	int stride = depth.get_stride_in_bytes() / sizeof(uint16_t);
+	// at most m_maxSamples reads per box whatever its size
+	int step = std::max(1, (int)ceil(sqrt((double)roi.area() / m_params.m_maxSamples)));
+	uint16_t minRaw = (uint16_t)std::min(65535.0f, m_params.m_minDepth / m_context->depthScale);
+	uint16_t maxRaw = (uint16_t)std::min(65535.0f, m_params.m_maxDepth / m_context->depthScale);
+
+	m_samples.clear();
+	for (int y = roi.y + step / 2; y < roi.y + roi.height; y += step)
+	{
+		const uint16_t* row = data + y * stride;
+		for (int x = roi.x + step / 2; x < roi.x + roi.width; x += step)
+		{
+			// 0 is a hole, out of range values are noise or the background
+			if ( (row[x] >= minRaw) && (row[x] <= maxRaw) )
+				m_samples.push_back(row[x]);
+		}
+	}
+	if (m_samples.empty())
+	{
+		return 0;
+	}
+	std::vector<uint16_t>::iterator middle = m_samples.begin() + m_samples.size() / 2;
+	std::nth_element(m_samples.begin(), middle, m_samples.end());
+	return *middle * m_context->depthScale;
+#else
+	(void)roi;
+	return 0;
+#endif
+}
+
+float DepthLocator::boxDepth(const cv::Rect & colorBox)
+{
+	// the box position in the depth image depends on the depth itself: guess, measure, then refine once
+	float depth = medianDepth(depthRoi(colorBox, (m_params.m_minDepth + m_params.m_maxDepth) / 4));
+	if (depth > 0)
+	{
+		float refined = medianDepth(depthRoi(colorBox, depth));
+		if (refined > 0)
+			depth = refined;
+	}
+	return depth;
+}
+
+void DepthLocator::locate(std::vector<SharedDetection> & detections)
+{
+	for (size_t i = 0; i < detections.size(); ++i)
+	{
+		SharedDetection & d = detections[i];
+		d.position[0] = d.position[1] = d.position[2] = 0;
+#ifdef HAVE_REALSENSE
+		float depth = this->boxDepth(cv::Rect(d.x, d.y, d.width, d.height));
+		if (depth > 0)
+		{
+			float center[2] = { d.x + d.width / 2.0f, d.y + d.height / 2.0f };
+			rs2_deproject_pixel_to_point(d.position, &m_context->colorIntrinsics, center, depth);
+		}
+#endif
+	}
+}
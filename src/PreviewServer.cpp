@@ -0,0 +1,388 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** PreviewServer.cpp
+**
+** MJPEG over HTTP preview of the processed frames
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <chrono>
+#include <sstream>
+
+#include "opencv2/imgcodecs.hpp"
+
+#include "logger.h"
+#include "PreviewServer.h"
+
+#define PREVIEW_BOUNDARY     "preview"
+#define PREVIEW_MAX_REQUEST  4096
+#define PREVIEW_MAX_CLIENTS  8
+
+static int64_t steadyMicros()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// -----------------------------------------
+//    create server
+// -----------------------------------------
+PreviewServer* PreviewServer::create(unsigned short port, double fps, int quality, const std::string & address)
+{
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1)
+	{
+		LOG(ERROR) << "Invalid preview address:" << address;
+		return NULL;
+	}
+
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+	{
+		LOG(ERROR) << "Cannot create preview socket " << strerror(errno);
+		return NULL;
+	}
+	int reuse = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	if ( (bind(fd, (sockaddr*)&addr, sizeof(addr)) == -1) || (listen(fd, PREVIEW_MAX_CLIENTS) == -1) )
+	{
+		LOG(ERROR) << "Cannot listen on " << address << ":" << port << " " << strerror(errno);
+		::close(fd);
+		return NULL;
+	}
+
+	int wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakeFd == -1)
+	{
+		LOG(ERROR) << "Cannot create preview eventfd " << strerror(errno);
+		::close(fd);
+		return NULL;
+	}
+	LOG(NOTICE) << "Preview on http://" << address << ":" << port << "/ at " << fps << " fps";
+	return new PreviewServer(fd, wakeFd, fps, quality);
+}
+
+// -----------------------------------------
+//    constructor
+// -----------------------------------------
+PreviewServer::PreviewServer(int listenFd, int wakeFd, double fps, int quality)
+	: m_listenFd(listenFd), m_wakeFd(wakeFd), m_period(fps > 0 ? (int64_t)(1000000 / fps) : 0), m_quality(quality),
+	  m_clients(0), m_nextFrame(0), m_skipped(0), m_stop(false), m_hasPending(false)
+{
+	m_server = std::thread(&PreviewServer::serverLoop, this);
+}
+
+// -----------------------------------------
+//    destructor
+// -----------------------------------------
+PreviewServer::~PreviewServer()
+{
+	m_stop = true;
+	uint64_t one = 1;
+	if (::write(m_wakeFd, &one, sizeof(one)) != sizeof(one))
+	{
+		LOG(WARN) << "Cannot wake up the preview server " << strerror(errno);
+	}
+	if (m_server.joinable())
+	{
+		m_server.join();
+	}
+	while (!m_clientList.empty())
+	{
+		this->closeClient(m_clientList.size() - 1);
+	}
+	::close(m_wakeFd);
+	::close(m_listenFd);
+}
+
+bool PreviewServer::wantsFrame() const
+{
+	return (m_clients != 0) && (steadyMicros() >= m_nextFrame);
+}
+
+// -----------------------------------------
+//    called from the processing thread
+// -----------------------------------------
+void PreviewServer::publish(const cv::Mat & image)
+{
+	if (!this->wantsFrame() || image.empty())
+	{
+		return;
+	}
+	m_nextFrame = steadyMicros() + m_period;
+	{
+		// the server thread encodes a copy, the caller keeps drawing on its own image
+		std::lock_guard<std::mutex> lock(m_mutex);
+		image.copyTo(m_pending);
+		m_hasPending = true;
+	}
+	uint64_t one = 1;
+	if (::write(m_wakeFd, &one, sizeof(one)) != sizeof(one))
+	{
+		LOG_EVERY_MS(WARN, 1000) << "Cannot wake up the preview server " << strerror(errno);
+	}
+}
+
+// -----------------------------------------
+//    server thread
+// -----------------------------------------
+void PreviewServer::serverLoop()
+{
+	std::vector<pollfd> fds;
+	while (!m_stop)
+	{
+		fds.clear();
+		pollfd listenFd = { m_listenFd, POLLIN, 0 };
+		pollfd wakeFd = { m_wakeFd, POLLIN, 0 };
+		fds.push_back(listenFd);
+		fds.push_back(wakeFd);
+		for (size_t i = 0; i < m_clientList.size(); ++i)
+		{
+			// pending data: wait until the socket drains, otherwise only watch for the request / hangup
+			short events = m_clientList[i].payload ? POLLOUT : POLLIN;
+			pollfd clientFd = { m_clientList[i].fd, events, 0 };
+			fds.push_back(clientFd);
+		}
+
+		if (poll(fds.data(), fds.size(), 1000) == -1)
+		{
+			if (errno != EINTR)
+			{
+				LOG(ERROR) << "Preview poll failed " << strerror(errno);
+				break;
+			}
+			continue;
+		}
+
+		// clients first, indexes in fds match m_clientList before accept/close
+		for (size_t i = m_clientList.size(); i-- > 0; )
+		{
+			const pollfd & pfd = fds[i + 2];
+			bool alive = true;
+			if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+			{
+				alive = false;
+			}
+			else if (pfd.revents & POLLOUT)
+			{
+				alive = this->flush(m_clientList[i]);
+			}
+			else if (pfd.revents & POLLIN)
+			{
+				alive = this->readRequest(m_clientList[i]);
+			}
+			if (!alive)
+			{
+				this->closeClient(i);
+			}
+		}
+		if (fds[1].revents & POLLIN)
+		{
+			uint64_t count = 0;
+			if (::read(m_wakeFd, &count, sizeof(count)) == sizeof(count))
+			{
+				this->broadcast();
+			}
+		}
+		if (fds[0].revents & POLLIN)
+		{
+			this->acceptClient();
+		}
+	}
+}
+
+void PreviewServer::acceptClient()
+{
+	sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int fd = accept4(m_listenFd, (sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd == -1)
+	{
+		if ( (errno != EAGAIN) && (errno != EWOULDBLOCK) )
+		{
+			LOG_EVERY_MS(WARN, 1000) << "Preview accept failed " << strerror(errno);
+		}
+		return;
+	}
+	if (m_clientList.size() >= PREVIEW_MAX_CLIENTS)
+	{
+		LOG_EVERY_MS(WARN, 1000) << "Too many preview clients";
+		::close(fd);
+		return;
+	}
+	char ip[INET_ADDRSTRLEN] = "";
+	inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+	LOG(NOTICE) << "Preview client " << ip << ":" << ntohs(addr.sin_port);
+
+	Client client;
+	client.fd = fd;
+	client.streaming = false;
+	client.sent = 0;
+	m_clientList.push_back(client);
+}
+
+// returns false when the client must be closed
+bool PreviewServer::readRequest(Client & client)
+{
+	char buffer[512];
+	ssize_t size = ::recv(client.fd, buffer, sizeof(buffer), 0);
+	if (size == 0)
+	{
+		return false;
+	}
+	if (size < 0)
+	{
+		return (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR);
+	}
+	if (client.streaming)
+	{
+		// nothing more is expected once streaming
+		return true;
+	}
+	client.request.append(buffer, size);
+	if (client.request.find("\r\n\r\n") == std::string::npos)
+	{
+		return client.request.size() < PREVIEW_MAX_REQUEST;
+	}
+
+	std::string header;
+	if (client.request.compare(0, 4, "GET ") == 0)
+	{
+		header = "HTTP/1.0 200 OK\r\n"
+		         "Content-Type: multipart/x-mixed-replace; boundary=" PREVIEW_BOUNDARY "\r\n"
+		         "Cache-Control: no-cache, no-store\r\n"
+		         "Pragma: no-cache\r\n"
+		         "Connection: close\r\n"
+		         "\r\n";
+		client.streaming = true;
+		m_clients = m_clients + 1;
+	}
+	else
+	{
+		header = "HTTP/1.0 405 Method Not Allowed\r\nConnection: close\r\n\r\n";
+	}
+	client.request.clear();
+	client.payload = std::make_shared< const std::vector<unsigned char> >(header.begin(), header.end());
+	client.sent = 0;
+	return this->flush(client) && client.streaming;
+}
+
+// send what the socket accepts without blocking, returns false when the client must be closed
+bool PreviewServer::flush(Client & client)
+{
+	while (client.payload && (client.sent < client.payload->size()))
+	{
+		ssize_t size = ::send(client.fd, client.payload->data() + client.sent, client.payload->size() - client.sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (size < 0)
+		{
+			if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) )
+			{
+				return true;
+			}
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		client.sent += size;
+	}
+	client.payload.reset();
+	client.sent = 0;
+	return true;
+}
+
+// encode the pending frame once and queue it on every idle client
+void PreviewServer::broadcast()
+{
+	cv::Mat image;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_hasPending)
+			return;
+		// swap so that the next copyTo in publish reuses the buffer of the previous frame
+		cv::swap(image, m_pending);
+		m_hasPending = false;
+	}
+	if (m_clients == 0)
+	{
+		return;
+	}
+
+	std::vector<unsigned char> jpeg;
+	std::vector<int> params;
+	params.push_back(cv::IMWRITE_JPEG_QUALITY);
+	params.push_back(m_quality);
+	if (!cv::imencode(".jpg", image, jpeg, params))
+	{
+		LOG_EVERY_MS(WARN, 1000) << "Cannot encode the preview frame";
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_hasPending)
+		{
+			cv::swap(image, m_pending);
+		}
+	}
+
+	std::ostringstream os;
+	os << "--" PREVIEW_BOUNDARY "\r\n"
+	   << "Content-Type: image/jpeg\r\n"
+	   << "Content-Length: " << jpeg.size() << "\r\n"
+	   << "\r\n";
+	std::string header = os.str();
+	std::shared_ptr< std::vector<unsigned char> > part = std::make_shared< std::vector<unsigned char> >();
+	part->reserve(header.size() + jpeg.size() + 2);
+	part->insert(part->end(), header.begin(), header.end());
+	part->insert(part->end(), jpeg.begin(), jpeg.end());
+	part->push_back('\r');
+	part->push_back('\n');
+	Payload payload = part;
+
+	for (size_t i = m_clientList.size(); i-- > 0; )
+	{
+		Client & client = m_clientList[i];
+		if (!client.streaming)
+			continue;
+		if (client.payload)
+		{
+			// still sending the previous frame, only the latest frame matters
+			m_skipped++;
+			continue;
+		}
+		client.payload = payload;
+		client.sent = 0;
+		if (!this->flush(client))
+		{
+			this->closeClient(i);
+		}
+	}
+}
+
+void PreviewServer::closeClient(size_t index)
+{
+	Client & client = m_clientList[index];
+	if (client.streaming)
+	{
+		m_clients = m_clients - 1;
+	}
+	::close(client.fd);
+	m_clientList.erase(m_clientList.begin() + index);
+	LOG(NOTICE) << "Preview client closed, " << m_clients << " left";
+}
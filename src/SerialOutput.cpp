@@ -0,0 +1,250 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** SerialOutput.cpp
+**
+** Compact CRC checked detection frames sent to the control board over a UART
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+
+#include <algorithm>
+
+#include "logger.h"
+#include "SerialOutput.h"
+
+static speed_t baudConstant(unsigned int baud)
+{
+	switch (baud)
+	{
+		case 9600:    return B9600;
+		case 19200:   return B19200;
+		case 38400:   return B38400;
+		case 57600:   return B57600;
+		case 115200:  return B115200;
+		case 230400:  return B230400;
+		case 460800:  return B460800;
+		case 500000:  return B500000;
+		case 576000:  return B576000;
+		case 921600:  return B921600;
+		case 1000000: return B1000000;
+		case 1500000: return B1500000;
+		case 2000000: return B2000000;
+		case 3000000: return B3000000;
+		case 4000000: return B4000000;
+	}
+	return B0;
+}
+
+static void put16(std::vector<unsigned char> & packet, uint16_t value)
+{
+	packet.push_back(value & 0xff);
+	packet.push_back(value >> 8);
+}
+
+static void put32(std::vector<unsigned char> & packet, uint32_t value)
+{
+	put16(packet, value & 0xffff);
+	put16(packet, value >> 16);
+}
+
+static int16_t clamp16(int32_t value)
+{
+	return (int16_t)std::max(-32768, std::min(32767, value));
+}
+
+static bool higherConfidence(const SharedDetection & a, const SharedDetection & b)
+{
+	return a.confidence > b.confidence;
+}
+
+// -----------------------------------------
+//    create output
+// -----------------------------------------
+SerialOutput* SerialOutput::create(const std::string & device, unsigned int baud, unsigned int maxDetections)
+{
+	speed_t speed = baudConstant(baud);
+	if (speed == B0)
+	{
+		LOG(ERROR) << "Unsupported baud rate:" << baud;
+		return NULL;
+	}
+	int fd = open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1)
+	{
+		LOG(ERROR) << "Cannot open serial port:" << device << " " << strerror(errno);
+		return NULL;
+	}
+	termios tty;
+	if (tcgetattr(fd, &tty) == -1)
+	{
+		LOG(ERROR) << "Not a serial port:" << device << " " << strerror(errno);
+		::close(fd);
+		return NULL;
+	}
+	// 8N1, no flow control, no line discipline processing
+	cfmakeraw(&tty);
+	tty.c_cflag |= CLOCAL | CREAD;
+	tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+	cfsetispeed(&tty, speed);
+	cfsetospeed(&tty, speed);
+	if (tcsetattr(fd, TCSANOW, &tty) == -1)
+	{
+		LOG(ERROR) << "Cannot configure serial port:" << device << " " << strerror(errno);
+		::close(fd);
+		return NULL;
+	}
+	tcflush(fd, TCIOFLUSH);
+
+	LOG(NOTICE) << "Detections on " << device << " at " << baud << " baud";
+	return new SerialOutput(device, fd, std::min(maxDetections, 255u));
+}
+
+// -----------------------------------------
+//    constructor
+// -----------------------------------------
+SerialOutput::SerialOutput(const std::string & device, int fd, unsigned int maxDetections)
+	: m_device(device), m_fd(fd), m_maxDetections(maxDetections), m_hasPending(false), m_stop(false), m_sent(0), m_dropped(0)
+{
+	m_writer = std::thread(&SerialOutput::writerLoop, this);
+}
+
+// -----------------------------------------
+//    destructor
+// -----------------------------------------
+SerialOutput::~SerialOutput()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cond.notify_one();
+	if (m_writer.joinable())
+	{
+		m_writer.join();
+	}
+	::close(m_fd);
+}
+
+// CRC-16/CCITT-FALSE: poly 0x1021, init 0xFFFF, no reflection
+uint16_t SerialOutput::crc16(const unsigned char* data, size_t size)
+{
+	uint16_t crc = 0xFFFF;
+	for (size_t i = 0; i < size; ++i)
+	{
+		crc ^= (uint16_t)data[i] << 8;
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		}
+	}
+	return crc;
+}
+
+void SerialOutput::encode(uint32_t sequence, uint64_t timestamp, const std::vector<SharedDetection> & detections, unsigned int maxDetections, std::vector<unsigned char> & packet)
+{
+	// keep the most confident boxes when there are too many for one packet
+	std::vector<SharedDetection> sorted;
+	const std::vector<SharedDetection>* boxes = &detections;
+	if (detections.size() > maxDetections)
+	{
+		sorted = detections;
+		std::partial_sort(sorted.begin(), sorted.begin() + maxDetections, sorted.end(), higherConfidence);
+		sorted.resize(maxDetections);
+		boxes = &sorted;
+	}
+
+	packet.clear();
+	packet.push_back(SERIAL_OUTPUT_SYNC0);
+	packet.push_back(SERIAL_OUTPUT_SYNC1);
+	packet.push_back(SERIAL_OUTPUT_VERSION);
+	packet.push_back(boxes->size());
+	put32(packet, sequence);
+	put32(packet, (uint32_t)timestamp);
+	for (size_t i = 0; i < boxes->size(); ++i)
+	{
+		const SharedDetection & d = (*boxes)[i];
+		packet.push_back(std::min(std::max(d.classId, 0), 255));
+		packet.push_back((unsigned char)(std::min(std::max(d.confidence, 0.0f), 1.0f) * 255 + 0.5f));
+		put16(packet, clamp16(d.x));
+		put16(packet, clamp16(d.y));
+		put16(packet, clamp16(d.width));
+		put16(packet, clamp16(d.height));
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			put16(packet, clamp16((int32_t)(d.position[axis] * 1000)));
+		}
+	}
+	put16(packet, crc16(packet.data() + 2, packet.size() - 2));
+}
+
+// -----------------------------------------
+//    called from the inference thread
+// -----------------------------------------
+void SerialOutput::send(uint32_t sequence, uint64_t timestamp, const std::vector<SharedDetection> & detections)
+{
+	encode(sequence, timestamp, detections, m_maxDetections, m_packet);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_hasPending)
+		{
+			// the writer did not take the previous packet, only the latest matters
+			m_dropped++;
+		}
+		m_pending.swap(m_packet);
+		m_hasPending = true;
+	}
+	m_cond.notify_one();
+}
+
+// -----------------------------------------
+//    writer thread
+// -----------------------------------------
+void SerialOutput::writerLoop()
+{
+	std::vector<unsigned char> packet;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cond.wait(lock, [this] { return m_hasPending || m_stop; });
+			if (m_stop)
+				break;
+			packet.swap(m_pending);
+			m_hasPending = false;
+		}
+
+		// a packet is never cut, the next one waits until this one is in the UART
+		size_t written = 0;
+		while ( (written < packet.size()) && !m_stop )
+		{
+			ssize_t size = ::write(m_fd, packet.data() + written, packet.size() - written);
+			if (size > 0)
+			{
+				written += size;
+			}
+			else if ( (size < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) )
+			{
+				LOG_EVERY_MS(ERROR, 1000) << "Cannot write to " << m_device << " " << strerror(errno);
+				break;
+			}
+			else
+			{
+				pollfd pfd = { m_fd, POLLOUT, 0 };
+				poll(&pfd, 1, 100);
+			}
+		}
+		if (written == packet.size())
+		{
+			m_sent++;
+		}
+	}
+}
@@ -0,0 +1,310 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** SharedResults.cpp
+**
+** Detections and frames published to other processes through POSIX shared memory
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include "logger.h"
+#include "SharedResults.h"
+
+#define SHARED_ALIGN 64
+
+static size_t alignUp(size_t size)
+{
+	return (size + SHARED_ALIGN - 1) / SHARED_ALIGN * SHARED_ALIGN;
+}
+
+static std::string shmName(const std::string & name)
+{
+	return (name.empty() || name[0] != '/') ? "/" + name : name;
+}
+
+// slots start on their own cache line after the header
+static char* slotAddress(char* memory, const SharedResultsHeader* header, uint64_t frameId)
+{
+	return memory + alignUp(sizeof(SharedResultsHeader)) + (frameId % header->slotCount) * header->slotSize;
+}
+
+static size_t imageOffset(const SharedResultsHeader* header)
+{
+	return alignUp(sizeof(SharedResultSlot) + header->maxDetections * sizeof(SharedDetection));
+}
+
+static uint64_t monotonicMicros()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// -----------------------------------------
+//    create publisher
+// -----------------------------------------
+SharedPublisher* SharedPublisher::create(const std::string & name, unsigned int slotCount, unsigned int maxDetections, size_t frameCapacity)
+{
+	std::string path = shmName(name);
+	if (slotCount < 2)
+	{
+		slotCount = 2;
+	}
+	size_t slotSize = alignUp(sizeof(SharedResultSlot) + maxDetections * sizeof(SharedDetection)) + alignUp(frameCapacity);
+	size_t size = alignUp(sizeof(SharedResultsHeader)) + slotCount * slotSize;
+
+	// readers of a previous run keep their old mapping, they have to reopen
+	shm_unlink(path.c_str());
+	int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd == -1)
+	{
+		LOG(ERROR) << "Cannot create shared memory:" << path << " " << strerror(errno);
+		return NULL;
+	}
+	if (ftruncate(fd, size) == -1)
+	{
+		LOG(ERROR) << "Cannot size shared memory:" << path << " " << strerror(errno);
+		::close(fd);
+		shm_unlink(path.c_str());
+		return NULL;
+	}
+	void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (memory == MAP_FAILED)
+	{
+		LOG(ERROR) << "Cannot map shared memory:" << path << " " << strerror(errno);
+		shm_unlink(path.c_str());
+		return NULL;
+	}
+
+	SharedResultsHeader* header = (SharedResultsHeader*)memory;
+	header->version = SHARED_RESULTS_VERSION;
+	header->slotCount = slotCount;
+	header->maxDetections = maxDetections;
+	header->frameCapacity = alignUp(frameCapacity);
+	header->slotSize = slotSize;
+	header->latest = 0;
+	header->writerPid = getpid();
+	// readers check the magic first, publish it once the layout is complete
+	__atomic_store_n(&header->magic, SHARED_RESULTS_MAGIC, __ATOMIC_RELEASE);
+
+	LOG(NOTICE) << "Publishing results in /dev/shm" << path << " slots:" << slotCount << " size:" << size;
+	return new SharedPublisher(path, (char*)memory, size);
+}
+
+SharedPublisher::SharedPublisher(const std::string & name, char* memory, size_t size)
+	: m_name(name), m_memory(memory), m_size(size), m_header((SharedResultsHeader*)memory), m_frameId(0)
+{
+}
+
+SharedPublisher::~SharedPublisher()
+{
+	munmap(m_memory, m_size);
+	shm_unlink(m_name.c_str());
+}
+
+// -----------------------------------------
+//    writer, never waits for the readers
+// -----------------------------------------
+uint64_t SharedPublisher::publish(const std::vector<SharedDetection> & detections, double inferenceTime, const cv::Mat & frame)
+{
+	uint64_t frameId = m_frameId++;
+	SharedResultSlot* slot = (SharedResultSlot*)slotAddress(m_memory, m_header, frameId);
+
+	__atomic_store_n(&slot->sequence, 2 * frameId + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	size_t count = std::min(detections.size(), (size_t)m_header->maxDetections);
+	slot->frameId = frameId;
+	slot->timestamp = monotonicMicros();
+	slot->inferenceTime = inferenceTime;
+	slot->count = count;
+	if (count)
+	{
+		memcpy((char*)slot + sizeof(SharedResultSlot), detections.data(), count * sizeof(SharedDetection));
+	}
+
+	size_t imageSize = frame.empty() ? 0 : frame.cols * frame.elemSize() * frame.rows;
+	if (imageSize && (imageSize <= m_header->frameCapacity))
+	{
+		char* image = (char*)slot + imageOffset(m_header);
+		size_t lineSize = frame.cols * frame.elemSize();
+		if (frame.isContinuous())
+		{
+			memcpy(image, frame.data, imageSize);
+		}
+		else
+		{
+			for (int y = 0; y < frame.rows; ++y)
+			{
+				memcpy(image + y * lineSize, frame.ptr(y), lineSize);
+			}
+		}
+		slot->width = frame.cols;
+		slot->height = frame.rows;
+		slot->type = frame.type();
+		slot->step = lineSize;
+	}
+	else
+	{
+		if (imageSize)
+		{
+			LOG_EVERY_MS(WARN, 5000) << "Frame of " << imageSize << " bytes does not fit in the shared memory slots (" << m_header->frameCapacity << ")";
+		}
+		slot->width = slot->height = slot->type = 0;
+		slot->step = 0;
+	}
+
+	__atomic_store_n(&slot->sequence, 2 * frameId + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&m_header->latest, frameId + 1, __ATOMIC_RELEASE);
+	return frameId;
+}
+
+// -----------------------------------------
+//    open subscriber
+// -----------------------------------------
+SharedSubscriber* SharedSubscriber::open(const std::string & name)
+{
+	std::string path = shmName(name);
+	int fd = shm_open(path.c_str(), O_RDONLY, 0);
+	if (fd == -1)
+	{
+		LOG(ERROR) << "Cannot open shared memory:" << path << " " << strerror(errno);
+		return NULL;
+	}
+	struct stat st;
+	if ( (fstat(fd, &st) == -1) || ((size_t)st.st_size < alignUp(sizeof(SharedResultsHeader))) )
+	{
+		LOG(ERROR) << "Invalid shared memory:" << path;
+		::close(fd);
+		return NULL;
+	}
+	void* memory = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (memory == MAP_FAILED)
+	{
+		LOG(ERROR) << "Cannot map shared memory:" << path << " " << strerror(errno);
+		return NULL;
+	}
+
+	const SharedResultsHeader* header = (const SharedResultsHeader*)memory;
+	if ( (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHARED_RESULTS_MAGIC)
+		|| (header->version != SHARED_RESULTS_VERSION)
+		|| (alignUp(sizeof(SharedResultsHeader)) + header->slotCount * header->slotSize > (size_t)st.st_size) )
+	{
+		LOG(ERROR) << "Unexpected shared memory layout:" << path;
+		munmap(memory, st.st_size);
+		return NULL;
+	}
+	return new SharedSubscriber((char*)memory, st.st_size);
+}
+
+SharedSubscriber::SharedSubscriber(char* memory, size_t size)
+	: m_memory(memory), m_size(size), m_header((const SharedResultsHeader*)memory)
+{
+}
+
+SharedSubscriber::~SharedSubscriber()
+{
+	munmap(m_memory, m_size);
+}
+
+uint64_t SharedSubscriber::latest() const
+{
+	return __atomic_load_n(&m_header->latest, __ATOMIC_ACQUIRE);
+}
+
+bool SharedSubscriber::read(SharedResult & result)
+{
+	// the writer may overwrite the slot while we copy, retry with the newest frame
+	for (int retry = 0; retry < 4; ++retry)
+	{
+		uint64_t latest = this->latest();
+		if (latest == 0)
+		{
+			return false;
+		}
+		uint64_t frameId = latest - 1;
+		const SharedResultSlot* slot = (const SharedResultSlot*)slotAddress(m_memory, m_header, frameId);
+		uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		if (sequence != 2 * frameId + 2)
+		{
+			continue;
+		}
+
+		uint32_t count = std::min(slot->count, m_header->maxDetections);
+		result.detections.resize(count);
+		if (count)
+		{
+			memcpy(result.detections.data(), (const char*)slot + sizeof(SharedResultSlot), count * sizeof(SharedDetection));
+		}
+		result.frameId = slot->frameId;
+		result.timestamp = slot->timestamp;
+		result.inferenceTime = slot->inferenceTime;
+		uint32_t width = slot->width;
+		uint32_t height = slot->height;
+		uint32_t type = slot->type;
+		uint64_t step = slot->step;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != sequence)
+		{
+			continue;
+		}
+
+		result.slot = slot;
+		result.sequence = sequence;
+		if (width && height && (step * height <= m_header->frameCapacity))
+		{
+			// no copy, the caller checks valid() once done with the pixels
+			result.frame = cv::Mat(height, width, type, (char*)slot + imageOffset(m_header), step);
+		}
+		else
+		{
+			result.frame.release();
+		}
+		return true;
+	}
+	return false;
+}
+
+bool SharedSubscriber::wait(uint64_t frameId, SharedResult & result, int timeoutMs)
+{
+	uint64_t deadline = monotonicMicros() + (uint64_t)timeoutMs * 1000;
+	unsigned int spin = 0;
+	while (this->latest() <= frameId + 1)
+	{
+		// spin first for the lowest handoff latency, then back off
+		if (++spin > 1000)
+		{
+			if (monotonicMicros() >= deadline)
+			{
+				return false;
+			}
+			usleep(50);
+		}
+	}
+	return this->read(result);
+}
+
+bool SharedSubscriber::valid(const SharedResult & result) const
+{
+	if (result.slot == NULL)
+	{
+		return false;
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&result.slot->sequence, __ATOMIC_RELAXED) == result.sequence;
+}
@@ -0,0 +1,164 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** ThreadTuning.cpp
+** 
+** CPU affinity, real-time scheduling and memory locking helpers
+**
+** -------------------------------------------------------------------------*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#include "logger.h"
+#include "ThreadTuning.h"
+
+std::list<int> parseCpuList(const char* cpus)
+{
+	std::list<int> list;
+	const char* ptr = cpus;
+	while (ptr && *ptr)
+	{
+		char* end = NULL;
+		int first = strtol(ptr, &end, 10);
+		if (end == ptr) break;
+		int last = first;
+		if (*end == '-')
+		{
+			ptr = end + 1;
+			last = strtol(ptr, &end, 10);
+			if (end == ptr) break;
+		}
+		for (int cpu = first; cpu <= last; ++cpu)
+		{
+			list.push_back(cpu);
+		}
+		ptr = (*end == ',') ? end + 1 : NULL;
+	}
+	return list;
+}
+
+bool pinCurrentThread(const std::list<int>& cpus)
+{
+	if (cpus.empty())
+		return true;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (std::list<int>::const_iterator it = cpus.begin(); it != cpus.end(); ++it)
+	{
+		CPU_SET(*it, &set);
+	}
+	int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (ret != 0)
+	{
+		LOG(WARN) << "Cannot set thread affinity " << strerror(ret);
+		return false;
+	}
+	return true;
+}
+
+std::list<int> getThreadCpus()
+{
+	std::list<int> list;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	int ret = pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+	if (ret != 0)
+	{
+		LOG(WARN) << "Cannot get thread affinity " << strerror(ret);
+		return list;
+	}
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+	{
+		if (CPU_ISSET(cpu, &set))
+			list.push_back(cpu);
+	}
+	return list;
+}
+
+bool setRealtimePriority(int priority)
+{
+	if (priority <= 0)
+		return true;
+
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = std::min(priority, sched_get_priority_max(SCHED_FIFO));
+	int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (ret != 0)
+	{
+		LOG(WARN) << "Cannot set SCHED_FIFO priority:" << priority << " " << strerror(ret);
+		return false;
+	}
+	return true;
+}
+
+bool lockMemory()
+{
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+	{
+		LOG(WARN) << "Cannot lock memory " << strerror(errno);
+		return false;
+	}
+	return true;
+}
+
+// -----------------------------------------
+//    JitterStats
+// -----------------------------------------
+JitterStats::JitterStats(const std::string & name, unsigned int window) : m_name(name), m_window(window), m_started(false)
+{
+	m_samples.reserve(window);
+}
+
+void JitterStats::tick()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (m_started && m_samples.size() < m_window)
+	{
+		m_samples.push_back((now.tv_sec - m_last.tv_sec) * 1000.0 + (now.tv_nsec - m_last.tv_nsec) / 1000000.0);
+	}
+	m_last = now;
+	m_started = true;
+}
+
+void JitterStats::reset()
+{
+	m_samples.clear();
+	m_started = false;
+}
+
+void JitterStats::report(const char* tag)
+{
+	if (m_samples.empty())
+		return;
+
+	double sum = 0;
+	for (size_t i = 0; i < m_samples.size(); ++i)
+	{
+		sum += m_samples[i];
+	}
+	double mean = sum / m_samples.size();
+	double var = 0;
+	for (size_t i = 0; i < m_samples.size(); ++i)
+	{
+		var += (m_samples[i] - mean) * (m_samples[i] - mean);
+	}
+	std::vector<double> sorted(m_samples);
+	std::sort(sorted.begin(), sorted.end());
+	double p99 = sorted[std::min(sorted.size() - 1, (size_t)(sorted.size() * 0.99))];
+
+	LOG(NOTICE) << m_name << " jitter " << tag << " frames:" << m_samples.size() << " mean:" << mean << "ms stddev:" << sqrt(var / m_samples.size())
+	            << "ms min:" << sorted.front() << "ms p99:" << p99 << "ms max:" << sorted.back() << "ms";
+}
@@ -20,6 +20,10 @@
 #include "V4l2Capture.h"
 #include "V4l2MmapDevice.h"
 #include "V4l2ReadWriteDevice.h"
+#include "V4l2ReplayDevice.h"
+#include "V4l2FrameSink.h"
+#include "V4l2Converter.h"
+#include "V4l2H264Decoder.h"
 #include "opencv2/opencv.hpp"
 
 // -----------------------------------------
@@ -40,6 +44,9 @@ V4l2Capture* V4l2Capture::create(const V4L2DeviceParameters & param, IoType ioty
 			videoDevice = new V4l2ReadWriteDevice(param, V4L2_BUF_TYPE_VIDEO_CAPTURE); 
 			caps |= V4L2_CAP_READWRITE;
 		break;
+		case IOTYPE_REPLAY:
+			videoDevice = new V4l2ReplayDevice(param);
+		break;
 	}
 	
 	if (videoDevice &&  !videoDevice->init(caps))
@@ -58,8 +65,34 @@ V4l2Capture* V4l2Capture::create(const V4L2DeviceParameters & param, IoType ioty
 // -----------------------------------------
 //    constructor
 // -----------------------------------------
-V4l2Capture::V4l2Capture(V4l2Device* device) : V4l2Access(device)
+V4l2Capture::V4l2Capture(V4l2Device* device) : V4l2Access(device), m_sink(NULL), m_converter(NULL), m_decoder(NULL)
+{
+    if (m_device->getFormat() == V4L2_PIX_FMT_H264)
+    {
+        // 解码器有状态，不在转换函数表里
+        m_decoder = V4l2H264Decoder::create();
+    }
+    else
+    {
+        this->setLayout(V4l2Converter::LAYOUT_BGR);
+    }
+}
+
+// -----------------------------------------
+//    resolve the converter once for the negotiated format
+// -----------------------------------------
+bool V4l2Capture::setLayout(V4l2Converter::Layout layout)
 {
+    if (m_decoder)
+    {
+        return (layout == V4l2Converter::LAYOUT_BGR);
+    }
+    m_converter = V4l2Converter::find(m_device->getFormat(), layout);
+    if (m_converter == NULL)
+    {
+        LOG(WARN) << "No converter for format:" << fourcc(m_device->getFormat()) << " layout:" << layout;
+    }
+    return (m_converter != NULL);
 }
 
 // -----------------------------------------
@@ -67,6 +100,23 @@ V4l2Capture::V4l2Capture(V4l2Device* device) : V4l2Access(device)
 // -----------------------------------------
 V4l2Capture::~V4l2Capture() 
 {
+    delete m_decoder;
+}
+
+// -----------------------------------------
+//    decode or convert one frame, false when it gives no picture
+// -----------------------------------------
+bool V4l2Capture::convertFrame(const V4l2Planes& planes, cv::Mat &readImage)
+{
+    if (m_decoder)
+    {
+        return m_decoder->decode(planes.m_data[0], planes.m_size[0], readImage);
+    }
+    else if (m_converter)
+    {
+        m_converter(planes, m_device->getWidth(), m_device->getHeight(), readImage);
+    }
+    return !readImage.empty();
 }
 
 // -----------------------------------------
@@ -100,6 +150,36 @@ int V4l2Capture::read(cv::Mat &readImage)
     if(!readImage.empty()){
         readImage.release();
     }
+    // mmap设备直接在驱动缓存上转换，省掉一次整帧拷贝，多平面格式的各个平面也不拼接
+    V4l2Planes planes;
+    if (m_device->startRead(planes))
+    {
+        if (m_sink && (planes.m_count == 1))
+        {
+            m_sink->write(planes.m_data[0], planes.m_size[0], this->getTimestamp(), this->getSequence());
+        }
+        else if (m_sink)
+        {
+            // 只有录制多平面格式时才需要拼接
+            m_sinkBuffer.clear();
+            for (unsigned int p = 0; p < planes.m_count; ++p)
+            {
+                m_sinkBuffer.insert(m_sinkBuffer.end(), planes.m_data[p], planes.m_data[p] + planes.m_size[p]);
+            }
+            m_sink->write(m_sinkBuffer.data(), m_sinkBuffer.size(), this->getTimestamp(), this->getSequence());
+        }
+        bool picture = this->convertFrame(planes, readImage);
+        if (!m_device->endRead())
+        {
+            return -1;
+        }
+        return picture ? 0 : 1;
+    }
+    if (m_device->hasStartRead())
+    {
+        // VIDIOC_DQBUF failed and was logged, the copy path would only dequeue again
+        return -1;
+    }
     char buffer[this->getBufferSize()];
     int rsize = this->read(buffer, sizeof(buffer));
     if (rsize == -1)
@@ -108,6 +188,10 @@ int V4l2Capture::read(cv::Mat &readImage)
     }
     else
     {
+        if (m_sink)
+        {
+            m_sink->write(buffer, rsize, this->getTimestamp(), this->getSequence());
+        }
         /*
         2.6.1. Packed YUV formats
         2.6.2. V4L2_PIX_FMT_GREY (‘GREY’)
@@ -140,26 +224,32 @@ int V4l2Capture::read(cv::Mat &readImage)
         2.6.29. V4L2_PIX_FMT_M420 (‘M420’)
 
          * */
-        if(m_device->getFormat() == V4L2_PIX_FMT_YUYV){
-            cv::Mat v4l2Mat = cv::Mat( m_device->getHeight(),m_device->getWidth(), CV_8UC2, (void*)buffer);
-            cv::cvtColor(v4l2Mat,readImage,cv::COLOR_YUV2BGRA_YUYV);
-        }else if(m_device->getFormat() == V4L2_PIX_FMT_MJPEG){
-            cv::Mat v4l2Mat = cv::Mat( m_device->getHeight(),m_device->getWidth(), CV_8UC3, (void*)buffer);
-            readImage = cv::imdecode(v4l2Mat, 1);
-        }else  if(m_device->getFormat() == V4L2_PIX_FMT_H264){
-
-        }else  if(m_device->getFormat() == V4L2_PIX_FMT_NV12){
-            cv::Mat v4l2Mat = cv::Mat (m_device->getHeight()* 3 / 2, m_device->getWidth(), CV_8UC1, (void*)buffer);
-            cv::cvtColor(v4l2Mat,readImage,cv::COLOR_YUV2BGR_NV12);
-        }else if ((m_device->getFormat()  == V4L2_PIX_FMT_BGR24) || (m_device->getFormat() ==  V4L2_PIX_FMT_RGB24)) {
-            readImage = cv::Mat (m_device->getHeight(), m_device->getWidth(), CV_8UC3, (void*)buffer);
-        }else if ((m_device->getFormat()  == V4L2_PIX_FMT_YVU420) || (m_device->getFormat() ==  V4L2_PIX_FMT_YUV420)) {
-            cv::Mat v4l2Mat = cv::Mat (m_device->getHeight()* 3 / 2, m_device->getWidth(), CV_8UC1, (void*)buffer);
-            cv::cvtColor(v4l2Mat,readImage,cv::COLOR_YUV420p2BGR);
-        }
-        return 0;
+        V4l2Planes planes;
+        planes.m_count = 1;
+        planes.m_data[0] = buffer;
+        planes.m_size[0] = rsize;
+        return this->convertFrame(planes, readImage) ? 0 : 1;
     }
 
 }
 
-				
+// -----------------------------------------
+//    convert a raw V4L2 frame with the registered converter
+// -----------------------------------------
+void V4l2Capture::convert(const char* buffer, size_t size, unsigned int format, unsigned int width, unsigned int height, cv::Mat &readImage)
+{
+    V4l2Planes planes;
+    planes.m_count = 1;
+    planes.m_data[0] = (char*)buffer;
+    planes.m_size[0] = size;
+    convert(planes, format, width, height, readImage);
+}
+
+void V4l2Capture::convert(const V4l2Planes& planes, unsigned int format, unsigned int width, unsigned int height, cv::Mat &readImage)
+{
+    V4l2ConvertFunction converter = V4l2Converter::find(format);
+    if (converter)
+    {
+        converter(planes, width, height, readImage);
+    }
+}
@@ -0,0 +1,562 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2ConvertKernels.cpp
+**
+** Vectorised YUV to BGR/GRAY kernels used by V4l2Converter, BGR to YUV for V4l2Relay
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/core/hal/intrin.hpp"
+
+#include "V4l2ConvertKernels.h"
+
+// frames smaller than this are converted on the calling thread
+#define V4L2_CONVERT_PARALLEL_PIXELS (320*240)
+
+/*
+ * 定点计算，与opencv的YUV2BGR系数一致(BT.601 limited range):
+ *   c = (Y-16)<<6, d = (U-128)<<6, e = (V-128)<<6
+ *   B = c*1192>>16 + d*2066>>16
+ *   G = c*1192>>16 - d*400>>16 - e*833>>16
+ *   R = c*1192>>16 + e*1634>>16
+ * 向量版本用 mulhi 做 >>16，与标量版本逐位一致。
+ * full range(YUVJ420P，H264的video_full_range_flag)不减16，亮度不缩放，系数换成JPEG的。
+ */
+enum
+{
+	COEF_Y  = 1192, // 1.164 * 1024
+	COEF_UB = 2066, // 2.018 * 1024
+	COEF_UG = 400,  // 0.391 * 1024
+	COEF_VG = 833,  // 0.813 * 1024
+	COEF_VR = 1634, // 1.596 * 1024
+
+	COEF_Y_FULL  = 1024, // 1.0 * 1024
+	COEF_UB_FULL = 1815, // 1.772 * 1024
+	COEF_UG_FULL = 352,  // 0.344 * 1024
+	COEF_VG_FULL = 731,  // 0.714 * 1024
+	COEF_VR_FULL = 1436  // 1.402 * 1024
+};
+
+static inline unsigned char saturate(int value)
+{
+	return (unsigned char)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+template<bool FULL = false>
+static inline void yuvToBgr(int y, int u, int v, unsigned char* dst)
+{
+	int c = (FULL ? y : y - 16) << 6;
+	int d = (u - 128) << 6;
+	int e = (v - 128) << 6;
+	int luma = (c * (FULL ? COEF_Y_FULL : COEF_Y)) >> 16;
+	dst[0] = saturate(luma + ((d * (FULL ? COEF_UB_FULL : COEF_UB)) >> 16));
+	dst[1] = saturate(luma - ((d * (FULL ? COEF_UG_FULL : COEF_UG)) >> 16) - ((e * (FULL ? COEF_VG_FULL : COEF_VG)) >> 16));
+	dst[2] = saturate(luma + ((e * (FULL ? COEF_VR_FULL : COEF_VR)) >> 16));
+}
+
+#if CV_SIMD128
+// 8 pixels, chroma already upsampled
+template<bool FULL = false>
+static inline void yuvToBgr(const cv::v_uint16x8 & y, const cv::v_uint16x8 & u, const cv::v_uint16x8 & v, cv::v_int16x8 & b, cv::v_int16x8 & g, cv::v_int16x8 & r)
+{
+	cv::v_int16x8 c = (cv::v_reinterpret_as_s16(y) - cv::v_setall_s16(FULL ? 0 : 16)) << 6;
+	cv::v_int16x8 d = (cv::v_reinterpret_as_s16(u) - cv::v_setall_s16(128)) << 6;
+	cv::v_int16x8 e = (cv::v_reinterpret_as_s16(v) - cv::v_setall_s16(128)) << 6;
+	cv::v_int16x8 luma = cv::v_mul_hi(c, cv::v_setall_s16(FULL ? COEF_Y_FULL : COEF_Y));
+	b = luma + cv::v_mul_hi(d, cv::v_setall_s16(FULL ? COEF_UB_FULL : COEF_UB));
+	g = luma - cv::v_mul_hi(d, cv::v_setall_s16(FULL ? COEF_UG_FULL : COEF_UG)) - cv::v_mul_hi(e, cv::v_setall_s16(FULL ? COEF_VG_FULL : COEF_VG));
+	r = luma + cv::v_mul_hi(e, cv::v_setall_s16(FULL ? COEF_VR_FULL : COEF_VR));
+}
+
+// 16 pixels, chroma already upsampled, written as packed BGR
+template<bool FULL = false>
+static inline void storeBgr(unsigned char* dst, const cv::v_uint8x16 & y, const cv::v_uint8x16 & u, const cv::v_uint8x16 & v)
+{
+	cv::v_uint16x8 y0, y1, u0, u1, v0, v1;
+	cv::v_expand(y, y0, y1);
+	cv::v_expand(u, u0, u1);
+	cv::v_expand(v, v0, v1);
+	cv::v_int16x8 b0, g0, r0, b1, g1, r1;
+	yuvToBgr<FULL>(y0, u0, v0, b0, g0, r0);
+	yuvToBgr<FULL>(y1, u1, v1, b1, g1, r1);
+	cv::v_store_interleave(dst, cv::v_pack_u(b0, b1), cv::v_pack_u(g0, g1), cv::v_pack_u(r0, r1));
+}
+#endif
+
+// packed 4:2:2, Y0/U/Y1/V give the byte position of each component in a macropixel
+template<int Y0, int U, int Y1, int V>
+static void packedRowToBgr(const unsigned char* src, unsigned char* dst, unsigned int width)
+{
+	unsigned int x = 0;
+#if CV_SIMD128
+	for (; x + 32 <= width; x += 32, src += 64, dst += 96)
+	{
+		cv::v_uint8x16 c[4];
+		cv::v_load_deinterleave(src, c[0], c[1], c[2], c[3]);
+		cv::v_uint8x16 ylo, yhi, ulo, uhi, vlo, vhi;
+		cv::v_zip(c[Y0], c[Y1], ylo, yhi);
+		cv::v_zip(c[U], c[U], ulo, uhi);
+		cv::v_zip(c[V], c[V], vlo, vhi);
+		storeBgr(dst, ylo, ulo, vlo);
+		storeBgr(dst + 48, yhi, uhi, vhi);
+	}
+#endif
+	for (; x + 2 <= width; x += 2, src += 4, dst += 6)
+	{
+		yuvToBgr(src[Y0], src[U], src[V], dst);
+		yuvToBgr(src[Y1], src[U], src[V], dst + 3);
+	}
+}
+
+// one luma row with its interleaved (NV12: U=0,V=1) chroma row
+template<int U, int V>
+static void semiPlanarRowToBgr(const unsigned char* y, const unsigned char* uv, unsigned char* dst, unsigned int width)
+{
+	unsigned int x = 0;
+#if CV_SIMD128
+	for (; x + 32 <= width; x += 32)
+	{
+		cv::v_uint8x16 c[2];
+		cv::v_load_deinterleave(uv + x, c[0], c[1]);
+		cv::v_uint8x16 ulo, uhi, vlo, vhi;
+		cv::v_zip(c[U], c[U], ulo, uhi);
+		cv::v_zip(c[V], c[V], vlo, vhi);
+		storeBgr(dst + 3*x, cv::v_load(y + x), ulo, vlo);
+		storeBgr(dst + 3*x + 48, cv::v_load(y + x + 16), uhi, vhi);
+	}
+#endif
+	for (; x + 2 <= width; x += 2)
+	{
+		yuvToBgr(y[x], uv[x + U], uv[x + V], dst + 3*x);
+		yuvToBgr(y[x + 1], uv[x + U], uv[x + V], dst + 3*x + 3);
+	}
+}
+
+// one luma row with its U and V rows
+template<bool FULL>
+static void planarRowToBgr(const unsigned char* y, const unsigned char* u, const unsigned char* v, unsigned char* dst, unsigned int width)
+{
+	unsigned int x = 0;
+#if CV_SIMD128
+	for (; x + 32 <= width; x += 32)
+	{
+		cv::v_uint8x16 ulo, uhi, vlo, vhi;
+		cv::v_uint8x16 u16 = cv::v_load(u + x/2);
+		cv::v_uint8x16 v16 = cv::v_load(v + x/2);
+		cv::v_zip(u16, u16, ulo, uhi);
+		cv::v_zip(v16, v16, vlo, vhi);
+		storeBgr<FULL>(dst + 3*x, cv::v_load(y + x), ulo, vlo);
+		storeBgr<FULL>(dst + 3*x + 48, cv::v_load(y + x + 16), uhi, vhi);
+	}
+#endif
+	for (; x + 2 <= width; x += 2)
+	{
+		yuvToBgr<FULL>(y[x], u[x/2], v[x/2], dst + 3*x);
+		yuvToBgr<FULL>(y[x + 1], u[x/2], v[x/2], dst + 3*x + 3);
+	}
+}
+
+// split the rows between the OpenCV worker threads, unless the pool is reserved for inference
+template<typename Body>
+static void forEachRow(unsigned int rows, unsigned int width, unsigned int height, const Body & body)
+{
+	if ( (width * height < V4L2_CONVERT_PARALLEL_PIXELS) || !V4l2Converter::isParallel() )
+	{
+		body(0, rows);
+		return;
+	}
+	cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range & range) { body(range.start, range.end); });
+}
+
+static inline size_t stride(const V4l2Planes & planes, unsigned int plane, size_t defaultStride)
+{
+	return planes.m_stride[plane] ? planes.m_stride[plane] : defaultStride;
+}
+
+template<int Y0, int U, int Y1, int V>
+static void packedToBgr(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	image.create(height, width, CV_8UC3);
+	const unsigned char* src = (const unsigned char*)planes.m_data[0];
+	size_t srcStride = stride(planes, 0, width * 2);
+	forEachRow(height, width, height, [&](int begin, int end) {
+		for (int row = begin; row < end; ++row)
+			packedRowToBgr<Y0, U, Y1, V>(src + row * srcStride, image.ptr<unsigned char>(row), width);
+	});
+}
+
+// the chroma of a single plane buffer follows the luma
+template<int U, int V>
+static void semiPlanarToBgr(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	image.create(height, width, CV_8UC3);
+	const unsigned char* y = (const unsigned char*)planes.m_data[0];
+	size_t yStride = stride(planes, 0, width);
+	const unsigned char* uv = (planes.m_count >= 2) ? (const unsigned char*)planes.m_data[1] : y + yStride * height;
+	size_t uvStride = (planes.m_count >= 2) ? stride(planes, 1, width) : yStride;
+	forEachRow(height / 2, width, height, [&](int begin, int end) {
+		for (int row = begin; row < end; ++row)
+		{
+			const unsigned char* chroma = uv + row * uvStride;
+			semiPlanarRowToBgr<U, V>(y + (2*row) * yStride, chroma, image.ptr<unsigned char>(2*row), width);
+			semiPlanarRowToBgr<U, V>(y + (2*row + 1) * yStride, chroma, image.ptr<unsigned char>(2*row + 1), width);
+		}
+	});
+}
+
+// chromaShift 1 for 4:2:0 (one chroma row for two luma rows), 0 for 4:2:2
+template<bool FULL>
+static void planarToBgr(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image, bool swapUV, int chromaShift)
+{
+	image.create(height, width, CV_8UC3);
+	const unsigned char* y = (const unsigned char*)planes.m_data[0];
+	size_t yStride = stride(planes, 0, width);
+	size_t cStride = (planes.m_count >= 3) ? stride(planes, 1, width / 2) : yStride / 2;
+	unsigned int chromaRows = height >> chromaShift;
+	const unsigned char* first = (planes.m_count >= 3) ? (const unsigned char*)planes.m_data[1] : y + yStride * height;
+	const unsigned char* second = (planes.m_count >= 3) ? (const unsigned char*)planes.m_data[2] : first + cStride * chromaRows;
+	const unsigned char* u = swapUV ? second : first;
+	const unsigned char* v = swapUV ? first : second;
+	forEachRow(height, width, height, [&](int begin, int end) {
+		for (int row = begin; row < end; ++row)
+		{
+			size_t offset = (row >> chromaShift) * cStride;
+			planarRowToBgr<FULL>(y + row * yStride, u + offset, v + offset, image.ptr<unsigned char>(row), width);
+		}
+	});
+}
+
+void convertYUYVToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	packedToBgr<0, 1, 2, 3>(planes, width, height, image);
+}
+
+void convertUYVYToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	packedToBgr<1, 0, 3, 2>(planes, width, height, image);
+}
+
+void convertYVYUToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	packedToBgr<0, 3, 2, 1>(planes, width, height, image);
+}
+
+void convertVYUYToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	packedToBgr<1, 2, 3, 0>(planes, width, height, image);
+}
+
+void convertNV12ToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	semiPlanarToBgr<0, 1>(planes, width, height, image);
+}
+
+void convertNV21ToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	semiPlanarToBgr<1, 0>(planes, width, height, image);
+}
+
+void convertI420ToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	planarToBgr<false>(planes, width, height, image, false, 1);
+}
+
+void convertJ420ToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	planarToBgr<true>(planes, width, height, image, false, 1);
+}
+
+void convertYV12ToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	planarToBgr<false>(planes, width, height, image, true, 1);
+}
+
+void convertYUV422PToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	planarToBgr<false>(planes, width, height, image, false, 0);
+}
+
+void convertGREYToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	image.create(height, width, CV_8UC3);
+	const unsigned char* src = (const unsigned char*)planes.m_data[0];
+	size_t srcStride = stride(planes, 0, width);
+	forEachRow(height, width, height, [&](int begin, int end) {
+		for (int row = begin; row < end; ++row)
+		{
+			const unsigned char* grey = src + row * srcStride;
+			unsigned char* dst = image.ptr<unsigned char>(row);
+			unsigned int x = 0;
+#if CV_SIMD128
+			for (; x + 16 <= width; x += 16)
+			{
+				cv::v_uint8x16 g = cv::v_load(grey + x);
+				cv::v_store_interleave(dst + 3*x, g, g, g);
+			}
+#endif
+			for (; x < width; ++x)
+				dst[3*x] = dst[3*x + 1] = dst[3*x + 2] = grey[x];
+		}
+	});
+}
+
+// packed 4:2:2 luma is every other byte, starting at offset
+template<int offset>
+static void packedToGray(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	image.create(height, width, CV_8UC1);
+	const unsigned char* src = (const unsigned char*)planes.m_data[0];
+	size_t srcStride = stride(planes, 0, width * 2);
+	forEachRow(height, width, height, [&](int begin, int end) {
+		for (int row = begin; row < end; ++row)
+		{
+			const unsigned char* line = src + row * srcStride;
+			unsigned char* dst = image.ptr<unsigned char>(row);
+			unsigned int x = 0;
+#if CV_SIMD128
+			for (; x + 16 <= width; x += 16)
+			{
+				cv::v_uint8x16 c[2];
+				cv::v_load_deinterleave(line + 2*x, c[0], c[1]);
+				cv::v_store(dst + x, c[offset]);
+			}
+#endif
+			for (; x < width; ++x)
+				dst[x] = line[2*x + offset];
+		}
+	});
+}
+
+void convertYUYVToGRAY(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	packedToGray<0>(planes, width, height, image);
+}
+
+void convertUYVYToGRAY(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	packedToGray<1>(planes, width, height, image);
+}
+
+// planar and semi-planar formats, and GREY, start with the luma plane
+void convertLumaToGRAY(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	cv::Mat(height, width, CV_8UC1, planes.m_data[0], stride(planes, 0, width)).copyTo(image);
+}
+
+/*
+ * 反方向，BGR -> YUV (V4l2Relay)，BT.601 limited range，8位定点:
+ *   Y = (( 66*R + 129*G +  25*B + 128) >> 8) + 16
+ *   U = ((-38*R -  74*G + 112*B + 128) >> 8) + 128
+ *   V = ((112*R -  94*G -  18*B + 128) >> 8) + 128
+ * 色度用相邻2个(4:2:2)或2x2个(4:2:0)像素四舍五入后的平均值计算。
+ * Y的中间值不超过 220*255+128，U/V 不超过 ±(112*255+128)，分别放得进 u16 和 s16，
+ * 向量版本与标量版本逐位一致。
+ */
+enum
+{
+	TO_Y_R = 66,  TO_Y_G = 129, TO_Y_B = 25,
+	TO_U_R = 38,  TO_U_G = 74,  TO_U_B = 112,
+	TO_V_R = 112, TO_V_G = 94,  TO_V_B = 18
+};
+
+static inline unsigned char bgrToY(int b, int g, int r)
+{
+	return (unsigned char)(((TO_Y_R * r + TO_Y_G * g + TO_Y_B * b + 128) >> 8) + 16);
+}
+
+static inline unsigned char bgrToU(int b, int g, int r)
+{
+	return (unsigned char)(((TO_U_B * b - TO_U_G * g - TO_U_R * r + 128) >> 8) + 128);
+}
+
+static inline unsigned char bgrToV(int b, int g, int r)
+{
+	return (unsigned char)(((TO_V_R * r - TO_V_G * g - TO_V_B * b + 128) >> 8) + 128);
+}
+
+#if CV_SIMD128
+static inline cv::v_uint16x8 bgrToY(const cv::v_uint16x8 & b, const cv::v_uint16x8 & g, const cv::v_uint16x8 & r)
+{
+	cv::v_uint16x8 sum = cv::v_mul_wrap(r, cv::v_setall_u16(TO_Y_R)) + cv::v_mul_wrap(g, cv::v_setall_u16(TO_Y_G))
+		+ cv::v_mul_wrap(b, cv::v_setall_u16(TO_Y_B)) + cv::v_setall_u16(128);
+	return (sum >> 8) + cv::v_setall_u16(16);
+}
+
+// b, g, r already averaged over the chroma block
+static inline void bgrToUV(const cv::v_int16x8 & b, const cv::v_int16x8 & g, const cv::v_int16x8 & r, cv::v_int16x8 & u, cv::v_int16x8 & v)
+{
+	cv::v_int16x8 half = cv::v_setall_s16(128);
+	u = ((cv::v_mul_wrap(b, cv::v_setall_s16(TO_U_B)) - cv::v_mul_wrap(g, cv::v_setall_s16(TO_U_G))
+		- cv::v_mul_wrap(r, cv::v_setall_s16(TO_U_R)) + half) >> 8) + half;
+	v = ((cv::v_mul_wrap(r, cv::v_setall_s16(TO_V_R)) - cv::v_mul_wrap(g, cv::v_setall_s16(TO_V_G))
+		- cv::v_mul_wrap(b, cv::v_setall_s16(TO_V_B)) + half) >> 8) + half;
+}
+
+// 16 BGR pixels: luma of the 8 even and of the 8 odd pixels, B/G/R sums of the 8 horizontal pairs
+static inline void loadPairs(const unsigned char* src, cv::v_uint16x8 & yEven, cv::v_uint16x8 & yOdd, cv::v_uint16x8 sum[3])
+{
+	cv::v_uint8x16 c[3];
+	cv::v_load_deinterleave(src, c[0], c[1], c[2]);
+	cv::v_uint16x8 even[3], odd[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		// little endian: the even pixel is the low byte of each 16 bit lane
+		cv::v_uint16x8 w = cv::v_reinterpret_as_u16(c[i]);
+		even[i] = w & cv::v_setall_u16(0xff);
+		odd[i] = w >> 8;
+		sum[i] = even[i] + odd[i];
+	}
+	yEven = bgrToY(even[0], even[1], even[2]);
+	yOdd = bgrToY(odd[0], odd[1], odd[2]);
+}
+
+// chroma of 8 blocks from their B/G/R sums, blockShift 1 for pairs, 2 for 2x2 blocks
+static inline void sumsToUV(const cv::v_uint16x8 sum[3], int blockShift, cv::v_int16x8 & u, cv::v_int16x8 & v)
+{
+	cv::v_uint16x8 round = cv::v_setall_u16((unsigned short)(1 << (blockShift - 1)));
+	cv::v_int16x8 avg[3];
+	for (int i = 0; i < 3; ++i)
+		avg[i] = cv::v_reinterpret_as_s16((sum[i] + round) >> blockShift);
+	bgrToUV(avg[0], avg[1], avg[2], u, v);
+}
+#endif
+
+// one BGR row to packed 4:2:2, Y0/U/Y1/V give the byte position of each component in a macropixel
+template<int Y0, int U, int Y1, int V>
+static void bgrRowToPacked(const unsigned char* src, unsigned char* dst, unsigned int width)
+{
+	unsigned int x = 0;
+#if CV_SIMD128
+	for (; x + 32 <= width; x += 32, src += 96, dst += 64)
+	{
+		cv::v_uint16x8 yEven[2], yOdd[2], sum[2][3];
+		cv::v_int16x8 u[2], v[2];
+		for (int k = 0; k < 2; ++k)
+		{
+			loadPairs(src + 48*k, yEven[k], yOdd[k], sum[k]);
+			sumsToUV(sum[k], 1, u[k], v[k]);
+		}
+		cv::v_uint8x16 c[4];
+		c[Y0] = cv::v_pack(yEven[0], yEven[1]);
+		c[Y1] = cv::v_pack(yOdd[0], yOdd[1]);
+		c[U] = cv::v_pack_u(u[0], u[1]);
+		c[V] = cv::v_pack_u(v[0], v[1]);
+		cv::v_store_interleave(dst, c[0], c[1], c[2], c[3]);
+	}
+#endif
+	for (; x + 2 <= width; x += 2, src += 6, dst += 4)
+	{
+		int b = (src[0] + src[3] + 1) >> 1;
+		int g = (src[1] + src[4] + 1) >> 1;
+		int r = (src[2] + src[5] + 1) >> 1;
+		dst[Y0] = bgrToY(src[0], src[1], src[2]);
+		dst[Y1] = bgrToY(src[3], src[4], src[5]);
+		dst[U] = bgrToU(b, g, r);
+		dst[V] = bgrToV(b, g, r);
+	}
+}
+
+// two BGR rows to two luma rows and their interleaved (NV12: U=0,V=1) chroma row
+template<int U, int V>
+static void bgrRowsToSemiPlanar(const unsigned char* src0, const unsigned char* src1, unsigned char* y0, unsigned char* y1, unsigned char* uv, unsigned int width)
+{
+	unsigned int x = 0;
+#if CV_SIMD128
+	for (; x + 32 <= width; x += 32)
+	{
+		const unsigned char* src[2] = { src0 + 3*x, src1 + 3*x };
+		unsigned char* luma[2] = { y0 + x, y1 + x };
+		cv::v_uint16x8 sum[2][2][3]; // row, half, channel
+		for (int row = 0; row < 2; ++row)
+		{
+			cv::v_uint16x8 yEven[2], yOdd[2];
+			loadPairs(src[row], yEven[0], yOdd[0], sum[row][0]);
+			loadPairs(src[row] + 48, yEven[1], yOdd[1], sum[row][1]);
+			cv::v_uint8x16 lo, hi;
+			cv::v_zip(cv::v_pack(yEven[0], yEven[1]), cv::v_pack(yOdd[0], yOdd[1]), lo, hi);
+			cv::v_store(luma[row], lo);
+			cv::v_store(luma[row] + 16, hi);
+		}
+		cv::v_int16x8 u[2], v[2];
+		for (int k = 0; k < 2; ++k)
+		{
+			cv::v_uint16x8 block[3];
+			for (int i = 0; i < 3; ++i)
+				block[i] = sum[0][k][i] + sum[1][k][i];
+			sumsToUV(block, 2, u[k], v[k]);
+		}
+		cv::v_uint8x16 c[2];
+		c[U] = cv::v_pack_u(u[0], u[1]);
+		c[V] = cv::v_pack_u(v[0], v[1]);
+		cv::v_store_interleave(uv + x, c[0], c[1]);
+	}
+#endif
+	for (; x + 2 <= width; x += 2)
+	{
+		const unsigned char* a = src0 + 3*x;
+		const unsigned char* c = src1 + 3*x;
+		int b = (a[0] + a[3] + c[0] + c[3] + 2) >> 2;
+		int g = (a[1] + a[4] + c[1] + c[4] + 2) >> 2;
+		int r = (a[2] + a[5] + c[2] + c[5] + 2) >> 2;
+		y0[x] = bgrToY(a[0], a[1], a[2]);
+		y0[x + 1] = bgrToY(a[3], a[4], a[5]);
+		y1[x] = bgrToY(c[0], c[1], c[2]);
+		y1[x + 1] = bgrToY(c[3], c[4], c[5]);
+		uv[x + U] = bgrToU(b, g, r);
+		uv[x + V] = bgrToV(b, g, r);
+	}
+}
+
+template<int Y0, int U, int Y1, int V>
+static void bgrToPacked(const cv::Mat & image, const V4l2Planes & planes, unsigned int width, unsigned int height)
+{
+	unsigned char* dst = (unsigned char*)planes.m_data[0];
+	size_t dstStride = stride(planes, 0, width * 2);
+	forEachRow(height, width, height, [&](int begin, int end) {
+		for (int row = begin; row < end; ++row)
+			bgrRowToPacked<Y0, U, Y1, V>(image.ptr<unsigned char>(row), dst + row * dstStride, width);
+	});
+}
+
+// the chroma of a single plane buffer follows the luma
+template<int U, int V>
+static void bgrToSemiPlanar(const cv::Mat & image, const V4l2Planes & planes, unsigned int width, unsigned int height)
+{
+	unsigned char* y = (unsigned char*)planes.m_data[0];
+	size_t yStride = stride(planes, 0, width);
+	unsigned char* uv = (planes.m_count >= 2) ? (unsigned char*)planes.m_data[1] : y + yStride * height;
+	size_t uvStride = (planes.m_count >= 2) ? stride(planes, 1, width) : yStride;
+	forEachRow(height / 2, width, height, [&](int begin, int end) {
+		for (int row = begin; row < end; ++row)
+		{
+			bgrRowsToSemiPlanar<U, V>(image.ptr<unsigned char>(2*row), image.ptr<unsigned char>(2*row + 1),
+				y + (2*row) * yStride, y + (2*row + 1) * yStride, uv + row * uvStride, width);
+		}
+	});
+}
+
+void convertBGRToYUYV(const cv::Mat & image, const V4l2Planes & planes, unsigned int width, unsigned int height)
+{
+	bgrToPacked<0, 1, 2, 3>(image, planes, width, height);
+}
+
+void convertBGRToUYVY(const cv::Mat & image, const V4l2Planes & planes, unsigned int width, unsigned int height)
+{
+	bgrToPacked<1, 0, 3, 2>(image, planes, width, height);
+}
+
+void convertBGRToNV12(const cv::Mat & image, const V4l2Planes & planes, unsigned int width, unsigned int height)
+{
+	bgrToSemiPlanar<0, 1>(image, planes, width, height);
+}
+
+void convertBGRToNV21(const cv::Mat & image, const V4l2Planes & planes, unsigned int width, unsigned int height)
+{
+	bgrToSemiPlanar<1, 0>(image, planes, width, height);
+}
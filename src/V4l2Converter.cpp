@@ -0,0 +1,160 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2Converter.cpp
+**
+** Registry of the raw frame to cv::Mat converters
+**
+** -------------------------------------------------------------------------*/
+
+#include <atomic>
+#include <map>
+#include <mutex>
+
+#include "opencv2/opencv.hpp"
+
+#include "V4l2Converter.h"
+#include "V4l2ConvertKernels.h"
+
+// formats OpenCV already handles well
+
+static void convertMJPEGToBGR(const V4l2Planes & planes, unsigned int, unsigned int, cv::Mat & image)
+{
+	// 只把实际的jpeg数据交给解码器
+	image = cv::imdecode(cv::Mat(1, planes.m_size[0], CV_8UC1, planes.m_data[0]), cv::IMREAD_COLOR);
+}
+
+static void convertMJPEGToGRAY(const V4l2Planes & planes, unsigned int, unsigned int, cv::Mat & image)
+{
+	image = cv::imdecode(cv::Mat(1, planes.m_size[0], CV_8UC1, planes.m_data[0]), cv::IMREAD_GRAYSCALE);
+}
+
+static void convertBGR24ToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	// 读取缓存是驱动的mmap或者栈上的数组，必须拷贝出来
+	size_t stride = planes.m_stride[0] ? planes.m_stride[0] : width * 3;
+	cv::Mat(height, width, CV_8UC3, planes.m_data[0], stride).copyTo(image);
+}
+
+static void convertRGB24ToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	size_t stride = planes.m_stride[0] ? planes.m_stride[0] : width * 3;
+	cv::cvtColor(cv::Mat(height, width, CV_8UC3, planes.m_data[0], stride), image, cv::COLOR_RGB2BGR);
+}
+
+static void convertBGR24ToGRAY(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	size_t stride = planes.m_stride[0] ? planes.m_stride[0] : width * 3;
+	cv::cvtColor(cv::Mat(height, width, CV_8UC3, planes.m_data[0], stride), image, cv::COLOR_BGR2GRAY);
+}
+
+// BGR32/XBGR32/ABGR32 are B,G,R,X in memory
+static void convertBGR32ToBGR(const V4l2Planes & planes, unsigned int width, unsigned int height, cv::Mat & image)
+{
+	size_t stride = planes.m_stride[0] ? planes.m_stride[0] : width * 4;
+	cv::cvtColor(cv::Mat(height, width, CV_8UC4, planes.m_data[0], stride), image, cv::COLOR_BGRA2BGR);
+}
+
+typedef std::map< std::pair<unsigned int, int>, V4l2ConvertFunction > V4l2ConverterMap;
+
+static std::mutex & registryLock()
+{
+	static std::mutex lock;
+	return lock;
+}
+
+static V4l2ConverterMap & registry()
+{
+	static V4l2ConverterMap converters;
+	static bool initialized = false;
+	if (!initialized)
+	{
+		initialized = true;
+		const V4l2Converter::Layout BGR = V4l2Converter::LAYOUT_BGR;
+		const V4l2Converter::Layout GRAY = V4l2Converter::LAYOUT_GRAY;
+
+		converters[std::make_pair(V4L2_PIX_FMT_YUYV,    BGR)] = convertYUYVToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_UYVY,    BGR)] = convertUYVYToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_YVYU,    BGR)] = convertYVYUToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_VYUY,    BGR)] = convertVYUYToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_NV12,    BGR)] = convertNV12ToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_NV12M,   BGR)] = convertNV12ToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_NV21,    BGR)] = convertNV21ToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_NV21M,   BGR)] = convertNV21ToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_YUV420,  BGR)] = convertI420ToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_YUV420M, BGR)] = convertI420ToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_YVU420,  BGR)] = convertYV12ToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_YVU420M, BGR)] = convertYV12ToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_YUV422P, BGR)] = convertYUV422PToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_GREY,    BGR)] = convertGREYToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_MJPEG,   BGR)] = convertMJPEGToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_JPEG,    BGR)] = convertMJPEGToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_BGR24,   BGR)] = convertBGR24ToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_RGB24,   BGR)] = convertRGB24ToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_BGR32,   BGR)] = convertBGR32ToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_XBGR32,  BGR)] = convertBGR32ToBGR;
+		converters[std::make_pair(V4L2_PIX_FMT_ABGR32,  BGR)] = convertBGR32ToBGR;
+
+		converters[std::make_pair(V4L2_PIX_FMT_YUYV,    GRAY)] = convertYUYVToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_YVYU,    GRAY)] = convertYUYVToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_UYVY,    GRAY)] = convertUYVYToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_VYUY,    GRAY)] = convertUYVYToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_NV12,    GRAY)] = convertLumaToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_NV12M,   GRAY)] = convertLumaToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_NV21,    GRAY)] = convertLumaToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_NV21M,   GRAY)] = convertLumaToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_YUV420,  GRAY)] = convertLumaToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_YUV420M, GRAY)] = convertLumaToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_YVU420,  GRAY)] = convertLumaToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_YVU420M, GRAY)] = convertLumaToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_YUV422P, GRAY)] = convertLumaToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_GREY,    GRAY)] = convertLumaToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_MJPEG,   GRAY)] = convertMJPEGToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_JPEG,    GRAY)] = convertMJPEGToGRAY;
+		converters[std::make_pair(V4L2_PIX_FMT_BGR24,   GRAY)] = convertBGR24ToGRAY;
+	}
+	return converters;
+}
+
+void V4l2Converter::registerConverter(unsigned int format, Layout layout, V4l2ConvertFunction function)
+{
+	std::lock_guard<std::mutex> lock(registryLock());
+	registry()[std::make_pair(format, (int)layout)] = function;
+}
+
+V4l2ConvertFunction V4l2Converter::find(unsigned int format, Layout layout)
+{
+	std::lock_guard<std::mutex> lock(registryLock());
+	V4l2ConverterMap & converters = registry();
+	V4l2ConverterMap::iterator it = converters.find(std::make_pair(format, (int)layout));
+	if (it == converters.end())
+		return NULL;
+	return it->second;
+}
+
+static std::atomic<bool> parallelRows(true);
+
+void V4l2Converter::setParallel(bool parallel)
+{
+	parallelRows = parallel;
+}
+
+bool V4l2Converter::isParallel()
+{
+	return parallelRows;
+}
+
+std::list<unsigned int> V4l2Converter::formats(Layout layout)
+{
+	std::lock_guard<std::mutex> lock(registryLock());
+	std::list<unsigned int> formats;
+	V4l2ConverterMap & converters = registry();
+	for (V4l2ConverterMap::iterator it = converters.begin(); it != converters.end(); ++it)
+	{
+		if (it->first.second == layout)
+			formats.push_back(it->first.first);
+	}
+	return formats;
+}
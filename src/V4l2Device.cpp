@@ -13,12 +13,15 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+
 // libv4l2
 #include <linux/videodev2.h>
 
 #include "logger.h"
 
 #include "V4l2Device.h"
+#include "V4l2ModeSelector.h"
 
 std::string fourcc(unsigned int format)
 {
@@ -29,8 +32,13 @@ std::string fourcc(unsigned int format)
 // -----------------------------------------
 //    V4L2Device
 // -----------------------------------------
-V4l2Device::V4l2Device(const V4L2DeviceParameters&  params, v4l2_buf_type deviceType) : m_params(params), m_fd(-1), m_deviceType(deviceType), m_bufferSize(0), m_format(0)
+V4l2Device::V4l2Device(const V4L2DeviceParameters&  params, v4l2_buf_type deviceType) : m_params(params), m_fd(-1), m_deviceType(deviceType), m_bufferSize(0), m_format(0), m_planeCount(1), m_sequence(0),
+	m_configuredFps(0), m_measuredFps(0), m_fpsStartSequence(0), m_fpsFrames(0), m_partialWriteInProgress(false)
 {
+	memset(&m_bytesPerLine, 0, sizeof(m_bytesPerLine));
+	memset(&m_timestamp, 0, sizeof(m_timestamp));
+	memset(&m_fpsStart, 0, sizeof(m_fpsStart));
+	memset(&bus_info, 0, sizeof(bus_info));
 }
 
 V4l2Device::~V4l2Device() 
@@ -53,13 +61,38 @@ void V4l2Device::queryFormat()
 	memset(&fmt,0,sizeof(fmt));
 	fmt.type  = m_deviceType;
 	if (0 == ioctl(m_fd,VIDIOC_G_FMT,&fmt)) 
+	{
+		this->setFormat(fmt);
+
+		LOG(NOTICE) << m_params.m_devName << ":" << fourcc(m_format) << " size:" << m_width << "x" << m_height << " bufferSize:" << m_bufferSize;
+	}
+}
+
+// keep the negotiated format, pix or pix_mp depending on the buffer type
+void V4l2Device::setFormat(const struct v4l2_format & fmt)
+{
+	memset(&m_bytesPerLine, 0, sizeof(m_bytesPerLine));
+	if (this->isMultiPlanar())
+	{
+		m_format     = fmt.fmt.pix_mp.pixelformat;
+		m_width      = fmt.fmt.pix_mp.width;
+		m_height     = fmt.fmt.pix_mp.height;
+		m_planeCount = fmt.fmt.pix_mp.num_planes;
+		m_bufferSize = 0;
+		for (unsigned int i = 0; i < m_planeCount && i < VIDEO_MAX_PLANES; ++i)
+		{
+			m_bytesPerLine[i] = fmt.fmt.pix_mp.plane_fmt[i].bytesperline;
+			m_bufferSize     += fmt.fmt.pix_mp.plane_fmt[i].sizeimage;
+		}
+	}
+	else
 	{
 		m_format     = fmt.fmt.pix.pixelformat;
 		m_width      = fmt.fmt.pix.width;
 		m_height     = fmt.fmt.pix.height;
+		m_planeCount = 1;
+		m_bytesPerLine[0] = fmt.fmt.pix.bytesperline;
 		m_bufferSize = fmt.fmt.pix.sizeimage;
-
-		LOG(NOTICE) << m_params.m_devName << ":" << fourcc(m_format) << " size:" << m_width << "x" << m_height << " bufferSize:" << m_bufferSize;
 	}
 }
 
@@ -92,13 +125,7 @@ int V4l2Device::initdevice(const char *dev_name,unsigned int mandatoryCapabiliti
 		this->close();
 		return -1;
 	}
-    /*
-     * 查询video的可输入设备数，和对应的名字
-     */
     struct v4l2_input input;
-
-    struct v4l2_standard standard;
-
     memset (&input, 0, sizeof (input));
 
     //首先获得当前输入的 index,注意只是 index，要获得具体的信息，就的调用列举操作
@@ -107,39 +134,6 @@ int V4l2Device::initdevice(const char *dev_name,unsigned int mandatoryCapabiliti
          LOG(ERROR) << "can not set " << m_params.m_inputIndex <<" input index";
          return -1;
     }
-    if (-1 == ioctl (m_fd, VIDIOC_G_INPUT, &input.index)) {
-
-        LOG(ERROR) << "get VIDIOC_G_INPUT error ";
-        return -1;
-    }
-
-
-    //调用列举操作，获得 input.index 对应的输入的具体信息
-
-    if (-1 == ioctl (m_fd, VIDIOC_ENUMINPUT, &input)) {
-     LOG(ERROR) << "Get ”VIDIOC_ENUM_INPUT” error";
-    return -1;
-    }
-    LOG(NOTICE) << "Current input " <<input.name<<" supports:";
-    memset (&standard, 0, sizeof (standard)); standard.index = 0;
-
-    //列举所有的所支持的 standard，如果 standard.id 与当前 input 的 input.std 有共同的
-    //bit flag，意味着当前的输入支持这个 standard,这样将所有驱动所支持的 standard 列举一个
-    //遍，就可以找到该输入所支持的所有 standard 了。
-
-    while (0 == ioctl (m_fd, VIDIOC_ENUMSTD, &standard)) {
-
-        if (standard.id & input.std)
-            LOG(NOTICE) << standard.name;
-            standard.index++;
-    }
-
-    /* EINVAL indicates the end of the enumeration, which cannot be empty unless this device falls under the USB exception.*/
-
-    if (errno != EINVAL || standard.index == 0) {
-     LOG(NOTICE) << "Get ”VIDIOC_ENUMSTD” error";
-    }
-
 
 	if (checkCapabilities(m_fd,mandatoryCapabilities) !=0)
 	{
@@ -156,6 +150,10 @@ int V4l2Device::initdevice(const char *dev_name,unsigned int mandatoryCapabiliti
 		this->close();
 		return -1;
 	}
+	if (m_params.m_lockExposure && !this->lockExposure())
+	{
+		LOG(WARN) << "Exposure not locked, the frame rate may drop in low light";
+	}
 	
 	return m_fd;
 }
@@ -202,6 +200,115 @@ static void print_frmival(const struct v4l2_frmivalenum &frmival)
     }
 }
 
+// log the current input and its standards, skipped when the probe cache is valid
+int V4l2Device::enumerateInputs(int fd)
+{
+    /*
+     * 查询video的可输入设备数，和对应的名字
+     */
+    struct v4l2_input input;
+
+    struct v4l2_standard standard;
+
+    memset (&input, 0, sizeof (input));
+    if (-1 == ioctl (fd, VIDIOC_G_INPUT, &input.index)) {
+
+        LOG(ERROR) << "get VIDIOC_G_INPUT error ";
+        return -1;
+    }
+
+    //调用列举操作，获得 input.index 对应的输入的具体信息
+
+    if (-1 == ioctl (fd, VIDIOC_ENUMINPUT, &input)) {
+     LOG(ERROR) << "Get ”VIDIOC_ENUM_INPUT” error";
+    return -1;
+    }
+    LOG(NOTICE) << "Current input " <<input.name<<" supports:";
+    memset (&standard, 0, sizeof (standard)); standard.index = 0;
+
+    //列举所有的所支持的 standard，如果 standard.id 与当前 input 的 input.std 有共同的
+    //bit flag，意味着当前的输入支持这个 standard,这样将所有驱动所支持的 standard 列举一个
+    //遍，就可以找到该输入所支持的所有 standard 了。
+
+    while (0 == ioctl (fd, VIDIOC_ENUMSTD, &standard)) {
+
+        if (standard.id & input.std)
+            LOG(NOTICE) << standard.name;
+        standard.index++;
+    }
+
+    /* EINVAL indicates the end of the enumeration, which cannot be empty unless this device falls under the USB exception.*/
+
+    if (errno != EINVAL || standard.index == 0) {
+     LOG(NOTICE) << "Get ”VIDIOC_ENUMSTD” error";
+    }
+    return 0;
+}
+
+// enumerate the formats, frame sizes and frame intervals of the capture device
+void V4l2Device::enumerateModes(int fd)
+{
+    /*
+        struct v4l2_fmtdesc
+
+        {
+        u32 index;// 要查询的格式序号，应用程序设置
+        enum v4l2_buf_type type; // 帧类型，应用程序设置
+        u32 flags;// 是否为压缩格式
+        u8 description[32]; // 格式名称
+        u32 pixelformat;// 格式
+        u32 reserved[4]; // 保留
+        };
+    */
+    LOG(NOTICE) <<"capture Support format:";
+    m_modes.clear();
+
+    //获取摄像头所支持的格式和分辨率
+    struct v4l2_fmtdesc fmtdesc;
+    struct v4l2_frmsizeenum frmsize;
+    struct v4l2_frmivalenum frmival;
+
+    memset(&fmtdesc, 0, sizeof(fmtdesc));
+    fmtdesc.index = 0;
+    fmtdesc.type = (m_deviceType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    while (ioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc) >= 0) {
+        LOG(NOTICE) <<(fmtdesc.index+1) <<"."<<fmtdesc.description<<",supoort resolution:";
+        memset(&frmsize, 0, sizeof(frmsize));
+        frmsize.pixel_format = fmtdesc.pixelformat;
+        frmsize.index = 0;
+        while (ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frmsize) >= 0){
+
+            if(frmsize.type == V4L2_FRMSIZE_TYPE_DISCRETE){
+                LOG(NOTICE) << "width:"<<frmsize.discrete.width << ",height:"<< frmsize.discrete.height;
+                memset(&frmival, 0, sizeof(frmival));
+                frmival.index = 0;
+                frmival.pixel_format = fmtdesc.pixelformat;
+                frmival.width = frmsize.discrete.width;
+                frmival.height = frmsize.discrete.height;
+                while (ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &frmival) >= 0) {
+                    print_frmival(frmival);
+                    // stepwise intervals are recorded with their fastest rate
+                    const struct v4l2_fract & interval = (frmival.type == V4L2_FRMIVAL_TYPE_DISCRETE) ? frmival.discrete : frmival.stepwise.min;
+                    m_modes.push_back(V4l2Mode(fmtdesc.pixelformat, frmsize.discrete.width, frmsize.discrete.height, interval.numerator, interval.denominator));
+                    frmival.index++;
+                }
+                if (frmival.index == 0) {
+                    m_modes.push_back(V4l2Mode(fmtdesc.pixelformat, frmsize.discrete.width, frmsize.discrete.height));
+                }
+            }else if(frmsize.type == V4L2_FRMSIZE_TYPE_STEPWISE || frmsize.type == V4L2_FRMSIZE_TYPE_CONTINUOUS){
+                LOG(NOTICE) << "width:"<<frmsize.stepwise.min_width << "-" << frmsize.stepwise.max_width << ",height:"<< frmsize.stepwise.min_height << "-" << frmsize.stepwise.max_height;
+                // only the bounds are recorded
+                m_modes.push_back(V4l2Mode(fmtdesc.pixelformat, frmsize.stepwise.min_width, frmsize.stepwise.min_height));
+                m_modes.push_back(V4l2Mode(fmtdesc.pixelformat, frmsize.stepwise.max_width, frmsize.stepwise.max_height));
+            }
+
+            frmsize.index++;
+        }
+
+        fmtdesc.index++;
+    }
+}
+
 // check needed V4L2 capabilities,get the device the basic imformation
 int V4l2Device::checkCapabilities(int fd, unsigned int mandatoryCapabilities)
 {
@@ -228,76 +335,35 @@ int V4l2Device::checkCapabilities(int fd, unsigned int mandatoryCapabilities)
 	LOG(NOTICE) << "driver:" << cap.driver << " capabilities:" << std::hex << cap.capabilities <<  " mandatory:" << mandatoryCapabilities << std::dec;
     LOG(NOTICE) << "card:" << cap.card <<	" Bus info: " << cap.bus_info;
     memcpy(bus_info, cap.bus_info, sizeof(cap.bus_info));
+
+    // SoC ISP 摄像头一般只提供多平面接口 (NV12M/YUV420M)
+    unsigned int deviceCaps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+    if ( (m_deviceType == V4L2_BUF_TYPE_VIDEO_CAPTURE) && !(deviceCaps & V4L2_CAP_VIDEO_CAPTURE) && (deviceCaps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) )
+    {
+        LOG(NOTICE) << m_params.m_devName << " use multi-planar capture";
+        m_deviceType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        mandatoryCapabilities = (mandatoryCapabilities & ~V4L2_CAP_VIDEO_CAPTURE) | V4L2_CAP_VIDEO_CAPTURE_MPLANE;
+    }
+
+    // 相同的摄像头(驱动/名字/总线/版本)不用再逐个枚举
+    std::string key = V4l2ProbeCache::key(cap);
+    bool probed = m_params.m_probeCache && V4l2ProbeCache::load(key, m_modes);
+    if (!probed && (this->enumerateInputs(fd) != 0)) {
+        return -1;
+    }
     /// 检查设备的能力
 	if ((cap.capabilities & V4L2_CAP_VIDEO_OUTPUT))  LOG(NOTICE) << m_params.m_devName << " support output";
-    if ((cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
+    if ((cap.capabilities & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE))) {
         LOG(NOTICE) << m_params.m_devName << " support capture";
-        /***
-         *
-         * 查询该设备所有支持的功能
-         ***/
-        /*
-            struct v4l2_fmtdesc
-
-            {
-            u32 index;// 要查询的格式序号，应用程序设置
-            enum v4l2_buf_type type; // 帧类型，应用程序设置
-            u32 flags;// 是否为压缩格式
-            u8 description[32]; // 格式名称
-            u32 pixelformat;// 格式
-            u32 reserved[4]; // 保留
-            };
-    */
-        struct v4l2_fmtdesc fmtdesc;
-        fmtdesc.index=0;
-        fmtdesc.type=V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        LOG(NOTICE) <<"capture Support format:";
-//        while(ioctl(m_fd, VIDIOC_ENUM_FMT, &fmtdesc) != -1)
-//        {
-////          printf("\t%d.%s\n",fmtdesc.index+1,fmtdesc.description);
-//          LOG(NOTICE) <<(fmtdesc.index+1) <<"."<<fmtdesc.description<<",pixelformat:"<< fourcc(fmtdesc.pixelformat) ;
-
-//          fmtdesc.index++;
-//        }
-        {//获取摄像头所支持的格式和分辨率
-
-            enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            struct v4l2_fmtdesc fmtdesc;
-            struct v4l2_frmsizeenum frmsize;
-            struct v4l2_frmivalenum frmival;
-
-            fmtdesc.index = 0;
-            fmtdesc.type = type;
-            while (ioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc) >= 0) {
-              LOG(NOTICE) <<(fmtdesc.index+1) <<"."<<fmtdesc.description<<",supoort resolution:";
-              frmsize.pixel_format = fmtdesc.pixelformat;
-              frmsize.index = 0;
-              while (ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frmsize) >= 0){
-
-                if(frmsize.type == V4L2_FRMSIZE_TYPE_DISCRETE){
-                    LOG(NOTICE) << "width:"<<frmsize.discrete.width << ",height:"<< frmsize.discrete.height;
-                    frmival.index = 0;
-                    frmival.pixel_format = fmtdesc.pixelformat;
-                    frmival.width = frmsize.discrete.width;
-                    frmival.height = frmsize.discrete.height;
-                    while (ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &frmival) >= 0) {
-                        print_frmival(frmival);
-                        frmival.index++;
-                    }
-                }else if(frmsize.type == V4L2_FRMSIZE_TYPE_STEPWISE){
-                    LOG(NOTICE) << "width:"<<frmsize.discrete.width << ",height:"<< frmsize.discrete.height;
-                }
-
-                frmsize.index++;
-                      }
-
-              fmtdesc.index++;
-            }
-
-          }
-
-
+        if (probed) {
+            LOG(NOTICE) << "capture modes from probe cache:" << m_modes.size();
+        } else {
+            this->enumerateModes(fd);
+        }
+    }
 
+    if (!probed && m_params.m_probeCache && !m_modes.empty()) {
+        V4l2ProbeCache::store(key, m_modes);
     }
 
 	if ((cap.capabilities & V4L2_CAP_READWRITE))     LOG(NOTICE) << m_params.m_devName << " support read/write";
@@ -320,6 +386,18 @@ int V4l2Device::configureFormat(int fd)
 	// get current configuration
 	this->queryFormat();		
 
+	// let the cost model override the requested format/size/fps
+	V4l2Mode mode;
+	if ( (m_params.m_modeSelector != NULL) && m_params.m_modeSelector->select(m_modes, mode) ) {
+		m_params.m_formatList.clear();
+		m_params.m_formatList.push_back(mode.m_format);
+		m_params.m_width  = mode.m_width;
+		m_params.m_height = mode.m_height;
+		if (mode.fps() > 0) {
+			m_params.m_fps = (int)(mode.fps() + 0.5);
+		}
+	}
+
 	unsigned int width = m_width;
 	unsigned int height = m_height;
 	if (m_params.m_width != 0)  {
@@ -352,32 +430,40 @@ int V4l2Device::configureFormat(int fd, unsigned int format, unsigned int width,
 	struct v4l2_format   fmt;			
 	memset(&(fmt), 0, sizeof(fmt));
 	fmt.type                = m_deviceType;
-	fmt.fmt.pix.width       = width;
-	fmt.fmt.pix.height      = height;
-	fmt.fmt.pix.pixelformat = format;
-	fmt.fmt.pix.field       = V4L2_FIELD_ANY;
+	if (this->isMultiPlanar())
+	{
+		// the driver fills num_planes and plane_fmt
+		fmt.fmt.pix_mp.width       = width;
+		fmt.fmt.pix_mp.height      = height;
+		fmt.fmt.pix_mp.pixelformat = format;
+		fmt.fmt.pix_mp.field       = V4L2_FIELD_ANY;
+	}
+	else
+	{
+		fmt.fmt.pix.width       = width;
+		fmt.fmt.pix.height      = height;
+		fmt.fmt.pix.pixelformat = format;
+		fmt.fmt.pix.field       = V4L2_FIELD_ANY;
+	}
 	
 	if (ioctl(fd, VIDIOC_S_FMT, &fmt) == -1)
 	{
 		LOG(ERROR) << "Cannot set format:" << fourcc(format) << " for device:" << m_params.m_devName << " " << strerror(errno);
 		return -1;
 	}			
-	if (fmt.fmt.pix.pixelformat != format) 
+	unsigned int negotiated = this->isMultiPlanar() ? fmt.fmt.pix_mp.pixelformat : fmt.fmt.pix.pixelformat;
+	if (negotiated != format) 
 	{
-		LOG(ERROR) << "Cannot set pixelformat to:" << fourcc(format) << " format is:" << fourcc(fmt.fmt.pix.pixelformat);
+		LOG(ERROR) << "Cannot set pixelformat to:" << fourcc(format) << " format is:" << fourcc(negotiated);
 		return -1;
 	}
-	if ((fmt.fmt.pix.width != width) || (fmt.fmt.pix.height != height))
+	this->setFormat(fmt);
+	if ((m_width != width) || (m_height != height))
 	{
-		LOG(WARN) << "Cannot set size to:" << width << "x" << height << " size is:"  << fmt.fmt.pix.width << "x" << fmt.fmt.pix.height;
+		LOG(WARN) << "Cannot set size to:" << width << "x" << height << " size is:"  << m_width << "x" << m_height;
 	}
 	
-	m_format     = fmt.fmt.pix.pixelformat;
-	m_width      = fmt.fmt.pix.width;
-	m_height     = fmt.fmt.pix.height;		
-	m_bufferSize = fmt.fmt.pix.sizeimage;
-	
-    LOG(NOTICE) <<"Setting "<< m_params.m_devName << ":" << fourcc(m_format) << " size:" << m_width << "x" << m_height << " bufferSize:" << m_bufferSize;
+    LOG(NOTICE) <<"Setting "<< m_params.m_devName << ":" << fourcc(m_format) << " size:" << m_width << "x" << m_height << " planes:" << m_planeCount << " bufferSize:" << m_bufferSize;
 	
 	return 0;
 }
@@ -399,6 +485,11 @@ int V4l2Device::configureParam(int fd)
 		}
 	
         LOG(NOTICE) <<"Setting "<< "fps:" << param.parm.capture.timeperframe.numerator << "/" << param.parm.capture.timeperframe.denominator;
+		if (param.parm.capture.timeperframe.numerator)
+		{
+			// timeperframe is written back with what the driver actually accepted
+			m_configuredFps = (double)param.parm.capture.timeperframe.denominator / param.parm.capture.timeperframe.numerator;
+		}
         LOG(NOTICE) <<"Setting "<< "nbBuffer:" << param.parm.capture.readbuffers;
 	}
 	
@@ -406,3 +497,218 @@ int V4l2Device::configureParam(int fd)
 }
 
 
+
+// -----------------------------------------
+//    frame timing
+// -----------------------------------------
+// called by the devices for every frame read, the rate comes from the driver timestamps and sequence
+void V4l2Device::frameDequeued(const timeval & timestamp, unsigned int sequence)
+{
+	m_timestamp = timestamp;
+	m_sequence = sequence;
+	if ( (m_fpsStart.tv_sec == 0) && (m_fpsStart.tv_usec == 0) )
+	{
+		m_fpsStart = timestamp;
+		m_fpsStartSequence = sequence;
+		m_fpsFrames = 0;
+		return;
+	}
+	m_fpsFrames++;
+	double elapsed = (timestamp.tv_sec - m_fpsStart.tv_sec) + (timestamp.tv_usec - m_fpsStart.tv_usec) / 1000000.0;
+	if (elapsed >= 1.0)
+	{
+		// the sequence also counts the frames the driver dropped, that is the camera rate
+		unsigned int frames = sequence - m_fpsStartSequence;
+		if ( (frames == 0) || (frames > 4 * m_fpsFrames + 4) )
+		{
+			frames = m_fpsFrames;
+		}
+		m_measuredFps = frames / elapsed;
+		m_fpsStart = timestamp;
+		m_fpsStartSequence = sequence;
+		m_fpsFrames = 0;
+	}
+	else if (elapsed < 0)
+	{
+		m_fpsStart = timestamp;
+		m_fpsStartSequence = sequence;
+		m_fpsFrames = 0;
+	}
+}
+
+// -----------------------------------------
+//    controls
+// -----------------------------------------
+static void controlFromQuery(const v4l2_queryctrl & query, V4l2Control & control)
+{
+	control.m_id = query.id;
+	control.m_name = std::string((const char*)query.name, strnlen((const char*)query.name, sizeof(query.name)));
+	control.m_type = query.type;
+	control.m_minimum = query.minimum;
+	control.m_maximum = query.maximum;
+	control.m_step = query.step;
+	control.m_default = query.default_value;
+	control.m_flags = query.flags;
+	control.m_menu.clear();
+}
+
+static void enumerateMenu(int fd, V4l2Control & control)
+{
+	if (control.m_type != V4L2_CTRL_TYPE_MENU)
+		return;
+	for (int index = control.m_minimum; index <= control.m_maximum; ++index)
+	{
+		struct v4l2_querymenu menu;
+		memset(&menu, 0, sizeof(menu));
+		menu.id = control.m_id;
+		menu.index = index;
+		if (ioctl(fd, VIDIOC_QUERYMENU, &menu) == 0)
+		{
+			control.m_menu.push_back(std::make_pair(index, std::string((const char*)menu.name, strnlen((const char*)menu.name, sizeof(menu.name)))));
+		}
+	}
+}
+
+std::list<V4l2Control> V4l2Device::enumerateControls()
+{
+	std::list<V4l2Control> controls;
+	struct v4l2_queryctrl query;
+	memset(&query, 0, sizeof(query));
+	query.id = V4L2_CTRL_FLAG_NEXT_CTRL;
+	while (ioctl(m_fd, VIDIOC_QUERYCTRL, &query) == 0)
+	{
+		if ( !(query.flags & V4L2_CTRL_FLAG_DISABLED) && (query.type != V4L2_CTRL_TYPE_CTRL_CLASS) )
+		{
+			V4l2Control control;
+			controlFromQuery(query, control);
+			enumerateMenu(m_fd, control);
+			controls.push_back(control);
+		}
+		query.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
+	}
+	return controls;
+}
+
+bool V4l2Device::queryControl(unsigned int id, V4l2Control & control)
+{
+	struct v4l2_queryctrl query;
+	memset(&query, 0, sizeof(query));
+	query.id = id;
+	if ( (ioctl(m_fd, VIDIOC_QUERYCTRL, &query) == -1) || (query.flags & V4L2_CTRL_FLAG_DISABLED) )
+	{
+		return false;
+	}
+	controlFromQuery(query, control);
+	enumerateMenu(m_fd, control);
+	return true;
+}
+
+bool V4l2Device::getControl(unsigned int id, int & value)
+{
+	struct v4l2_control control;
+	memset(&control, 0, sizeof(control));
+	control.id = id;
+	if (ioctl(m_fd, VIDIOC_G_CTRL, &control) == -1)
+	{
+		LOG(WARN) << "Cannot get control:" << std::hex << id << std::dec << " " << strerror(errno);
+		return false;
+	}
+	value = control.value;
+	return true;
+}
+
+bool V4l2Device::setControl(unsigned int id, int value)
+{
+	struct v4l2_control control;
+	memset(&control, 0, sizeof(control));
+	control.id = id;
+	control.value = value;
+	if (ioctl(m_fd, VIDIOC_S_CTRL, &control) == -1)
+	{
+		LOG(WARN) << "Cannot set control:" << std::hex << id << std::dec << " to:" << value << " " << strerror(errno);
+		return false;
+	}
+	return true;
+}
+
+bool V4l2Device::setControls(const V4l2ControlValues & values)
+{
+	if (values.empty())
+		return true;
+
+	std::vector<v4l2_ext_control> controls(values.size());
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		memset(&controls[i], 0, sizeof(controls[i]));
+		controls[i].id = values[i].first;
+		controls[i].value = values[i].second;
+	}
+	struct v4l2_ext_controls ext;
+	memset(&ext, 0, sizeof(ext));
+	ext.which = V4L2_CTRL_WHICH_CUR_VAL; // controls of any class in one call
+	ext.count = controls.size();
+	ext.controls = controls.data();
+	if (ioctl(m_fd, VIDIOC_S_EXT_CTRLS, &ext) == 0)
+	{
+		return true;
+	}
+	LOG(NOTICE) << "VIDIOC_S_EXT_CTRLS failed for device:" << m_params.m_devName << " " << strerror(errno) << ", setting the controls one by one";
+
+	bool ret = true;
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		ret = this->setControl(values[i].first, values[i].second) && ret;
+	}
+	return ret;
+}
+
+// UVC auto exposure lengthens the exposure in low light, which silently lowers the frame rate
+// (exposure_auto_priority) and blurs moving targets: cap it below the frame period instead
+bool V4l2Device::lockExposure(double dutyCycle)
+{
+	double fps = m_configuredFps ? m_configuredFps : m_params.m_fps;
+	if (fps <= 0)
+	{
+		LOG(WARN) << "Cannot lock exposure without a frame rate";
+		return false;
+	}
+	V4l2Control exposure;
+	if (!this->queryControl(V4L2_CID_EXPOSURE_ABSOLUTE, exposure))
+	{
+		LOG(WARN) << "Device:" << m_params.m_devName << " has no absolute exposure control";
+		return false;
+	}
+
+	// exposure_absolute is in 100us units
+	int maxExposure = (int)(dutyCycle * 10000.0 / fps);
+	int current = exposure.m_default;
+	this->getControl(V4L2_CID_EXPOSURE_ABSOLUTE, current);
+	int locked = std::max(exposure.m_minimum, std::min(std::min(current, maxExposure), exposure.m_maximum));
+
+	V4l2ControlValues values;
+	V4l2Control control;
+	if (this->queryControl(V4L2_CID_EXPOSURE_AUTO, control))
+	{
+		values.push_back(std::make_pair((unsigned int)V4L2_CID_EXPOSURE_AUTO, (int)V4L2_EXPOSURE_MANUAL));
+	}
+	if (this->queryControl(V4L2_CID_EXPOSURE_AUTO_PRIORITY, control))
+	{
+		// never let the camera trade frame rate for exposure
+		values.push_back(std::make_pair((unsigned int)V4L2_CID_EXPOSURE_AUTO_PRIORITY, 0));
+	}
+	values.push_back(std::make_pair((unsigned int)V4L2_CID_EXPOSURE_ABSOLUTE, locked));
+
+	// keep the brightness of the auto exposure, assuming the gain is roughly linear
+	V4l2Control gain;
+	int gainValue = 0;
+	if ( (locked < current) && (locked > 0) && this->queryControl(V4L2_CID_GAIN, gain) && this->getControl(V4L2_CID_GAIN, gainValue) )
+	{
+		int base = std::max(gainValue, std::max(gain.m_minimum, 1));
+		gainValue = std::min(gain.m_maximum, (int)((double)base * current / locked + 0.5));
+		values.push_back(std::make_pair((unsigned int)V4L2_CID_GAIN, gainValue));
+	}
+
+	bool ret = this->setControls(values);
+	LOG(NOTICE) << "Exposure locked for " << fps << " fps: " << locked * 100 << "us (auto was " << current * 100 << "us, max " << maxExposure * 100 << "us) gain:" << gainValue;
+	return ret;
+}
@@ -0,0 +1,374 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2H264Decoder.cpp
+**
+** Low latency H.264 decoding of V4L2 access units (libavcodec)
+**
+** -------------------------------------------------------------------------*/
+
+#ifdef HAVE_LIBAVCODEC
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+#endif
+
+#include "logger.h"
+#include "V4l2Device.h"
+#include "V4l2ConvertKernels.h"
+#include "V4l2H264Decoder.h"
+
+#define H264_NAL_SLICE_IDR 5
+#define H264_NAL_SPS       7
+#define H264_NAL_PPS       8
+
+static const unsigned char H264_START_CODE[] = { 0, 0, 0, 1 };
+
+V4l2H264Decoder* V4l2H264Decoder::create(int threads)
+{
+	V4l2H264Decoder* decoder = new V4l2H264Decoder();
+	if (!decoder->init(threads))
+	{
+		delete decoder;
+		decoder = NULL;
+	}
+	return decoder;
+}
+
+V4l2H264Decoder::V4l2H264Decoder() : m_context(NULL), m_frame(NULL), m_packet(NULL), m_waitKeyframe(true)
+{
+}
+
+V4l2H264Decoder::~V4l2H264Decoder()
+{
+#ifdef HAVE_LIBAVCODEC
+	av_packet_free(&m_packet);
+	av_frame_free(&m_frame);
+	avcodec_free_context(&m_context);
+#endif
+}
+
+bool V4l2H264Decoder::init(int threads)
+{
+#ifdef HAVE_LIBAVCODEC
+	const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+	if (codec == NULL)
+	{
+		LOG(ERROR) << "No H264 decoder in libavcodec";
+		return false;
+	}
+	m_context = avcodec_alloc_context3(codec);
+	m_frame = av_frame_alloc();
+	m_packet = av_packet_alloc();
+	if ( (m_context == NULL) || (m_frame == NULL) || (m_packet == NULL) )
+	{
+		LOG(ERROR) << "Cannot allocate H264 decoder";
+		return false;
+	}
+	// output each picture as soon as it is decoded, no reordering delay
+	m_context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+	m_context->thread_type = FF_THREAD_SLICE;
+	m_context->thread_count = threads;
+	if (avcodec_open2(m_context, codec, NULL) < 0)
+	{
+		LOG(ERROR) << "Cannot open H264 decoder";
+		return false;
+	}
+	LOG(NOTICE) << "H264 decoder:" << codec->name << " slice threads:" << m_context->thread_count;
+	return true;
+#else
+	(void)threads;
+	LOG(ERROR) << "H264 decoding needs libavcodec (HAVE_LIBAVCODEC)";
+	return false;
+#endif
+}
+
+void V4l2H264Decoder::reset()
+{
+#ifdef HAVE_LIBAVCODEC
+	avcodec_flush_buffers(m_context);
+#endif
+	m_waitKeyframe = true;
+}
+
+size_t V4l2H264Decoder::nextStartCode(const unsigned char* data, size_t size, size_t from, size_t* codeLength)
+{
+	for (size_t i = from; i + 3 <= size; ++i)
+	{
+		if ( (data[i] == 0) && (data[i+1] == 0) )
+		{
+			if (data[i+2] == 1)
+			{
+				*codeLength = 3;
+				return i;
+			}
+			if ( (i + 4 <= size) && (data[i+2] == 0) && (data[i+3] == 1) )
+			{
+				*codeLength = 4;
+				return i;
+			}
+		}
+	}
+	*codeLength = 0;
+	return size;
+}
+
+// Exp-Golomb reader over an RBSP, the emulation prevention bytes already removed
+class SpsReader
+{
+	public:
+		SpsReader(const std::vector<unsigned char> & rbsp) : m_rbsp(rbsp), m_bit(0), m_overflow(false) {}
+
+		unsigned int bit()
+		{
+			if (m_bit >= m_rbsp.size() * 8)
+			{
+				m_overflow = true;
+				return 0;
+			}
+			unsigned int value = (m_rbsp[m_bit / 8] >> (7 - m_bit % 8)) & 1;
+			m_bit++;
+			return value;
+		}
+		unsigned int bits(int count)
+		{
+			unsigned int value = 0;
+			while (count-- > 0)
+				value = (value << 1) | this->bit();
+			return value;
+		}
+		unsigned int ue()
+		{
+			int zeros = 0;
+			while ( !m_overflow && (this->bit() == 0) )
+			{
+				if (++zeros > 31)
+				{
+					m_overflow = true;
+					return 0;
+				}
+			}
+			return ((1u << zeros) - 1) + this->bits(zeros);
+		}
+		int se()
+		{
+			unsigned int value = this->ue();
+			return (value & 1) ? (int)((value + 1) / 2) : -(int)(value / 2);
+		}
+		bool overflow() { return m_overflow; }
+
+	protected:
+		const std::vector<unsigned char> & m_rbsp;
+		size_t m_bit;
+		bool m_overflow;
+};
+
+bool V4l2H264Decoder::parseSpsSize(const unsigned char* nal, size_t size, unsigned int & width, unsigned int & height)
+{
+	if ( (size < 4) || ((nal[0] & 0x1f) != H264_NAL_SPS) )
+		return false;
+	// drop the 03 of each 00 00 03
+	std::vector<unsigned char> rbsp;
+	rbsp.reserve(size);
+	for (size_t i = 1; i < size; ++i)
+	{
+		if ( (nal[i] == 3) && (rbsp.size() >= 2) && (rbsp[rbsp.size()-1] == 0) && (rbsp[rbsp.size()-2] == 0) )
+			continue;
+		rbsp.push_back(nal[i]);
+	}
+
+	SpsReader sps(rbsp);
+	unsigned int profile = sps.bits(8);
+	sps.bits(16); // constraint flags, level
+	sps.ue();     // seq_parameter_set_id
+	unsigned int chromaFormat = 1;
+	bool separateColourPlanes = false;
+	if ( (profile == 100) || (profile == 110) || (profile == 122) || (profile == 244) || (profile == 44) || (profile == 83)
+		|| (profile == 86) || (profile == 118) || (profile == 128) || (profile == 138) || (profile == 139) || (profile == 134) || (profile == 135) )
+	{
+		chromaFormat = sps.ue();
+		if (chromaFormat == 3)
+			separateColourPlanes = sps.bit();
+		sps.ue();   // bit_depth_luma_minus8
+		sps.ue();   // bit_depth_chroma_minus8
+		sps.bit();  // qpprime_y_zero_transform_bypass_flag
+		if (sps.bit())
+		{
+			// scaling lists, only skipped
+			for (int i = 0; i < ((chromaFormat != 3) ? 8 : 12); ++i)
+			{
+				if (!sps.bit())
+					continue;
+				int last = 8;
+				int next = 8;
+				for (int j = 0; j < ((i < 6) ? 16 : 64) && (next != 0); ++j)
+				{
+					next = (last + sps.se() + 256) % 256;
+					if (next != 0)
+						last = next;
+				}
+			}
+		}
+	}
+	sps.ue(); // log2_max_frame_num_minus4
+	unsigned int pocType = sps.ue();
+	if (pocType == 0)
+	{
+		sps.ue(); // log2_max_pic_order_cnt_lsb_minus4
+	}
+	else if (pocType == 1)
+	{
+		sps.bit(); // delta_pic_order_always_zero_flag
+		sps.se();  // offset_for_non_ref_pic
+		sps.se();  // offset_for_top_to_bottom_field
+		unsigned int cycle = sps.ue();
+		for (unsigned int i = 0; (i < cycle) && !sps.overflow(); ++i)
+			sps.se();
+	}
+	sps.ue();  // max_num_ref_frames
+	sps.bit(); // gaps_in_frame_num_value_allowed_flag
+	unsigned int widthInMbs = sps.ue() + 1;
+	unsigned int heightInMapUnits = sps.ue() + 1;
+	unsigned int frameMbsOnly = sps.bit();
+	if (!frameMbsOnly)
+		sps.bit(); // mb_adaptive_frame_field_flag
+	sps.bit();     // direct_8x8_inference_flag
+	unsigned int cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+	if (sps.bit())
+	{
+		cropLeft = sps.ue();
+		cropRight = sps.ue();
+		cropTop = sps.ue();
+		cropBottom = sps.ue();
+	}
+	if (sps.overflow())
+		return false;
+
+	unsigned int cropUnitX = 1;
+	unsigned int cropUnitY = 2 - frameMbsOnly;
+	if (!separateColourPlanes && (chromaFormat != 0))
+	{
+		cropUnitX = (chromaFormat == 3) ? 1 : 2;
+		cropUnitY *= (chromaFormat == 1) ? 2 : 1;
+	}
+	unsigned int codedWidth = widthInMbs * 16;
+	unsigned int codedHeight = (2 - frameMbsOnly) * heightInMapUnits * 16;
+	if ( (cropUnitX * (cropLeft + cropRight) >= codedWidth) || (cropUnitY * (cropTop + cropBottom) >= codedHeight) )
+		return false;
+	width = codedWidth - cropUnitX * (cropLeft + cropRight);
+	height = codedHeight - cropUnitY * (cropTop + cropBottom);
+	return true;
+}
+
+// remember the last SPS/PPS, returns true when the access unit holds an IDR slice
+bool V4l2H264Decoder::scanParameterSets(const unsigned char* data, size_t size, bool & hasParameterSets)
+{
+	bool idr = false;
+	bool sps = false;
+	bool pps = false;
+	size_t codeLength = 0;
+	size_t start = nextStartCode(data, size, 0, &codeLength);
+	while (start < size)
+	{
+		size_t nal = start + codeLength;
+		size_t next = nextStartCode(data, size, nal, &codeLength);
+		if (nal < next)
+		{
+			switch (data[nal] & 0x1f)
+			{
+				case H264_NAL_SLICE_IDR:
+					idr = true;
+				break;
+				case H264_NAL_SPS:
+					m_sps.assign(data + nal, data + next);
+					sps = true;
+				break;
+				case H264_NAL_PPS:
+					m_pps.assign(data + nal, data + next);
+					pps = true;
+				break;
+			}
+		}
+		start = next;
+	}
+	hasParameterSets = sps && pps;
+	return idr;
+}
+
+bool V4l2H264Decoder::decode(const char* data, size_t size, cv::Mat & image)
+{
+#ifdef HAVE_LIBAVCODEC
+	const unsigned char* au = (const unsigned char*)data;
+	bool hasParameterSets = false;
+	bool idr = this->scanParameterSets(au, size, hasParameterSets);
+	if (m_waitKeyframe)
+	{
+		// nothing can be decoded before the first IDR and its parameter sets
+		if (!idr || m_sps.empty() || m_pps.empty())
+			return false;
+		m_waitKeyframe = false;
+	}
+
+	m_buffer.clear();
+	if (idr && !hasParameterSets)
+	{
+		m_buffer.insert(m_buffer.end(), H264_START_CODE, H264_START_CODE + sizeof(H264_START_CODE));
+		m_buffer.insert(m_buffer.end(), m_sps.begin(), m_sps.end());
+		m_buffer.insert(m_buffer.end(), H264_START_CODE, H264_START_CODE + sizeof(H264_START_CODE));
+		m_buffer.insert(m_buffer.end(), m_pps.begin(), m_pps.end());
+	}
+	// libavcodec reads past the end, the mmap buffer cannot be given as is
+	m_buffer.insert(m_buffer.end(), au, au + size);
+	size_t payload = m_buffer.size();
+	m_buffer.resize(payload + AV_INPUT_BUFFER_PADDING_SIZE, 0);
+
+	m_packet->data = m_buffer.data();
+	m_packet->size = payload;
+	int ret = avcodec_send_packet(m_context, m_packet);
+	if (ret < 0)
+	{
+		LOG_EVERY_MS(WARN, 1000) << "H264 decode error:" << ret << ", waiting for the next IDR";
+		this->reset();
+		return false;
+	}
+
+	bool decoded = false;
+	while (avcodec_receive_frame(m_context, m_frame) == 0)
+	{
+		V4l2Planes planes;
+		for (unsigned int p = 0; p < 3 && m_frame->data[p]; ++p)
+		{
+			planes.m_data[p] = (char*)m_frame->data[p];
+			planes.m_stride[p] = m_frame->linesize[p];
+			planes.m_count = p + 1;
+		}
+		// no release here, image.create keeps a buffer the caller passes in; V4l2Capture::read releases it first
+		// because the previous frame is usually still held by the pipeline, so each picture gets a new one
+		switch (m_frame->format)
+		{
+			case AV_PIX_FMT_YUV420P:
+			case AV_PIX_FMT_YUVJ420P:
+				if ( (m_frame->format == AV_PIX_FMT_YUVJ420P) || (m_frame->color_range == AVCOL_RANGE_JPEG) )
+					convertJ420ToBGR(planes, m_frame->width, m_frame->height, image);
+				else
+					convertI420ToBGR(planes, m_frame->width, m_frame->height, image);
+				decoded = true;
+			break;
+			case AV_PIX_FMT_NV12:
+				convertNV12ToBGR(planes, m_frame->width, m_frame->height, image);
+				decoded = true;
+			break;
+			default:
+				LOG_EVERY_MS(ERROR, 1000) << "Unsupported H264 output format:" << m_frame->format;
+			break;
+		}
+	}
+	return decoded;
+#else
+	(void)data; (void)size; (void)image;
+	return false;
+#endif
+}
@@ -23,9 +23,25 @@
 #include "logger.h"
 #include "V4l2MmapDevice.h"
 
-V4l2MmapDevice::V4l2MmapDevice(const V4L2DeviceParameters & params, v4l2_buf_type deviceType) : V4l2Device(params, deviceType), n_buffers(0) 
+V4l2MmapDevice::V4l2MmapDevice(const V4L2DeviceParameters & params, v4l2_buf_type deviceType) : V4l2Device(params, deviceType), n_buffers(0), m_readInProgress(false) 
 {
 	memset(&m_buffer, 0, sizeof(m_buffer));
+	memset(&m_readBuf, 0, sizeof(m_readBuf));
+	memset(&m_readPlanes, 0, sizeof(m_readPlanes));
+}
+
+// prepare a v4l2_buffer for QUERYBUF/DQBUF, multi-planar buffers carry their planes in a separate array
+void V4l2MmapDevice::initBuffer(struct v4l2_buffer & buf, struct v4l2_plane * planes)
+{
+	memset (&buf, 0, sizeof(buf));
+	buf.type        = m_deviceType;
+	buf.memory      = V4L2_MEMORY_MMAP;
+	if (this->isMultiPlanar())
+	{
+		memset(planes, 0, sizeof(struct v4l2_plane) * VIDEO_MAX_PLANES);
+		buf.m.planes = planes;
+		buf.length   = m_planeCount;
+	}
 }
 
 bool V4l2MmapDevice::init(unsigned int mandatoryCapabilities)
@@ -77,9 +93,8 @@ bool V4l2MmapDevice::start()
 		for (n_buffers = 0; n_buffers < req.count; ++n_buffers) 
 		{
 			struct v4l2_buffer buf;
-			memset (&buf, 0, sizeof(buf));
-			buf.type        = m_deviceType;
-			buf.memory      = V4L2_MEMORY_MMAP;
+			struct v4l2_plane planes[VIDEO_MAX_PLANES];
+			this->initBuffer(buf, planes);
 			buf.index       = n_buffers;
 
 			if (-1 == ioctl(m_fd, VIDIOC_QUERYBUF, &buf))
@@ -89,22 +104,27 @@ bool V4l2MmapDevice::start()
 			}
 			else
 			{
-				LOG(INFO) << "Device " << m_params.m_devName << " buffer idx:" << n_buffers << " size:" << buf.length << " offset:" << buf.m.offset;
-				m_buffer[n_buffers].length = buf.length;
-				if (!m_buffer[n_buffers].length) {
-					m_buffer[n_buffers].length = buf.bytesused;
-				}
-				m_buffer[n_buffers].start = mmap (   NULL /* start anywhere */, 
-											m_buffer[n_buffers].length, 
-											PROT_READ | PROT_WRITE /* required */, 
-											MAP_SHARED /* recommended */, 
-											m_fd, 
-											buf.m.offset);
-
-				if (MAP_FAILED == m_buffer[n_buffers].start)
+				for (unsigned int p = 0; p < this->planeCount(); ++p)
 				{
-					perror("mmap");
-					success = false;
+					size_t length = this->isMultiPlanar() ? planes[p].length : buf.length;
+					off_t offset = this->isMultiPlanar() ? planes[p].m.mem_offset : buf.m.offset;
+					LOG(INFO) << "Device " << m_params.m_devName << " buffer idx:" << n_buffers << " plane:" << p << " size:" << length << " offset:" << offset;
+					m_buffer[n_buffers].length[p] = length;
+					if (!m_buffer[n_buffers].length[p]) {
+						m_buffer[n_buffers].length[p] = this->isMultiPlanar() ? planes[p].bytesused : buf.bytesused;
+					}
+					m_buffer[n_buffers].start[p] = mmap (   NULL /* start anywhere */, 
+												m_buffer[n_buffers].length[p], 
+												PROT_READ | PROT_WRITE /* required */, 
+												MAP_SHARED /* recommended */, 
+												m_fd, 
+												offset);
+
+					if (MAP_FAILED == m_buffer[n_buffers].start[p])
+					{
+						perror("mmap");
+						success = false;
+					}
 				}
 			}
 		}
@@ -113,9 +133,8 @@ bool V4l2MmapDevice::start()
 		for (unsigned int i = 0; i < n_buffers; ++i) 
 		{
 			struct v4l2_buffer buf;
-			memset (&buf, 0, sizeof(buf));
-			buf.type        = m_deviceType;
-			buf.memory      = V4L2_MEMORY_MMAP;
+			struct v4l2_plane planes[VIDEO_MAX_PLANES];
+			this->initBuffer(buf, planes);
 			buf.index       = i;
 
 			if (-1 == ioctl(m_fd, VIDIOC_QBUF, &buf))
@@ -151,10 +170,13 @@ bool V4l2MmapDevice::stop()
 
 	for (unsigned int i = 0; i < n_buffers; ++i)
 	{
-		if (-1 == munmap (m_buffer[i].start, m_buffer[i].length))
+		for (unsigned int p = 0; p < this->planeCount(); ++p)
 		{
-			perror("munmap");
-			success = false;
+			if (-1 == munmap (m_buffer[i].start[p], m_buffer[i].length[p]))
+			{
+				perror("munmap");
+				success = false;
+			}
 		}
 	}
 	
@@ -180,28 +202,49 @@ size_t V4l2MmapDevice::readInternal(char* buffer, size_t bufferSize)
 	if (n_buffers > 0)
 	{
 		struct v4l2_buffer buf;	
-		memset (&buf, 0, sizeof(buf));
-		buf.type = m_deviceType;
-		buf.memory = V4L2_MEMORY_MMAP;
+		struct v4l2_plane planes[VIDEO_MAX_PLANES];
+		this->initBuffer(buf, planes);
 
 		if (-1 == ioctl(m_fd, VIDIOC_DQBUF, &buf)) 
 		{
-			perror("VIDIOC_DQBUF");
+			LOG_EVERY_MS(ERROR, 1000) << "VIDIOC_DQBUF " << strerror(errno);
 			size = -1;
 		}
 		else if (buf.index < n_buffers)
 		{
-			size = buf.bytesused;
-			if (size > bufferSize)
+			this->frameDequeued(buf.timestamp, buf.sequence);
+			if (this->isMultiPlanar())
 			{
-				size = bufferSize;
-				LOG(WARN) << "Device " << m_params.m_devName << " buffer truncated available:" << bufferSize << " needed:" << buf.bytesused;
+				// planes are copied one after the other
+				size_t needed = 0;
+				for (unsigned int p = 0; p < m_planeCount; ++p)
+				{
+					size_t planeSize = planes[p].bytesused - planes[p].data_offset;
+					needed += planeSize;
+					if (size + planeSize > bufferSize)
+						planeSize = bufferSize - size;
+					memcpy(buffer + size, (char*)m_buffer[buf.index].start[p] + planes[p].data_offset, planeSize);
+					size += planeSize;
+				}
+				if (needed > bufferSize)
+				{
+					LOG_EVERY_MS(WARN, 1000) << "Device " << m_params.m_devName << " buffer truncated available:" << bufferSize << " needed:" << needed;
+				}
+			}
+			else
+			{
+				size = buf.bytesused;
+				if (size > bufferSize)
+				{
+					size = bufferSize;
+					LOG_EVERY_MS(WARN, 1000) << "Device " << m_params.m_devName << " buffer truncated available:" << bufferSize << " needed:" << buf.bytesused;
+				}
+				memcpy(buffer, m_buffer[buf.index].start[0], size);
 			}
-			memcpy(buffer, m_buffer[buf.index].start, size);
 
 			if (-1 == ioctl(m_fd, VIDIOC_QBUF, &buf))
 			{
-				perror("VIDIOC_QBUF");
+				LOG_EVERY_MS(ERROR, 1000) << "VIDIOC_QBUF " << strerror(errno);
 				size = -1;
 			}
 		}
@@ -209,6 +252,63 @@ size_t V4l2MmapDevice::readInternal(char* buffer, size_t bufferSize)
 	return size;
 }
 
+// dequeue a buffer and give access to its mappings without copy, endRead gives it back to the driver
+bool V4l2MmapDevice::startRead(V4l2Planes& planes)
+{
+	if (n_buffers <= 0)
+		return false;
+	if (m_readInProgress)
+		return false;
+	this->initBuffer(m_readBuf, m_readPlanes);
+	if (-1 == ioctl(m_fd, VIDIOC_DQBUF, &m_readBuf))
+	{
+		LOG_EVERY_MS(ERROR, 1000) << "VIDIOC_DQBUF " << strerror(errno);
+		return false;
+	}
+	if (m_readBuf.index >= n_buffers)
+	{
+		// give it back, else the ring is one buffer short for good
+		LOG_EVERY_MS(ERROR, 1000) << "VIDIOC_DQBUF index " << m_readBuf.index << " out of " << n_buffers;
+		if (-1 == ioctl(m_fd, VIDIOC_QBUF, &m_readBuf))
+		{
+			LOG_EVERY_MS(ERROR, 1000) << "VIDIOC_QBUF " << strerror(errno);
+		}
+		return false;
+	}
+	this->frameDequeued(m_readBuf.timestamp, m_readBuf.sequence);
+	planes.m_count = this->planeCount();
+	for (unsigned int p = 0; p < planes.m_count; ++p)
+	{
+		char* start = (char*)m_buffer[m_readBuf.index].start[p];
+		if (this->isMultiPlanar())
+		{
+			planes.m_data[p] = start + m_readPlanes[p].data_offset;
+			planes.m_size[p] = m_readPlanes[p].bytesused - m_readPlanes[p].data_offset;
+		}
+		else
+		{
+			planes.m_data[p] = start;
+			planes.m_size[p] = m_readBuf.bytesused;
+		}
+		planes.m_stride[p] = m_bytesPerLine[p];
+	}
+	m_readInProgress = true;
+	return true;
+}
+
+bool V4l2MmapDevice::endRead(void)
+{
+	if (!m_readInProgress)
+		return false;
+	m_readInProgress = false;
+	if (-1 == ioctl(m_fd, VIDIOC_QBUF, &m_readBuf))
+	{
+		LOG_EVERY_MS(ERROR, 1000) << "VIDIOC_QBUF " << strerror(errno);
+		return false;
+	}
+	return true;
+}
+
 size_t V4l2MmapDevice::writeInternal(char* buffer, size_t bufferSize)
 {
 	size_t size = 0;
@@ -221,7 +321,7 @@ size_t V4l2MmapDevice::writeInternal(char* buffer, size_t bufferSize)
 
 		if (-1 == ioctl(m_fd, VIDIOC_DQBUF, &buf)) 
 		{
-			perror("VIDIOC_DQBUF");
+			LOG_EVERY_MS(ERROR, 1000) << "VIDIOC_DQBUF " << strerror(errno);
 			size = -1;
 		}
 		else if (buf.index < n_buffers)
@@ -229,15 +329,15 @@ size_t V4l2MmapDevice::writeInternal(char* buffer, size_t bufferSize)
 			size = bufferSize;
 			if (size > buf.length)
 			{
-				LOG(WARN) << "Device " << m_params.m_devName << " buffer truncated available:" << buf.length << " needed:" << size;
+				LOG_EVERY_MS(WARN, 1000) << "Device " << m_params.m_devName << " buffer truncated available:" << buf.length << " needed:" << size;
 				size = buf.length;
 			}
-			memcpy(m_buffer[buf.index].start, buffer, size);
+			memcpy(m_buffer[buf.index].start[0], buffer, size);
 			buf.bytesused = size;
 
 			if (-1 == ioctl(m_fd, VIDIOC_QBUF, &buf))
 			{
-				perror("VIDIOC_QBUF");
+				LOG_EVERY_MS(ERROR, 1000) << "VIDIOC_QBUF " << strerror(errno);
 				size = -1;
 			}
 		}
@@ -256,7 +356,7 @@ bool V4l2MmapDevice::startPartialWrite(void)
 	m_partialWriteBuf.memory = V4L2_MEMORY_MMAP;
 	if (-1 == ioctl(m_fd, VIDIOC_DQBUF, &m_partialWriteBuf))
 	{
-		perror("VIDIOC_DQBUF");
+		LOG_EVERY_MS(ERROR, 1000) << "VIDIOC_DQBUF " << strerror(errno);
 		return false;
 	}
 	m_partialWriteBuf.bytesused = 0;
@@ -275,11 +375,11 @@ size_t V4l2MmapDevice::writePartialInternal(char* buffer, size_t bufferSize)
 			new_size = m_partialWriteBuf.bytesused + bufferSize;
 			if (new_size > m_partialWriteBuf.length)
 			{
-				LOG(WARN) << "Device " << m_params.m_devName << " buffer truncated available:" << m_partialWriteBuf.length << " needed:" << new_size;
+				LOG_EVERY_MS(WARN, 1000) << "Device " << m_params.m_devName << " buffer truncated available:" << m_partialWriteBuf.length << " needed:" << new_size;
 				new_size = m_partialWriteBuf.length;
 			}
 			size = new_size - m_partialWriteBuf.bytesused;
-			memcpy(&((char *)m_buffer[m_partialWriteBuf.index].start)[m_partialWriteBuf.bytesused], buffer, size);
+			memcpy(&((char *)m_buffer[m_partialWriteBuf.index].start[0])[m_partialWriteBuf.bytesused], buffer, size);
 
 			m_partialWriteBuf.bytesused += size;
 		}
@@ -298,10 +398,68 @@ bool V4l2MmapDevice::endPartialWrite(void)
 	}
 	if (-1 == ioctl(m_fd, VIDIOC_QBUF, &m_partialWriteBuf))
 	{
-		perror("VIDIOC_QBUF");
+		LOG_EVERY_MS(ERROR, 1000) << "VIDIOC_QBUF " << strerror(errno);
 		m_partialWriteInProgress = false; // abort partial write
 		return true;
 	}
 	m_partialWriteInProgress = false;
 	return true;
 }
+
+// dequeue a free output buffer and give access to its mapping, the caller fills it in place and endWrite queues it
+bool V4l2MmapDevice::startWrite(V4l2Planes& planes)
+{
+	if ( (n_buffers <= 0) || this->isMultiPlanar() )
+		return false;
+	if (m_partialWriteInProgress)
+		return false;
+	memset(&m_partialWriteBuf, 0, sizeof(m_partialWriteBuf));
+	m_partialWriteBuf.type = m_deviceType;
+	m_partialWriteBuf.memory = V4L2_MEMORY_MMAP;
+	if (-1 == ioctl(m_fd, VIDIOC_DQBUF, &m_partialWriteBuf))
+	{
+		// EAGAIN: every buffer is still queued, the consumer is late
+		if (errno != EAGAIN)
+		{
+			LOG_EVERY_MS(ERROR, 1000) << "VIDIOC_DQBUF " << strerror(errno);
+		}
+		return false;
+	}
+	if (m_partialWriteBuf.index >= n_buffers)
+	{
+		// give it back, else the ring is one buffer short for good
+		LOG_EVERY_MS(ERROR, 1000) << "VIDIOC_DQBUF index " << m_partialWriteBuf.index << " out of " << n_buffers;
+		if (-1 == ioctl(m_fd, VIDIOC_QBUF, &m_partialWriteBuf))
+		{
+			LOG_EVERY_MS(ERROR, 1000) << "VIDIOC_QBUF " << strerror(errno);
+		}
+		return false;
+	}
+	planes.m_count = 1;
+	planes.m_data[0] = (char*)m_buffer[m_partialWriteBuf.index].start[0];
+	planes.m_size[0] = m_buffer[m_partialWriteBuf.index].length[0];
+	planes.m_stride[0] = m_bytesPerLine[0];
+	m_partialWriteBuf.bytesused = 0;
+	m_partialWriteInProgress = true;
+	return true;
+}
+
+bool V4l2MmapDevice::endWrite(size_t bytesused)
+{
+	if (!m_partialWriteInProgress)
+		return false;
+	m_partialWriteInProgress = false;
+	size_t length = m_buffer[m_partialWriteBuf.index].length[0];
+	if (bytesused > length)
+	{
+		LOG_EVERY_MS(WARN, 1000) << "Device " << m_params.m_devName << " buffer truncated available:" << length << " needed:" << bytesused;
+		bytesused = length;
+	}
+	m_partialWriteBuf.bytesused = bytesused;
+	if (-1 == ioctl(m_fd, VIDIOC_QBUF, &m_partialWriteBuf))
+	{
+		LOG_EVERY_MS(ERROR, 1000) << "VIDIOC_QBUF " << strerror(errno);
+		return false;
+	}
+	return true;
+}
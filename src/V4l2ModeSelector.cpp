@@ -0,0 +1,188 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2ModeSelector.cpp
+**
+** Choose the capture format/size/fps from the enumerated modes
+**
+** -------------------------------------------------------------------------*/
+
+#include <vector>
+#include <algorithm>
+
+#include <opencv2/opencv.hpp>
+
+#include "logger.h"
+#include "V4l2Device.h"
+#include "V4l2Capture.h"
+#include "V4l2Converter.h"
+#include "V4l2ModeSelector.h"
+
+// rough ns per pixel of the registered converter, negative when the format cannot be converted
+double V4l2ModeSelector::defaultDecodeCost(unsigned int format)
+{
+#ifdef HAVE_LIBAVCODEC
+	// V4l2H264Decoder, slice threaded
+	if (format == V4L2_PIX_FMT_H264)
+		return 3.0;
+#endif
+	if (V4l2Converter::find(format) == NULL)
+		return -1;
+	switch (format)
+	{
+		case V4L2_PIX_FMT_GREY:
+		case V4L2_PIX_FMT_BGR24:  return 0.3;
+		case V4L2_PIX_FMT_RGB24:  return 0.5;
+		case V4L2_PIX_FMT_MJPEG:
+		case V4L2_PIX_FMT_JPEG:   return 6.0;
+		default:                  return 0.8; // vectorised YUV kernels
+	}
+}
+
+// bytes per pixel on the bus, compressed formats use a typical ratio
+double V4l2ModeSelector::bytesPerPixel(unsigned int format)
+{
+	switch (format)
+	{
+		case V4L2_PIX_FMT_BGR32:
+		case V4L2_PIX_FMT_XBGR32:
+		case V4L2_PIX_FMT_ABGR32: return 4;
+		case V4L2_PIX_FMT_BGR24:
+		case V4L2_PIX_FMT_RGB24:  return 3;
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_UYVY:
+		case V4L2_PIX_FMT_YVYU:
+		case V4L2_PIX_FMT_VYUY:
+		case V4L2_PIX_FMT_YUV422P: return 2;
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV12M:
+		case V4L2_PIX_FMT_NV21:
+		case V4L2_PIX_FMT_NV21M:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YUV420M:
+		case V4L2_PIX_FMT_YVU420:
+		case V4L2_PIX_FMT_YVU420M: return 1.5;
+		case V4L2_PIX_FMT_GREY:   return 1;
+		case V4L2_PIX_FMT_H264:   return 0.05;
+		default:                  return 0.25;
+	}
+}
+
+double V4l2ModeSelector::decodeCost(unsigned int format) const
+{
+	std::map<unsigned int, double>::const_iterator it = m_constraints.m_decodeCost.find(format);
+	if (it != m_constraints.m_decodeCost.end())
+		return it->second;
+	return defaultDecodeCost(format);
+}
+
+double V4l2ModeSelector::cost(const V4l2Mode & mode) const
+{
+	double decode = this->decodeCost(mode.m_format);
+	double fps = mode.fps();
+	if ( (decode < 0) || (mode.m_width == 0) || (mode.m_height == 0) )
+		return -1;
+	// a mode without interval information is assumed to reach the requested rate
+	if (fps == 0)
+		fps = m_constraints.m_minFps;
+	if (fps < m_constraints.m_minFps)
+		return -1;
+
+	double pixels = (double)mode.m_width * mode.m_height;
+	if ( (m_constraints.m_busBandwidth > 0) && (pixels * bytesPerPixel(mode.m_format) * fps > m_constraints.m_busBandwidth) )
+		return -1;
+
+	// the capture thread converts every frame, not only the ones the network sees
+	double cpu = decode * pixels * fps * 1e-9;
+
+	double scale = (double)mode.m_width / m_constraints.m_targetWidth;
+	if (m_constraints.m_targetHeight != 0)
+		scale = std::min(scale, (double)mode.m_height / m_constraints.m_targetHeight);
+	double underscale = (scale < 1) ? (1 - scale) * m_constraints.m_underscaleCost : 0;
+
+	double latency = m_constraints.m_latencyCost / fps;
+
+	return cpu + underscale + latency;
+}
+
+bool V4l2ModeSelector::select(const std::list<V4l2Mode> & modes, V4l2Mode & best)
+{
+	if (m_constraints.m_calibrate)
+	{
+		this->calibrate(modes);
+		m_constraints.m_calibrate = false;
+	}
+
+	double bestCost = -1;
+	for (std::list<V4l2Mode>::const_iterator it = modes.begin(); it != modes.end(); ++it)
+	{
+		double c = this->cost(*it);
+		LOG(DEBUG) << "mode " << fourcc(it->m_format) << " " << it->m_width << "x" << it->m_height << "@" << it->fps() << " cost:" << c;
+		if ( (c >= 0) && ((bestCost < 0) || (c < bestCost)) )
+		{
+			bestCost = c;
+			best = *it;
+		}
+	}
+	if (bestCost < 0)
+	{
+		LOG(WARN) << "No capture mode satisfies " << m_constraints.m_targetWidth << "x" << m_constraints.m_targetHeight << "@" << m_constraints.m_minFps;
+		return false;
+	}
+	LOG(NOTICE) << "Selected mode " << fourcc(best.m_format) << " " << best.m_width << "x" << best.m_height << "@" << best.fps() << " cost:" << bestCost;
+	return true;
+}
+
+void V4l2ModeSelector::calibrate(const std::list<V4l2Mode> & modes)
+{
+	const int width = 640;
+	const int height = 480;
+	const int loops = 10;
+
+	// textured test pattern, a flat image makes the JPEG decoder look too fast
+	cv::Mat bgr(height, width, CV_8UC3);
+	for (int y = 0; y < height; ++y)
+	{
+		unsigned char* row = bgr.ptr<unsigned char>(y);
+		for (int x = 0; x < width; ++x)
+		{
+			row[3*x]   = (unsigned char)(x + y);
+			row[3*x+1] = (unsigned char)((x * y) >> 4);
+			row[3*x+2] = (unsigned char)(((x ^ y) & 0x1f) << 3);
+		}
+	}
+
+	for (std::list<V4l2Mode>::const_iterator it = modes.begin(); it != modes.end(); ++it)
+	{
+		unsigned int format = it->m_format;
+		if ( (defaultDecodeCost(format) < 0) || (m_constraints.m_decodeCost.count(format) != 0) )
+			continue;
+		// H264 goes through the stateful V4l2H264Decoder, not through convert: keep the default cost
+		if (format == V4L2_PIX_FMT_H264)
+			continue;
+
+		std::vector<unsigned char> buffer;
+		if ( (format == V4L2_PIX_FMT_MJPEG) || (format == V4L2_PIX_FMT_JPEG) )
+		{
+			cv::imencode(".jpg", bgr, buffer);
+		}
+		else
+		{
+			buffer.resize((size_t)(width * height * bytesPerPixel(format)));
+			for (size_t i = 0; i < buffer.size(); ++i)
+				buffer[i] = bgr.data[i % (bgr.total() * 3)];
+		}
+
+		cv::Mat out;
+		V4l2Capture::convert((const char*)buffer.data(), buffer.size(), format, width, height, out);
+		int64_t start = cv::getTickCount();
+		for (int i = 0; i < loops; ++i)
+			V4l2Capture::convert((const char*)buffer.data(), buffer.size(), format, width, height, out);
+		double ns = (cv::getTickCount() - start) * 1e9 / cv::getTickFrequency() / loops / (width * height);
+
+		m_constraints.m_decodeCost[format] = ns;
+		LOG(NOTICE) << "Calibrated " << fourcc(format) << " convert:" << ns << " ns/pixel";
+	}
+}
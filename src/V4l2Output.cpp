@@ -39,6 +39,9 @@ V4l2Output* V4l2Output::create(const V4L2DeviceParameters & param, IoType iotype
 			videoDevice = new V4l2ReadWriteDevice(param, V4L2_BUF_TYPE_VIDEO_OUTPUT); 
 			caps |= V4L2_CAP_READWRITE;
 		break;
+		default:
+			LOG(ERROR) << "Unsupported output iotype:" << iotype;
+		break;
 	}
 	
 	if (videoDevice &&  !videoDevice->init(caps))
@@ -104,3 +107,12 @@ bool V4l2Output::endPartialWrite(void)
 	return m_device->endPartialWrite();
 }
 
+bool V4l2Output::startWrite(V4l2Planes & planes)
+{
+	return m_device->startWrite(planes);
+}
+
+bool V4l2Output::endWrite(size_t bytesused)
+{
+	return m_device->endWrite(bytesused);
+}
@@ -0,0 +1,212 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2PassthroughSink.cpp
+** 
+** Records the camera payload (MJPEG...) as is, without decode/re-encode
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "logger.h"
+#include "V4l2PassthroughSink.h"
+
+#define PASSTHROUGH_ALIGN 4096
+
+// -----------------------------------------
+//    create sink
+// -----------------------------------------
+V4l2PassthroughSink* V4l2PassthroughSink::create(const std::string & path, unsigned int format, unsigned int width, unsigned int height, size_t chunkSize, unsigned int nbChunks)
+{
+	// O_DIRECT needs aligned memory, offset and size
+	chunkSize = (chunkSize + PASSTHROUGH_ALIGN - 1) / PASSTHROUGH_ALIGN * PASSTHROUGH_ALIGN;
+	std::vector<char*> buffers(nbChunks < 2 ? 2 : nbChunks, (char*)NULL);
+	for (size_t i = 0; i < buffers.size(); ++i)
+	{
+		void* data = NULL;
+		if (posix_memalign(&data, PASSTHROUGH_ALIGN, chunkSize) != 0)
+		{
+			LOG(ERROR) << "Cannot allocate " << buffers.size() << " chunks of " << chunkSize << " bytes";
+			for (size_t j = 0; j < i; ++j)
+				free(buffers[j]);
+			return NULL;
+		}
+		buffers[i] = (char*)data;
+	}
+
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+	int fd = open(path.c_str(), flags | O_DIRECT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if ( (fd == -1) && (errno == EINVAL) )
+	{
+		// tmpfs and some others refuse O_DIRECT
+		LOG(NOTICE) << path << " does not support O_DIRECT, using buffered writes";
+		fd = open(path.c_str(), flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	}
+	if (fd == -1)
+	{
+		LOG(ERROR) << "Cannot create:" << path << " " << strerror(errno);
+		for (size_t i = 0; i < buffers.size(); ++i)
+			free(buffers[i]);
+		return NULL;
+	}
+	std::string indexPath = path + ".idx";
+	FILE* index = fopen(indexPath.c_str(), "wb");
+	if (index == NULL)
+	{
+		LOG(ERROR) << "Cannot create:" << indexPath << " " << strerror(errno);
+		::close(fd);
+		for (size_t i = 0; i < buffers.size(); ++i)
+			free(buffers[i]);
+		return NULL;
+	}
+	V4l2PassthroughIndexHeader header;
+	header.magic = 0x58444934; /* "4IDX" */
+	header.format = format;
+	header.width = width;
+	header.height = height;
+	fwrite(&header, sizeof(header), 1, index);
+
+	return new V4l2PassthroughSink(path, fd, index, chunkSize, buffers);
+}
+
+// -----------------------------------------
+//    constructor
+// -----------------------------------------
+V4l2PassthroughSink::V4l2PassthroughSink(const std::string & path, int fd, FILE* index, size_t chunkSize, const std::vector<char*> & buffers)
+	: m_path(path), m_fd(fd), m_index(index), m_chunkSize(chunkSize), m_chunks(buffers.size()), m_offset(0), m_sealed(0), m_written(0), m_stop(false), m_dropped(0)
+{
+	for (size_t i = 0; i < m_chunks.size(); ++i)
+	{
+		m_chunks[i].data = buffers[i];
+		m_chunks[i].fill = 0;
+		m_chunks[i].index.reserve(256);
+	}
+	m_writer = std::thread(&V4l2PassthroughSink::writerLoop, this);
+}
+
+// -----------------------------------------
+//    destructor
+// -----------------------------------------
+V4l2PassthroughSink::~V4l2PassthroughSink()
+{
+	// flush the partially filled chunk, it is padded on disk then truncated
+	if (m_chunks[m_sealed % m_chunks.size()].fill > 0)
+	{
+		this->seal();
+	}
+	m_stop = true;
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		m_cond.notify_one();
+	}
+	m_writer.join();
+	if (ftruncate(m_fd, m_offset) == -1)
+	{
+		LOG(ERROR) << "Cannot truncate:" << m_path << " " << strerror(errno);
+	}
+	::close(m_fd);
+	fclose(m_index);
+	for (size_t i = 0; i < m_chunks.size(); ++i)
+	{
+		free(m_chunks[i].data);
+	}
+	LOG(NOTICE) << "Recording " << m_path << " bytes:" << m_offset << " dropped frames:" << m_dropped;
+}
+
+// -----------------------------------------
+//    capture thread: copy the payload, never wait for the disk
+// -----------------------------------------
+bool V4l2PassthroughSink::write(const char* buffer, size_t size, const timeval & timestamp, unsigned int sequence)
+{
+	unsigned long nbChunks = m_chunks.size();
+	Chunk* chunk = &m_chunks[m_sealed % nbChunks];
+	// the current chunk plus the ones the writer has released
+	unsigned long freeChunks = nbChunks - 1 - (m_sealed - m_written);
+	if (size > (m_chunkSize - chunk->fill) + freeChunks * m_chunkSize)
+	{
+		m_dropped++;
+		return false;
+	}
+
+	V4l2PassthroughIndexEntry entry;
+	entry.timestamp = (uint64_t)timestamp.tv_sec * 1000000 + timestamp.tv_usec;
+	entry.offset = m_offset;
+	entry.size = size;
+	entry.sequence = sequence;
+	chunk->index.push_back(entry);
+
+	// the file is a contiguous stream, a frame may span several chunks.
+	// a full chunk is handed over only when the next one is needed, so the current chunk is never owned by the writer
+	while (size > 0)
+	{
+		if (chunk->fill == m_chunkSize)
+		{
+			this->seal();
+			chunk = &m_chunks[m_sealed % nbChunks];
+		}
+		size_t len = std::min(size, m_chunkSize - chunk->fill);
+		memcpy(chunk->data + chunk->fill, buffer, len);
+		chunk->fill += len;
+		buffer += len;
+		size -= len;
+		m_offset += len;
+	}
+	return true;
+}
+
+void V4l2PassthroughSink::seal()
+{
+	m_sealed++;
+	std::lock_guard<std::mutex> guard(m_mutex);
+	m_cond.notify_one();
+}
+
+// -----------------------------------------
+//    writer thread
+// -----------------------------------------
+void V4l2PassthroughSink::writerLoop()
+{
+	unsigned long nbChunks = m_chunks.size();
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> guard(m_mutex);
+			m_cond.wait(guard, [this] { return m_stop || (m_written < m_sealed); });
+			if (m_stop && (m_written == m_sealed))
+				break;
+		}
+		Chunk & chunk = m_chunks[m_written % nbChunks];
+		off_t offset = (off_t)m_written * m_chunkSize;
+		size_t len = (chunk.fill + PASSTHROUGH_ALIGN - 1) / PASSTHROUGH_ALIGN * PASSTHROUGH_ALIGN;
+		size_t done = 0;
+		while (done < len)
+		{
+			ssize_t ret = pwrite(m_fd, chunk.data + done, len - done, offset + done);
+			if (ret <= 0)
+			{
+				if (ret == -1 && errno == EINTR)
+					continue;
+				LOG(ERROR) << "Cannot write:" << m_path << " " << strerror(errno);
+				break;
+			}
+			done += ret;
+		}
+		if (!chunk.index.empty())
+		{
+			fwrite(chunk.index.data(), sizeof(V4l2PassthroughIndexEntry), chunk.index.size(), m_index);
+			chunk.index.clear();
+		}
+		chunk.fill = 0;
+		m_written++;
+	}
+}
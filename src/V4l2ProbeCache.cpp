@@ -0,0 +1,99 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2ProbeCache.cpp
+** 
+** Persistent cache of the capture modes enumerated on a device
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <sstream>
+
+#include "logger.h"
+#include "V4l2ProbeCache.h"
+
+#define V4L2_PROBE_CACHE_VERSION 1
+
+std::string V4l2ProbeCache::key(const struct v4l2_capability & cap)
+{
+	std::ostringstream os;
+	os << cap.driver << "_" << cap.card << "_" << cap.bus_info << "_" << std::hex << cap.version << "_" << cap.capabilities;
+	// keep it usable as a file name
+	std::string key = os.str();
+	for (size_t i = 0; i < key.size(); ++i)
+	{
+		char c = key[i];
+		if (!isalnum(c) && c != '_' && c != '-' && c != '.')
+			key[i] = '-';
+	}
+	return key;
+}
+
+std::string V4l2ProbeCache::path(const std::string & key)
+{
+	const char* dir = getenv("V4L2CPP_CACHE_DIR");
+	std::string path = dir ? dir : "/tmp/v4l2cpp";
+	mkdir(path.c_str(), 0755);
+	return path + "/" + key;
+}
+
+bool V4l2ProbeCache::load(const std::string & key, std::list<V4l2Mode> & modes)
+{
+	FILE* file = fopen(path(key).c_str(), "r");
+	if (file == NULL)
+		return false;
+
+	modes.clear();
+	int version = 0;
+	bool valid = (fscanf(file, "v4l2cpp-probe %d\n", &version) == 1) && (version == V4L2_PROBE_CACHE_VERSION);
+	V4l2Mode mode;
+	while (valid && (fscanf(file, "%x %u %u %u %u\n", &mode.m_format, &mode.m_width, &mode.m_height, &mode.m_numerator, &mode.m_denominator) == 5))
+	{
+		modes.push_back(mode);
+	}
+	valid = valid && feof(file) && !modes.empty();
+	fclose(file);
+	if (!valid)
+	{
+		modes.clear();
+	}
+	return valid;
+}
+
+bool V4l2ProbeCache::store(const std::string & key, const std::list<V4l2Mode> & modes)
+{
+	// write then rename, a concurrent open never sees a partial file
+	std::string target = path(key);
+	std::ostringstream tmp;
+	tmp << target << "." << getpid();
+	FILE* file = fopen(tmp.str().c_str(), "w");
+	if (file == NULL)
+	{
+		LOG(WARN) << "Cannot write probe cache:" << tmp.str();
+		return false;
+	}
+	fprintf(file, "v4l2cpp-probe %d\n", V4L2_PROBE_CACHE_VERSION);
+	for (std::list<V4l2Mode>::const_iterator it = modes.begin(); it != modes.end(); ++it)
+	{
+		fprintf(file, "%x %u %u %u %u\n", it->m_format, it->m_width, it->m_height, it->m_numerator, it->m_denominator);
+	}
+	bool success = (fclose(file) == 0) && (rename(tmp.str().c_str(), target.c_str()) == 0);
+	if (!success)
+	{
+		unlink(tmp.str().c_str());
+	}
+	return success;
+}
+
+void V4l2ProbeCache::invalidate(const std::string & key)
+{
+	unlink(path(key).c_str());
+}
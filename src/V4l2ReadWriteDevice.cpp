@@ -10,6 +10,7 @@
 ** -------------------------------------------------------------------------*/
 
 #include <unistd.h>
+#include <time.h>
 
 #include "V4l2ReadWriteDevice.h"
 
@@ -22,7 +23,17 @@ size_t V4l2ReadWriteDevice::writeInternal(char* buffer, size_t bufferSize) {
 }
 
 size_t V4l2ReadWriteDevice::readInternal(char* buffer, size_t bufferSize)  { 
-	return ::read(m_fd, buffer,  bufferSize); 
+	size_t size = ::read(m_fd, buffer,  bufferSize); 
+	if (size != (size_t)-1) {
+		// read() gives no buffer metadata, stamp the frame on arrival
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timeval timestamp;
+		timestamp.tv_sec = now.tv_sec;
+		timestamp.tv_usec = now.tv_nsec / 1000;
+		this->frameDequeued(timestamp, m_sequence + 1);
+	}
+	return size;
 }
 		
 	
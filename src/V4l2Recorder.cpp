@@ -0,0 +1,163 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2Recorder.cpp
+** 
+** Raw V4L2 frame recorder
+**
+** -------------------------------------------------------------------------*/
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#include "logger.h"
+#include "V4l2Device.h"
+#include "V4l2Recorder.h"
+
+// -----------------------------------------
+//    create recorder
+// -----------------------------------------
+V4l2Recorder* V4l2Recorder::create(const std::string & path, unsigned int format, unsigned int width, unsigned int height)
+{
+	int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd == -1)
+	{
+		LOG(ERROR) << "Cannot create recording:" << path << " " << strerror(errno);
+		return NULL;
+	}
+	V4l2Recorder* recorder = new V4l2Recorder(fd, path, format, width, height);
+	if (!recorder->mapWindow(0) || !recorder->append(&recorder->m_header, sizeof(recorder->m_header)))
+	{
+		LOG(ERROR) << "Cannot write recording header:" << path;
+		delete recorder;
+		recorder = NULL;
+	}
+	return recorder;
+}
+
+// -----------------------------------------
+//    constructor
+// -----------------------------------------
+V4l2Recorder::V4l2Recorder(int fd, const std::string & path, unsigned int format, unsigned int width, unsigned int height)
+	: m_fd(fd), m_path(path), m_window(NULL), m_windowOffset(0), m_offset(0)
+{
+	memset(&m_header, 0, sizeof(m_header));
+	m_header.magic = V4L2REC_MAGIC;
+	m_header.version = V4L2REC_VERSION;
+	m_header.format = format;
+	m_header.width = width;
+	m_header.height = height;
+}
+
+// -----------------------------------------
+//    destructor
+// -----------------------------------------
+V4l2Recorder::~V4l2Recorder()
+{
+	if (m_window)
+	{
+		munmap(m_window, V4L2REC_WINDOW);
+	}
+	// the last window was allocated in full
+	if (ftruncate(m_fd, m_offset) == -1)
+	{
+		LOG(ERROR) << "Cannot truncate recording:" << m_path << " " << strerror(errno);
+	}
+	// header is rewritten at the end with the final frame count and largest payload
+	if (pwrite(m_fd, &m_header, sizeof(m_header), 0) != sizeof(m_header))
+	{
+		LOG(ERROR) << "Cannot update recording header:" << m_path << " " << strerror(errno);
+	}
+	LOG(NOTICE) << "Recording " << m_path << " frames:" << m_header.nbFrames;
+	::close(m_fd);
+}
+
+// -----------------------------------------
+//    allocate the disk space of a window and map it
+// -----------------------------------------
+bool V4l2Recorder::mapWindow(uint64_t offset)
+{
+	if (m_window)
+	{
+		// dirty pages stay in the page cache, the kernel writes them back
+		munmap(m_window, V4L2REC_WINDOW);
+		m_window = NULL;
+	}
+	if (fallocate(m_fd, 0, offset, V4L2REC_WINDOW) == -1)
+	{
+		if (errno != EOPNOTSUPP)
+		{
+			LOG(ERROR) << "Cannot grow recording:" << m_path << " " << strerror(errno);
+			return false;
+		}
+		// no preallocation on this filesystem, a full disk would then raise SIGBUS on the mapping
+		if (ftruncate(m_fd, offset + V4L2REC_WINDOW) == -1)
+		{
+			LOG(ERROR) << "Cannot grow recording:" << m_path << " " << strerror(errno);
+			return false;
+		}
+	}
+	void* window = mmap(NULL, V4L2REC_WINDOW, PROT_WRITE, MAP_SHARED, m_fd, offset);
+	if (window == MAP_FAILED)
+	{
+		LOG(ERROR) << "Cannot map recording:" << m_path << " " << strerror(errno);
+		return false;
+	}
+	m_window = (char*)window;
+	m_windowOffset = offset;
+	return true;
+}
+
+bool V4l2Recorder::append(const void* data, size_t size)
+{
+	const char* ptr = (const char*)data;
+	while (size > 0)
+	{
+		uint64_t windowOffset = m_offset - m_offset % V4L2REC_WINDOW;
+		if ( (m_window == NULL) || (windowOffset != m_windowOffset) )
+		{
+			if (!this->mapWindow(windowOffset))
+				return false;
+		}
+		size_t len = std::min(size, (size_t)(m_windowOffset + V4L2REC_WINDOW - m_offset));
+		memcpy(m_window + (m_offset - m_windowOffset), ptr, len);
+		ptr += len;
+		size -= len;
+		m_offset += len;
+	}
+	return true;
+}
+
+// -----------------------------------------
+//    append one frame
+// -----------------------------------------
+bool V4l2Recorder::write(const char* buffer, size_t size, const timeval & timestamp, unsigned int sequence)
+{
+	V4l2RecordingFrame frame;
+	frame.timestamp = (uint64_t)timestamp.tv_sec * 1000000 + timestamp.tv_usec;
+	frame.sequence = sequence;
+	frame.size = size;
+
+	static const char padding[8] = {0};
+	uint64_t start = m_offset;
+	if (!this->append(&frame, sizeof(frame)) || !this->append(buffer, size) || !this->append(padding, (8 - size % 8) % 8))
+	{
+		// the partial frame is cut when the file is truncated
+		m_offset = start;
+		LOG_EVERY_MS(ERROR, 1000) << "Cannot write frame to recording:" << m_path;
+		return false;
+	}
+	m_header.nbFrames++;
+	if (size > m_header.bufferSize)
+	{
+		m_header.bufferSize = size;
+	}
+	return true;
+}
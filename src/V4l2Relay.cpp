@@ -0,0 +1,142 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2Relay.cpp
+**
+** Publishes BGR images on a V4L2 output device (v4l2loopback)
+**
+** -------------------------------------------------------------------------*/
+
+#include <sys/time.h>
+
+#include <algorithm>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "logger.h"
+#include "V4l2ConvertKernels.h"
+#include "V4l2Relay.h"
+
+static V4l2RelayConvertFunction findConverter(unsigned int format)
+{
+	switch (format)
+	{
+		case V4L2_PIX_FMT_YUYV: return convertBGRToYUYV;
+		case V4L2_PIX_FMT_UYVY: return convertBGRToUYVY;
+		case V4L2_PIX_FMT_NV12: return convertBGRToNV12;
+		case V4L2_PIX_FMT_NV21: return convertBGRToNV21;
+		default: return NULL;
+	}
+}
+
+// -----------------------------------------
+//    create relay
+// -----------------------------------------
+V4l2Relay* V4l2Relay::create(const std::string & device, unsigned int width, unsigned int height, unsigned int format, int fps, V4l2Access::IoType iotype)
+{
+	if (findConverter(format) == NULL)
+	{
+		LOG(ERROR) << "Relay format not supported:" << fourcc(format);
+		return NULL;
+	}
+	// 4:2:2 and 4:2:0 need even sizes
+	V4L2DeviceParameters param(device.c_str(), format, width & ~1u, height & ~1u, fps);
+	// the modes of a loopback device follow its writer, not worth caching
+	param.m_probeCache = false;
+	V4l2Output* output = V4l2Output::create(param, iotype);
+	if (output == NULL)
+	{
+		LOG(ERROR) << "Cannot open relay device:" << device;
+		return NULL;
+	}
+	// the driver may have adjusted the format, the frames are converted to what it accepted
+	V4l2RelayConvertFunction convert = findConverter(output->getFormat());
+	if ( (convert == NULL) || (output->getWidth() < 2) || (output->getHeight() < 2) )
+	{
+		LOG(ERROR) << "Relay device " << device << " refused " << fourcc(format) << " " << width << "x" << height
+			<< ", got " << fourcc(output->getFormat()) << " " << output->getWidth() << "x" << output->getHeight();
+		delete output;
+		return NULL;
+	}
+	LOG(NOTICE) << "Relay " << device << " " << fourcc(output->getFormat()) << " " << output->getWidth() << "x" << output->getHeight()
+		<< " stride:" << output->getBytesPerLine() << (iotype == V4l2Access::IOTYPE_MMAP ? " mmap" : " read/write");
+	return new V4l2Relay(output, convert, iotype == V4l2Access::IOTYPE_MMAP);
+}
+
+// -----------------------------------------
+//    constructor
+// -----------------------------------------
+V4l2Relay::V4l2Relay(V4l2Output* output, V4l2RelayConvertFunction convert, bool zeroCopy)
+	: m_output(output), m_convert(convert), m_zeroCopy(zeroCopy), m_width(output->getWidth() & ~1u), m_height(output->getHeight() & ~1u), m_written(0), m_dropped(0)
+{
+	unsigned int stride = output->getBytesPerLine();
+	bool packed = (output->getFormat() == V4L2_PIX_FMT_YUYV) || (output->getFormat() == V4L2_PIX_FMT_UYVY);
+	size_t minimum = packed ? (size_t)(stride ? stride : m_width * 2) * m_height : (size_t)(stride ? stride : m_width) * m_height * 3 / 2;
+	m_frameSize = std::max((size_t)output->getBufferSize(), minimum);
+	if (!m_zeroCopy)
+	{
+		m_buffer.resize(m_frameSize);
+	}
+}
+
+// -----------------------------------------
+//    destructor
+// -----------------------------------------
+V4l2Relay::~V4l2Relay()
+{
+	LOG(NOTICE) << "Relay frames:" << m_written << " dropped:" << m_dropped;
+	delete m_output;
+}
+
+// -----------------------------------------
+//    convert a frame into a free buffer, never wait for the consumer
+// -----------------------------------------
+bool V4l2Relay::write(const cv::Mat & image)
+{
+	if (image.empty() || (image.type() != CV_8UC3))
+	{
+		return false;
+	}
+	// no buffer given back by the driver yet: the consumer is late, drop rather than wait
+	timeval tv = { 0, 0 };
+	if (m_output->isWritable(&tv) <= 0)
+	{
+		m_dropped++;
+		return false;
+	}
+
+	const cv::Mat* frame = &image;
+	if ( (image.cols != (int)m_width) || (image.rows != (int)m_height) )
+	{
+		cv::resize(image, m_scaled, cv::Size(m_width, m_height), 0, 0, cv::INTER_AREA);
+		frame = &m_scaled;
+	}
+
+	bool written = false;
+	if (m_zeroCopy)
+	{
+		V4l2Planes planes;
+		if (m_output->startWrite(planes))
+		{
+			m_convert(*frame, planes, m_width, m_height);
+			written = m_output->endWrite(m_frameSize);
+		}
+	}
+	else
+	{
+		V4l2Planes planes;
+		planes.m_count = 1;
+		planes.m_data[0] = m_buffer.data();
+		planes.m_size[0] = m_buffer.size();
+		planes.m_stride[0] = m_output->getBytesPerLine();
+		m_convert(*frame, planes, m_width, m_height);
+		written = (m_output->write(m_buffer.data(), m_buffer.size()) == m_buffer.size());
+	}
+	if (written)
+		m_written++;
+	else
+		m_dropped++;
+	return written;
+}
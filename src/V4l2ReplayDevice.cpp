@@ -0,0 +1,270 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2ReplayDevice.cpp
+** 
+** V4L2 source replaying a V4l2Recorder file
+**
+** -------------------------------------------------------------------------*/
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include "logger.h"
+#include "V4l2Recorder.h"
+#include "V4l2ReplayDevice.h"
+#include "V4l2H264Decoder.h"
+
+// frame rate assumed for the timestamps of a raw H.264 stream
+#define V4L2REPLAY_ES_FPS 30
+
+V4l2ReplayDevice::V4l2ReplayDevice(const V4L2DeviceParameters & params) : V4l2Device(params, V4L2_BUF_TYPE_VIDEO_CAPTURE), m_data(NULL), m_dataSize(0), m_current(0), m_firstTimestamp(0)
+{
+	memset(&m_startTime, 0, sizeof(m_startTime));
+}
+
+V4l2ReplayDevice::~V4l2ReplayDevice()
+{
+	if (m_data)
+	{
+		munmap(m_data, m_dataSize);
+	}
+}
+
+// map the recording and index its frames
+bool V4l2ReplayDevice::init(unsigned int)
+{
+	int fd = open(m_params.m_devName.c_str(), O_RDONLY);
+	if (fd == -1)
+	{
+		LOG(ERROR) << "Cannot open recording:" << m_params.m_devName << " " << strerror(errno);
+		return false;
+	}
+	struct stat sb;
+	if ( (fstat(fd, &sb) == 0) && (sb.st_size > 0) )
+	{
+		m_dataSize = sb.st_size;
+		m_data = (char*)mmap(NULL, m_dataSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (m_data == MAP_FAILED)
+		{
+			LOG(ERROR) << "Cannot map recording:" << m_params.m_devName << " " << strerror(errno);
+			m_data = NULL;
+		}
+	}
+	::close(fd);
+	if (m_data == NULL)
+	{
+		return false;
+	}
+	madvise(m_data, m_dataSize, MADV_SEQUENTIAL);
+
+	size_t codeLength = 0;
+	const V4l2RecordingHeader* header = (const V4l2RecordingHeader*)m_data;
+	bool indexed = false;
+	if ( (m_dataSize >= sizeof(V4l2RecordingHeader)) && (header->magic == V4L2REC_MAGIC) && (header->version == V4L2REC_VERSION) )
+	{
+		indexed = this->indexRecording();
+	}
+	else if (V4l2H264Decoder::nextStartCode((const unsigned char*)m_data, m_dataSize, 0, &codeLength) == 0)
+	{
+		indexed = this->indexElementaryStream();
+	}
+	else
+	{
+		LOG(ERROR) << "Not a recording:" << m_params.m_devName;
+	}
+	if (!indexed)
+	{
+		return false;
+	}
+	snprintf((char*)bus_info, sizeof(bus_info), "replay:%s", m_params.m_devName.c_str());
+	LOG(NOTICE) << m_params.m_devName << ": " << fourcc(m_format) << " frames:" << m_frames.size() << " size:" << m_width << "x" << m_height << " bufferSize:" << m_bufferSize;
+
+	m_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (m_fd == -1)
+	{
+		LOG(ERROR) << "Cannot create timer " << strerror(errno);
+		return false;
+	}
+	return this->start();
+}
+
+// index the frames of a V4l2Recorder file, the header count is not trusted in case recording was interrupted
+bool V4l2ReplayDevice::indexRecording()
+{
+	const V4l2RecordingHeader* header = (const V4l2RecordingHeader*)m_data;
+	m_format = header->format;
+	m_width = header->width;
+	m_height = header->height;
+	m_bufferSize = header->bufferSize;
+
+	m_frames.reserve(header->nbFrames);
+	size_t offset = sizeof(V4l2RecordingHeader);
+	while (offset + sizeof(V4l2RecordingFrame) <= m_dataSize)
+	{
+		const V4l2RecordingFrame* recorded = (const V4l2RecordingFrame*)(m_data + offset);
+		size_t next = offset + sizeof(V4l2RecordingFrame) + recorded->size;
+		if (next > m_dataSize)
+			break;
+		Frame frame = { offset + sizeof(V4l2RecordingFrame), recorded->size, recorded->timestamp, recorded->sequence };
+		m_frames.push_back(frame);
+		if (recorded->size > m_bufferSize)
+			m_bufferSize = recorded->size;
+		offset = next + (8 - recorded->size % 8) % 8;
+	}
+	return true;
+}
+
+// split an H.264 Annex B stream in access units, the size comes from the first SPS
+bool V4l2ReplayDevice::indexElementaryStream()
+{
+	const unsigned char* data = (const unsigned char*)m_data;
+	m_format = V4L2_PIX_FMT_H264;
+	m_width = 0;
+	m_height = 0;
+	m_bufferSize = 0;
+
+	size_t codeLength = 0;
+	size_t start = V4l2H264Decoder::nextStartCode(data, m_dataSize, 0, &codeLength);
+	size_t unitStart = start;
+	bool hasSlice = false;
+	while (start < m_dataSize)
+	{
+		size_t nal = start + codeLength;
+		size_t next = V4l2H264Decoder::nextStartCode(data, m_dataSize, nal, &codeLength);
+		if (nal < next)
+		{
+			int type = data[nal] & 0x1f;
+			if ( (type == 7) && (m_width == 0) && !V4l2H264Decoder::parseSpsSize(data + nal, next - nal, m_width, m_height) )
+			{
+				LOG(WARN) << m_params.m_devName << ": cannot parse the SPS, unknown picture size";
+			}
+			bool slice = (type == 1) || (type == 5);
+			// first_mb_in_slice == 0 is coded as a single 1 bit
+			bool firstSlice = slice && (nal + 1 < next) && (data[nal + 1] & 0x80);
+			// AUD, SEI, SPS, PPS or a new picture after a slice start the next access unit
+			if (hasSlice && (firstSlice || (type == 6) || (type == 7) || (type == 8) || (type == 9)))
+			{
+				Frame frame = { unitStart, start - unitStart, 0, 0 };
+				m_frames.push_back(frame);
+				unitStart = start;
+				hasSlice = false;
+			}
+			hasSlice = hasSlice || slice;
+		}
+		start = next;
+	}
+	if (hasSlice)
+	{
+		Frame frame = { unitStart, m_dataSize - unitStart, 0, 0 };
+		m_frames.push_back(frame);
+	}
+
+	// no timing in a raw stream
+	for (size_t i = 0; i < m_frames.size(); ++i)
+	{
+		m_frames[i].timestamp = i * 1000000ULL / V4L2REPLAY_ES_FPS;
+		m_frames[i].sequence = i;
+		if (m_frames[i].size > m_bufferSize)
+			m_bufferSize = m_frames[i].size;
+	}
+	return !m_frames.empty();
+}
+
+bool V4l2ReplayDevice::start()
+{
+	m_current = 0;
+	clock_gettime(CLOCK_MONOTONIC, &m_startTime);
+	if (!m_frames.empty())
+	{
+		m_firstTimestamp = m_frames[0].timestamp;
+	}
+	return this->armTimer();
+}
+
+// program the timer for the due time of the current frame
+bool V4l2ReplayDevice::armTimer()
+{
+	bool immediate = (m_params.m_fps < 0) || (m_current >= m_frames.size());
+	uint64_t delay = 0; // ns after start
+	if (immediate)
+	{
+	}
+	else if (m_params.m_fps > 0)
+	{
+		delay = m_current * 1000000000ULL / m_params.m_fps;
+	}
+	else if (m_params.m_fps == 0)
+	{
+		delay = (m_frames[m_current].timestamp - m_firstTimestamp) * 1000;
+	}
+
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+	if (immediate)
+	{
+		// already elapsed absolute time, fires immediately (also used to report the end of the recording)
+		clock_gettime(CLOCK_MONOTONIC, &spec.it_value);
+	}
+	else
+	{
+		uint64_t ns = m_startTime.tv_nsec + delay;
+		spec.it_value.tv_sec = m_startTime.tv_sec + ns / 1000000000ULL;
+		spec.it_value.tv_nsec = ns % 1000000000ULL;
+	}
+	if (timerfd_settime(m_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+	{
+		LOG(ERROR) << "Cannot arm timer " << strerror(errno);
+		return false;
+	}
+	return true;
+}
+
+size_t V4l2ReplayDevice::readInternal(char* buffer, size_t bufferSize)
+{
+	if (m_current >= m_frames.size())
+	{
+		LOG(NOTICE) << m_params.m_devName << ": end of recording";
+		return -1;
+	}
+
+	// wait for the frame to be due, as a real device would
+	uint64_t expirations = 0;
+	while (::read(m_fd, &expirations, sizeof(expirations)) == -1)
+	{
+		if (errno != EAGAIN)
+		{
+			return -1;
+		}
+		struct pollfd pfd = { m_fd, POLLIN, 0 };
+		poll(&pfd, 1, -1);
+	}
+
+	const Frame & frame = m_frames[m_current];
+	size_t size = frame.size;
+	if (size > bufferSize)
+	{
+		size = bufferSize;
+		LOG_EVERY_MS(WARN, 1000) << "Device " << m_params.m_devName << " buffer truncated available:" << bufferSize << " needed:" << frame.size;
+	}
+	memcpy(buffer, m_data + frame.offset, size);
+
+	// timestamp is the replay time so latency measurements stay meaningful, sequence is the recorded one
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timeval timestamp;
+	timestamp.tv_sec = now.tv_sec;
+	timestamp.tv_usec = now.tv_nsec / 1000;
+	this->frameDequeued(timestamp, frame.sequence);
+
+	m_current++;
+	this->armTimer();
+	return size;
+}
@@ -0,0 +1,324 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2Supervisor.cpp
+**
+** Capture that survives camera disconnects and stream errors
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+
+#include <algorithm>
+
+#include <linux/videodev2.h>
+
+#include "logger.h"
+#include "V4l2Supervisor.h"
+
+static double nowMs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// bus info of a capture node, empty when it is not one (metadata node, output, gone)
+static std::string captureBusInfo(const std::string & path)
+{
+	int fd = open(path.c_str(), O_RDWR | O_NONBLOCK);
+	if (fd == -1)
+		return std::string();
+	struct v4l2_capability cap;
+	memset(&cap, 0, sizeof(cap));
+	std::string busInfo;
+	if (ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0)
+	{
+		unsigned int caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+		if (caps & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE))
+			busInfo = std::string((const char*)cap.bus_info, strnlen((const char*)cap.bus_info, sizeof(cap.bus_info)));
+	}
+	close(fd);
+	return busInfo;
+}
+
+// -----------------------------------------
+//    create supervised capture
+// -----------------------------------------
+V4l2Supervisor* V4l2Supervisor::create(const V4L2DeviceParameters & param, V4l2Access::IoType iotype, unsigned int timeoutMs)
+{
+	V4l2Capture* capture = V4l2Capture::create(param, iotype);
+	if (capture == NULL)
+	{
+		return NULL;
+	}
+	// the next opens ask directly for the mode negotiated now
+	V4L2DeviceParameters pinned(param);
+	pinned.m_modeSelector = NULL;
+	if (iotype != V4l2Access::IOTYPE_REPLAY)
+	{
+		pinned.m_formatList.assign(1, capture->getFormat());
+		pinned.m_width = capture->getWidth();
+		pinned.m_height = capture->getHeight();
+		if (capture->getConfiguredFps() > 0)
+			pinned.m_fps = (int)(capture->getConfiguredFps() + 0.5);
+	}
+	return new V4l2Supervisor(pinned, iotype, capture, timeoutMs);
+}
+
+// -----------------------------------------
+//    constructor
+// -----------------------------------------
+V4l2Supervisor::V4l2Supervisor(const V4L2DeviceParameters & param, V4l2Access::IoType iotype, V4l2Capture* capture, unsigned int timeoutMs)
+	: m_params(param), m_iotype(iotype), m_capture(capture), m_sink(NULL), m_timeoutMs(timeoutMs), m_inotify(-1),
+	  m_lastFrame(nowMs()), m_failure(0), m_found(0), m_nextAttempt(0)
+{
+	if (m_iotype != V4l2Access::IOTYPE_REPLAY)
+	{
+		m_busInfo = m_capture->getBusInfo();
+		// creation of the nodes, and udev setting their permissions just after
+		m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if ( (m_inotify != -1) && (inotify_add_watch(m_inotify, "/dev", IN_CREATE | IN_ATTRIB) == -1) )
+		{
+			LOG(WARN) << "Cannot watch /dev: " << strerror(errno) << ", polling every " << RETRY_MS << "ms";
+			close(m_inotify);
+			m_inotify = -1;
+		}
+	}
+}
+
+// -----------------------------------------
+//    destructor
+// -----------------------------------------
+V4l2Supervisor::~V4l2Supervisor()
+{
+	delete m_capture;
+	if (m_inotify != -1)
+	{
+		close(m_inotify);
+	}
+}
+
+void V4l2Supervisor::setSink(V4l2FrameSink* sink)
+{
+	m_sink = sink;
+	if (m_capture)
+	{
+		m_capture->setSink(sink);
+	}
+}
+
+// -----------------------------------------
+//    read a frame, or make progress on the recovery
+// -----------------------------------------
+int V4l2Supervisor::read(cv::Mat & image, unsigned int waitMs)
+{
+	image.release();
+	if (m_capture == NULL)
+	{
+		this->reconnect(waitMs);
+		return 0;
+	}
+
+	timeval tv;
+	tv.tv_sec = waitMs / 1000;
+	tv.tv_usec = (waitMs % 1000) * 1000;
+	int ret = m_capture->isReadable(&tv);
+	if ( (ret == -1) && (errno == EINTR) )
+	{
+		return 0;
+	}
+	if (m_iotype == V4l2Access::IOTYPE_REPLAY)
+	{
+		// nothing to recover, the end of the file is the end of the stream
+		if (ret == 1)
+		{
+			int status = m_capture->read(image);
+			return (status == -1) ? -1 : (status == 0) ? 1 : 0;
+		}
+		return (ret == 0) ? 0 : -1;
+	}
+
+	double now = nowMs();
+	if (ret == 1)
+	{
+		int status = m_capture->read(image);
+		if (status == 1)
+		{
+			// the device works, the decoder waits for an IDR: not a stall
+			m_lastFrame = now;
+			return 0;
+		}
+		if (status == 0)
+		{
+			m_lastFrame = now;
+			if (m_failure > 0)
+			{
+				V4l2Recovery recovery = { m_reason, m_params.m_devName, now - m_failure, now - m_found };
+				m_recoveries.push_back(recovery);
+				LOG(NOTICE) << "Capture recovered on " << m_params.m_devName << " after " << recovery.m_outageMs << "ms (" << m_reason
+					<< "), reopen to first frame " << recovery.m_reopenMs << "ms";
+				m_failure = 0;
+			}
+			return 1;
+		}
+		// the device logged the ioctl error
+		this->disconnect("read failed");
+	}
+	else if (ret == -1)
+	{
+		this->disconnect(std::string("select failed, ") + strerror(errno));
+	}
+	else if (now - m_lastFrame > m_timeoutMs)
+	{
+		// device still there but the stream stalled (firmware, bandwidth), a reopen restarts it
+		this->disconnect("no frame for " + std::to_string(m_timeoutMs) + "ms");
+	}
+	return 0;
+}
+
+// -----------------------------------------
+//    close at once, so that the kernel can release the node
+// -----------------------------------------
+void V4l2Supervisor::disconnect(const std::string & reason)
+{
+	if (m_failure == 0)
+	{
+		m_failure = nowMs();
+		m_reason = reason;
+	}
+	LOG(ERROR) << "Capture " << m_params.m_devName << " lost: " << reason;
+	delete m_capture;
+	m_capture = NULL;
+	// a stalled device is still there, try it again immediately
+	m_nextAttempt = 0;
+}
+
+bool V4l2Supervisor::reconnect(unsigned int waitMs)
+{
+	double deadline = nowMs() + waitMs;
+	while (true)
+	{
+		double now = nowMs();
+		if ( (now >= m_nextAttempt) && this->reopen() )
+		{
+			return true;
+		}
+		if (now >= m_nextAttempt)
+		{
+			m_nextAttempt = now + RETRY_MS;
+		}
+		if (now >= deadline)
+		{
+			return false;
+		}
+		// a new node wakes us up before the next periodic attempt
+		if (this->waitForDevice((unsigned int)(std::min(deadline, m_nextAttempt) - now)))
+		{
+			m_nextAttempt = 0;
+		}
+	}
+}
+
+bool V4l2Supervisor::reopen()
+{
+	std::string path = this->findDevice();
+	if (path.empty())
+	{
+		return false;
+	}
+	double found = nowMs();
+	V4L2DeviceParameters param(m_params);
+	param.m_devName = path;
+	V4l2Capture* capture = V4l2Capture::create(param, m_iotype);
+	if (capture == NULL)
+	{
+		// udev may not have set the permissions yet, the IN_ATTRIB event brings us back
+		return false;
+	}
+	if ( (capture->getFormat() != m_params.m_formatList.front()) || (capture->getWidth() != m_params.m_width) || (capture->getHeight() != m_params.m_height) )
+	{
+		LOG(WARN) << "Capture " << path << " reopened as " << fourcc(capture->getFormat()) << " " << capture->getWidth() << "x" << capture->getHeight()
+			<< " instead of " << fourcc(m_params.m_formatList.front()) << " " << m_params.m_width << "x" << m_params.m_height;
+	}
+	capture->setSink(m_sink);
+	m_capture = capture;
+	m_params.m_devName = path;
+	m_found = found;
+	// the stream gets the whole timeout to deliver its first frame
+	m_lastFrame = nowMs();
+	LOG(NOTICE) << "Capture reopened " << path << " in " << (m_lastFrame - found) << "ms";
+	return true;
+}
+
+// the node of the same camera: the previous path first, else any capture node on the same bus
+std::string V4l2Supervisor::findDevice()
+{
+	if (m_busInfo.empty())
+	{
+		return (access(m_params.m_devName.c_str(), F_OK) == 0) ? m_params.m_devName : std::string();
+	}
+	if (captureBusInfo(m_params.m_devName) == m_busInfo)
+	{
+		return m_params.m_devName;
+	}
+	std::string path;
+	DIR* dir = opendir("/dev");
+	if (dir == NULL)
+	{
+		return path;
+	}
+	struct dirent* entry;
+	while ( path.empty() && ((entry = readdir(dir)) != NULL) )
+	{
+		if (strncmp(entry->d_name, "video", 5) != 0)
+			continue;
+		std::string candidate = std::string("/dev/") + entry->d_name;
+		if ( (candidate != m_params.m_devName) && (captureBusInfo(candidate) == m_busInfo) )
+			path = candidate;
+	}
+	closedir(dir);
+	if (!path.empty())
+	{
+		LOG(NOTICE) << "Camera " << m_busInfo << " moved from " << m_params.m_devName << " to " << path;
+	}
+	return path;
+}
+
+// true when a video node was created or changed in /dev
+bool V4l2Supervisor::waitForDevice(unsigned int timeoutMs)
+{
+	if (m_inotify == -1)
+	{
+		usleep(timeoutMs * 1000);
+		return false;
+	}
+	struct pollfd fds = { m_inotify, POLLIN, 0 };
+	if (poll(&fds, 1, timeoutMs) <= 0)
+	{
+		return false;
+	}
+	bool video = false;
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = ::read(m_inotify, buffer, sizeof(buffer))) > 0)
+	{
+		for (char* ptr = buffer; ptr < buffer + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event*)ptr)->len)
+		{
+			const struct inotify_event* event = (const struct inotify_event*)ptr;
+			if ( (event->mask & IN_Q_OVERFLOW) || ((event->len > 0) && (strncmp(event->name, "video", 5) == 0)) )
+				video = true;
+		}
+	}
+	return video;
+}
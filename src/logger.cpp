@@ -10,5 +10,377 @@
 #include "logger.h"
 
 #ifndef HAVE_LOG4CPP
+
+#include <string.h>
+#include <time.h>
+#include <stdio.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
 int LogLevel=NOTICE;
+
+#define LOG_QUEUE_SIZE 4096 /* power of 2 */
+
+// argument encoding in LogRecord::payload: one tag byte followed by the value
+enum LogTag
+{
+	LOGTAG_SIGNED,    // int64_t
+	LOGTAG_UNSIGNED,  // uint64_t
+	LOGTAG_DOUBLE,    // double
+	LOGTAG_CHAR,      // char
+	LOGTAG_BOOL,      // char
+	LOGTAG_STRING,    // uint16_t length + bytes
+	LOGTAG_POINTER,   // const void*
+	LOGTAG_HEX,
+	LOGTAG_DEC,
+	LOGTAG_OCT,
+	LOGTAG_SUPPRESSED // uint64_t
+};
+
+static int64_t monotonicMs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// ---------------------------------
+// bounded multi producer queue (D. Vyukov) drained by a single background thread
+// ---------------------------------
+class AsyncLogger
+{
+	public:
+		static AsyncLogger& instance()
+		{
+			static AsyncLogger logger;
+			return logger;
+		}
+
+		void push(const LogRecord & record)
+		{
+			if (m_stopped)
+			{
+				// after exit started nobody drains the queue
+				std::lock_guard<std::mutex> guard(m_mutex);
+				this->format(record, std::cout);
+				std::cout.flush();
+				return;
+			}
+			Cell* cell = NULL;
+			size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+			for (;;)
+			{
+				cell = &m_cells[pos & (LOG_QUEUE_SIZE - 1)];
+				size_t seq = cell->sequence.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+				if (diff == 0)
+				{
+					if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+				{
+					m_dropped++;
+					return;
+				}
+				else
+				{
+					pos = m_enqueuePos.load(std::memory_order_relaxed);
+				}
+			}
+			memcpy(&cell->record, &record, offsetof(LogRecord, payload) + record.used);
+			// seq_cst on both sides (here and in run): the publish and the m_sleeping check must not be
+			// reordered, else the writer may go to sleep without seeing this record
+			cell->sequence.store(pos + 1, std::memory_order_seq_cst);
+
+			// only pay for a wakeup when the writer is actually sleeping
+			if (m_sleeping.load(std::memory_order_seq_cst))
+			{
+				std::lock_guard<std::mutex> guard(m_mutex);
+				m_cond.notify_one();
+			}
+		}
+
+	private:
+		AsyncLogger() : m_enqueuePos(0), m_dequeuePos(0), m_dropped(0), m_sleeping(false), m_stop(false), m_stopped(false)
+		{
+			for (size_t i = 0; i < LOG_QUEUE_SIZE; ++i)
+			{
+				m_cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+			m_thread = std::thread(&AsyncLogger::run, this);
+		}
+
+		~AsyncLogger()
+		{
+			m_stop = true;
+			{
+				std::lock_guard<std::mutex> guard(m_mutex);
+				m_cond.notify_one();
+			}
+			m_thread.join();
+			m_stopped = true;
+		}
+
+		bool pop(LogRecord & record)
+		{
+			Cell* cell = &m_cells[m_dequeuePos & (LOG_QUEUE_SIZE - 1)];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			if ((intptr_t)seq - (intptr_t)(m_dequeuePos + 1) < 0)
+				return false;
+			memcpy(&record, &cell->record, offsetof(LogRecord, payload) + cell->record.used);
+			cell->sequence.store(m_dequeuePos + LOG_QUEUE_SIZE, std::memory_order_release);
+			m_dequeuePos++;
+			return true;
+		}
+
+		void run()
+		{
+			LogRecord record;
+			std::ostringstream out;
+			for (;;)
+			{
+				bool empty = true;
+				while (this->pop(record))
+				{
+					this->format(record, out);
+					empty = false;
+				}
+				unsigned long dropped = m_dropped.exchange(0);
+				if (dropped)
+				{
+					out << "\n[WARN] logger queue full, " << dropped << " messages dropped";
+				}
+				if (!empty || dropped)
+				{
+					std::lock_guard<std::mutex> guard(m_mutex);
+					std::cout << out.str();
+					std::cout.flush();
+					out.str("");
+				}
+				if (empty)
+				{
+					if (m_stop)
+						break;
+					std::unique_lock<std::mutex> guard(m_mutex);
+					m_sleeping.store(true, std::memory_order_seq_cst);
+					// re-check after publishing m_sleeping so a concurrent push is not missed
+					Cell* cell = &m_cells[m_dequeuePos & (LOG_QUEUE_SIZE - 1)];
+					if ((intptr_t)cell->sequence.load(std::memory_order_seq_cst) - (intptr_t)(m_dequeuePos + 1) < 0 && !m_stop)
+					{
+						m_cond.wait_for(guard, std::chrono::milliseconds(100));
+					}
+					m_sleeping.store(false, std::memory_order_relaxed);
+				}
+			}
+		}
+
+		void format(const LogRecord & record, std::ostream & out)
+		{
+			out << "\n[" << record.level << "] " << record.file << ":" << record.line << "\n\t";
+			std::ios_base::fmtflags flags = out.flags();
+			const char* ptr = record.payload;
+			const char* end = record.payload + record.used;
+			while (ptr < end)
+			{
+				char tag = *ptr++;
+				switch (tag)
+				{
+					case LOGTAG_SIGNED:    { int64_t v;  memcpy(&v, ptr, sizeof(v)); ptr += sizeof(v); out << v; } break;
+					case LOGTAG_UNSIGNED:  { uint64_t v; memcpy(&v, ptr, sizeof(v)); ptr += sizeof(v); out << v; } break;
+					case LOGTAG_DOUBLE:    { double v;   memcpy(&v, ptr, sizeof(v)); ptr += sizeof(v); out << v; } break;
+					case LOGTAG_CHAR:      out << *ptr++; break;
+					case LOGTAG_BOOL:      out << (*ptr++ ? "true" : "false"); break;
+					case LOGTAG_STRING:    { uint16_t len; memcpy(&len, ptr, sizeof(len)); ptr += sizeof(len); out.write(ptr, len); ptr += len; } break;
+					case LOGTAG_POINTER:   { const void* v; memcpy(&v, ptr, sizeof(v)); ptr += sizeof(v); out << v; } break;
+					case LOGTAG_HEX:       out << std::hex; break;
+					case LOGTAG_DEC:       out << std::dec; break;
+					case LOGTAG_OCT:       out << std::oct; break;
+					case LOGTAG_SUPPRESSED:{ uint64_t v; memcpy(&v, ptr, sizeof(v)); ptr += sizeof(v); out << "(" << v << " similar messages suppressed) "; } break;
+					default: ptr = end; break;
+				}
+			}
+			out.flags(flags);
+		}
+
+	private:
+		struct Cell
+		{
+			std::atomic<size_t> sequence;
+			LogRecord record;
+		};
+		Cell m_cells[LOG_QUEUE_SIZE];
+		std::atomic<size_t> m_enqueuePos;
+		size_t m_dequeuePos;
+		std::atomic<unsigned long> m_dropped;
+		std::atomic<bool> m_sleeping;
+		std::atomic<bool> m_stop;
+		std::atomic<bool> m_stopped;
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::thread m_thread;
+};
+
+// -----------------------------------------
+//    LogRateLimiter
+// -----------------------------------------
+bool LogRateLimiter::allow(int ms)
+{
+	int64_t now = monotonicMs();
+	int64_t next = m_next.load(std::memory_order_relaxed);
+	if ( (now >= next) && m_next.compare_exchange_strong(next, now + ms) )
+	{
+		return true;
+	}
+	m_suppressed++;
+	return false;
+}
+
+// -----------------------------------------
+//    LogStream
+// -----------------------------------------
+LogStream::LogStream(const char* level, const char* file, int line)
+{
+	m_record.level = level;
+	m_record.file = file;
+	m_record.line = line;
+	m_record.used = 0;
+}
+
+LogStream::~LogStream()
+{
+	AsyncLogger::instance().push(m_record);
+}
+
+bool LogStream::reserve(size_t size)
+{
+	return m_record.used + size <= sizeof(m_record.payload);
+}
+
+LogStream& LogStream::putSigned(long long value)
+{
+	int64_t v = value;
+	if (this->reserve(1 + sizeof(v)))
+	{
+		m_record.payload[m_record.used++] = LOGTAG_SIGNED;
+		memcpy(m_record.payload + m_record.used, &v, sizeof(v));
+		m_record.used += sizeof(v);
+	}
+	return *this;
+}
+
+LogStream& LogStream::putUnsigned(unsigned long long value)
+{
+	uint64_t v = value;
+	if (this->reserve(1 + sizeof(v)))
+	{
+		m_record.payload[m_record.used++] = LOGTAG_UNSIGNED;
+		memcpy(m_record.payload + m_record.used, &v, sizeof(v));
+		m_record.used += sizeof(v);
+	}
+	return *this;
+}
+
+LogStream& LogStream::putDouble(double value)
+{
+	if (this->reserve(1 + sizeof(value)))
+	{
+		m_record.payload[m_record.used++] = LOGTAG_DOUBLE;
+		memcpy(m_record.payload + m_record.used, &value, sizeof(value));
+		m_record.used += sizeof(value);
+	}
+	return *this;
+}
+
+LogStream& LogStream::putString(const char* value, size_t length)
+{
+	// long strings are truncated to what is left in the record
+	if (this->reserve(1 + sizeof(uint16_t)))
+	{
+		uint16_t len = std::min(length, sizeof(m_record.payload) - m_record.used - 1 - sizeof(uint16_t));
+		m_record.payload[m_record.used++] = LOGTAG_STRING;
+		memcpy(m_record.payload + m_record.used, &len, sizeof(len));
+		m_record.used += sizeof(len);
+		memcpy(m_record.payload + m_record.used, value, len);
+		m_record.used += len;
+	}
+	return *this;
+}
+
+LogStream& LogStream::operator<<(bool value)
+{
+	if (this->reserve(2))
+	{
+		m_record.payload[m_record.used++] = LOGTAG_BOOL;
+		m_record.payload[m_record.used++] = value;
+	}
+	return *this;
+}
+
+LogStream& LogStream::operator<<(char value)
+{
+	if (this->reserve(2))
+	{
+		m_record.payload[m_record.used++] = LOGTAG_CHAR;
+		m_record.payload[m_record.used++] = value;
+	}
+	return *this;
+}
+
+LogStream& LogStream::operator<<(const char* value)
+{
+	if (value == NULL)
+		return this->putString("(null)", 6);
+	return this->putString(value, strlen(value));
+}
+
+LogStream& LogStream::operator<<(const std::string & value)
+{
+	return this->putString(value.c_str(), value.size());
+}
+
+LogStream& LogStream::operator<<(const void* value)
+{
+	if (this->reserve(1 + sizeof(value)))
+	{
+		m_record.payload[m_record.used++] = LOGTAG_POINTER;
+		memcpy(m_record.payload + m_record.used, &value, sizeof(value));
+		m_record.used += sizeof(value);
+	}
+	return *this;
+}
+
+LogStream& LogStream::operator<<(std::ios_base& (*manip)(std::ios_base&))
+{
+	char tag = -1;
+	if (manip == static_cast<std::ios_base& (*)(std::ios_base&)>(std::hex)) tag = LOGTAG_HEX;
+	else if (manip == static_cast<std::ios_base& (*)(std::ios_base&)>(std::dec)) tag = LOGTAG_DEC;
+	else if (manip == static_cast<std::ios_base& (*)(std::ios_base&)>(std::oct)) tag = LOGTAG_OCT;
+	if ( (tag != -1) && this->reserve(1) )
+	{
+		m_record.payload[m_record.used++] = tag;
+	}
+	return *this;
+}
+
+LogStream& LogStream::operator<<(std::ostream& (*)(std::ostream&))
+{
+	// std::endl and friends, every record already ends a line
+	return *this;
+}
+
+LogStream& LogStream::operator<<(const LogSuppressed & value)
+{
+	if ( (value.m_count != 0) && this->reserve(1 + sizeof(uint64_t)) )
+	{
+		uint64_t v = value.m_count;
+		m_record.payload[m_record.used++] = LOGTAG_SUPPRESSED;
+		memcpy(m_record.payload + m_record.used, &v, sizeof(v));
+		m_record.used += sizeof(v);
+	}
+	return *this;
+}
+
 #endif
@@ -0,0 +1,67 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** shm_reader.cpp
+**
+** Minimal consumer of the detections published by run -S name
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "SharedResults.h"
+
+static uint64_t monotonicMicros()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* name = (argc > 1) ? argv[1] : "v4l2cpp";
+	SharedSubscriber* subscriber = SharedSubscriber::open(name);
+	if (subscriber == NULL)
+	{
+		fprintf(stderr, "Cannot open /dev/shm/%s\n", name);
+		return -1;
+	}
+
+	SharedResult result;
+	uint64_t last = (uint64_t)-1;
+	while (subscriber->wait(last, result, 5000))
+	{
+		if ( (last != (uint64_t)-1) && (result.frameId != last + 1) )
+		{
+			printf("skipped %lu frames\n", (unsigned long)(result.frameId - last - 1));
+		}
+		last = result.frameId;
+		printf("frame %lu age %lu us inference %.2f ms detections %zu",
+			(unsigned long)result.frameId, (unsigned long)(monotonicMicros() - result.timestamp), result.inferenceTime, result.detections.size());
+		if (!result.frame.empty())
+		{
+			// the pixels are only guaranteed until the writer wraps around the ring
+			printf(" image %dx%d%s", result.frame.cols, result.frame.rows, subscriber->valid(result) ? "" : " (overwritten)");
+		}
+		printf("\n");
+		for (size_t i = 0; i < result.detections.size(); ++i)
+		{
+			const SharedDetection & d = result.detections[i];
+			printf("\tclass %d conf %.2f box %d,%d %dx%d", d.classId, d.confidence, d.x, d.y, d.width, d.height);
+			if (d.position[2] > 0)
+			{
+				printf(" at %.3f,%.3f,%.3f m", d.position[0], d.position[1], d.position[2]);
+			}
+			printf("\n");
+		}
+	}
+	fprintf(stderr, "No result for 5s\n");
+	delete subscriber;
+	return 0;
+}
@@ -0,0 +1,188 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** frame_arena.hpp
+**
+** Per-frame arena for the cv::Mat temporaries of YOLO::detect
+**
+** -------------------------------------------------------------------------*/
+
+#ifndef FRAME_ARENA
+#define FRAME_ARENA
+
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <iostream>
+#include <opencv2/core.hpp>
+
+/*
+ * 预先分配的一块内存，按顺序切分(bump pointer)。一帧开始时如果上一帧的Mat都已经释放，
+ * 就整体回到起点，稳态下检测不再调用malloc/free，也没有分配器的锁竞争。
+ * 放不下时交给OpenCV原来的分配器(getFallbacks)，结果不受影响，只是少了这部分收益。
+ * Mat可能在其他线程释放，所以只有 live 是原子的；offset 只由拥有arena的线程移动。
+ */
+class FrameArena
+{
+	public:
+		explicit FrameArena(size_t capacity);
+		~FrameArena();
+		// start of a frame: rewind when every block of the previous frame has been released
+		bool reset();
+		void* allocate(size_t size);
+		void release() { this->live--; }
+		void fallback() { this->fallbacks++; }
+		size_t getCapacity() const { return this->capacity; }
+		size_t getPeak() const { return this->peak; }            // largest frame so far, bytes
+		unsigned long getFallbacks() const { return this->fallbacks; }
+	private:
+		FrameArena(const FrameArena&);
+		FrameArena& operator=(const FrameArena&);
+		uchar* base;
+		size_t capacity;
+		size_t offset;
+		size_t peak;
+		std::atomic<int> live;
+		std::atomic<unsigned long> fallbacks;
+};
+
+/*
+ * 进程里唯一的默认MatAllocator，第一次使用时安装。
+ * 当前线程有 ArenaScope 时从它的arena分配，否则(其他线程、OpenCV的工作线程、scope之外)
+ * 交给原来的默认分配器，那些Mat的释放也不会再经过这里。
+ */
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 2)
+typedef cv::AccessFlag ArenaAccessFlag;
+#else
+typedef int ArenaAccessFlag;
+#endif
+
+class ArenaMatAllocator : public cv::MatAllocator
+{
+	public:
+		static ArenaMatAllocator* instance();
+		static FrameArena*& current();
+		cv::UMatData* allocate(int dims, const int* sizes, int type, void* data0, size_t* step, ArenaAccessFlag flags, cv::UMatUsageFlags usageFlags) const;
+		bool allocate(cv::UMatData* u, ArenaAccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const;
+		void deallocate(cv::UMatData* u) const;
+	private:
+		explicit ArenaMatAllocator(cv::MatAllocator* previous) : previous(previous) {}
+		cv::MatAllocator* previous;
+};
+
+// Mats created on this thread while the scope is alive come from the arena, NULL disables it
+class ArenaScope
+{
+	public:
+		explicit ArenaScope(FrameArena* arena) : saved(ArenaMatAllocator::current())
+		{
+			ArenaMatAllocator::instance();
+			ArenaMatAllocator::current() = arena;
+		}
+		~ArenaScope() { ArenaMatAllocator::current() = this->saved; }
+	private:
+		ArenaScope(const ArenaScope&);
+		ArenaScope& operator=(const ArenaScope&);
+		FrameArena* saved;
+};
+
+// block layout: owner arena, UMatData, data aligned like fastMalloc
+static const size_t ARENA_ALIGN = 64;
+static const size_t ARENA_UMAT_OFFSET = (sizeof(FrameArena*) + alignof(cv::UMatData) - 1) / alignof(cv::UMatData) * alignof(cv::UMatData);
+static const size_t ARENA_DATA_OFFSET = (ARENA_UMAT_OFFSET + sizeof(cv::UMatData) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+FrameArena::FrameArena(size_t capacity) : capacity(capacity), offset(0), peak(0), live(0), fallbacks(0)
+{
+	this->base = (uchar*)cv::fastMalloc(capacity);
+}
+
+FrameArena::~FrameArena()
+{
+	if (this->live == 0)
+		cv::fastFree(this->base);
+	else
+		std::cout << "Frame arena still used by " << this->live << " Mat, not released" << std::endl;
+}
+
+bool FrameArena::reset()
+{
+	if (this->live != 0)
+		return false;
+	this->offset = 0;
+	return true;
+}
+
+void* FrameArena::allocate(size_t size)
+{
+	size_t total = (ARENA_DATA_OFFSET + size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+	if (this->offset + total > this->capacity)
+		return NULL;
+	void* block = this->base + this->offset;
+	this->offset += total;
+	this->peak = std::max(this->peak, this->offset);
+	this->live++;
+	return block;
+}
+
+ArenaMatAllocator* ArenaMatAllocator::instance()
+{
+	static std::once_flag once;
+	static ArenaMatAllocator* allocator = NULL;
+	std::call_once(once, []() {
+		allocator = new ArenaMatAllocator(cv::Mat::getDefaultAllocator());
+		cv::Mat::setDefaultAllocator(allocator);
+	});
+	return allocator;
+}
+
+FrameArena*& ArenaMatAllocator::current()
+{
+	static thread_local FrameArena* arena = NULL;
+	return arena;
+}
+
+cv::UMatData* ArenaMatAllocator::allocate(int dims, const int* sizes, int type, void* data0, size_t* step, ArenaAccessFlag flags, cv::UMatUsageFlags usageFlags) const
+{
+	FrameArena* arena = current();
+	if (arena == NULL || data0 != NULL)
+		return this->previous->allocate(dims, sizes, type, data0, step, flags, usageFlags);
+
+	// continuous layout, as the standard allocator
+	size_t total = CV_ELEM_SIZE(type);
+	for (int i = dims - 1; i >= 0; i--)
+	{
+		if (step)
+			step[i] = total;
+		total *= sizes[i];
+	}
+	uchar* block = (uchar*)arena->allocate(total);
+	if (block == NULL)
+	{
+		arena->fallback();
+		return this->previous->allocate(dims, sizes, type, data0, step, flags, usageFlags);
+	}
+	*(FrameArena**)block = arena;
+	cv::UMatData* u = new (block + ARENA_UMAT_OFFSET) cv::UMatData(this);
+	u->data = u->origdata = block + ARENA_DATA_OFFSET;
+	u->size = total;
+	return u;
+}
+
+bool ArenaMatAllocator::allocate(cv::UMatData* u, ArenaAccessFlag, cv::UMatUsageFlags) const
+{
+	return u != NULL;
+}
+
+void ArenaMatAllocator::deallocate(cv::UMatData* u) const
+{
+	if (u == NULL)
+		return;
+	CV_Assert(u->urefcount == 0 && u->refcount == 0);
+	FrameArena* arena = *(FrameArena**)((uchar*)u - ARENA_UMAT_OFFSET);
+	u->~UMatData();
+	arena->release();
+}
+
+#endif
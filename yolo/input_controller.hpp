@@ -0,0 +1,95 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** input_controller.hpp
+**
+** Network input size selection holding a detection latency budget
+**
+** -------------------------------------------------------------------------*/
+
+#ifndef INPUT_CONTROLLER
+#define INPUT_CONTROLLER
+
+#include <vector>
+#include <atomic>
+
+/*
+ * 在几个预先准备好的网络输入大小(级别，从小到大)之间切换，让每帧检测的耗时保持在预算内。
+ * 降频、发热或者别的进程占用CPU时每帧都会变慢，只看测到的耗时就能反映出来:
+ *   - 耗时取指数平均；连续 DOWN_FRAMES 帧超过预算，或者平均值超过预算，立即换小一级
+ *   - 按输入面积估算大一级的耗时，低于 预算*(1-HYSTERESIS)，并且在当前级别至少停留了 HOLD_FRAMES 帧，才换大一级
+ *   - 切换时平均值按面积比例换算，新级别不用从头积累
+ * 预算为0或者只有一个级别时不切换。
+ */
+class InputSizeController
+{
+	public:
+		static const int DOWN_FRAMES = 3;
+		static const int HOLD_FRAMES = 60;
+		static constexpr double HYSTERESIS = 0.2;
+		static constexpr double ALPHA = 0.1;
+
+		InputSizeController() : budget(0), level(0), average(0), samples(0), framesAtLevel(0), overBudget(0), switches(0) {}
+
+		// cost of each level, proportional to the input area, smallest first
+		void configure(const std::vector<double>& costs, int level)
+		{
+			this->costs = costs;
+			this->level = level;
+			this->samples = 0;
+			this->framesAtLevel = 0;
+			this->overBudget = 0;
+		}
+		// ms per frame, can be changed from any thread
+		void setBudget(double budgetMs) { this->budget = (float)budgetMs; }
+		double getBudget() const { return this->budget; }
+		int getLevel() const { return this->level; }
+		unsigned long getSwitches() const { return this->switches; }
+
+		// latency of a frame detected at getLevel(), returns the level for the next frame
+		int update(double latencyMs)
+		{
+			double budget = this->budget;
+			if ( (this->costs.size() < 2) || (budget <= 0) )
+				return this->level;
+
+			this->average = (this->samples++ == 0) ? latencyMs : this->average + ALPHA * (latencyMs - this->average);
+			this->framesAtLevel++;
+			this->overBudget = (latencyMs > budget) ? this->overBudget + 1 : 0;
+
+			if ( (this->level > 0) && ((this->overBudget >= DOWN_FRAMES) || (this->average > budget)) )
+			{
+				this->switchTo(this->level - 1);
+			}
+			else if ( (this->level + 1 < (int)this->costs.size()) && (this->framesAtLevel >= HOLD_FRAMES) )
+			{
+				double predicted = this->average * this->costs[this->level + 1] / this->costs[this->level];
+				if (predicted < budget * (1 - HYSTERESIS))
+					this->switchTo(this->level + 1);
+			}
+			return this->level;
+		}
+
+	private:
+		void switchTo(int level)
+		{
+			this->average *= this->costs[level] / this->costs[this->level];
+			this->level = level;
+			this->framesAtLevel = 0;
+			this->overBudget = 0;
+			this->switches++;
+		}
+
+		std::vector<double> costs;
+		std::atomic<float> budget;
+		int level;
+		double average;          // ms, exponential average at the current level
+		unsigned long samples;
+		int framesAtLevel;
+		int overBudget;          // consecutive frames over the budget
+		unsigned long switches;
+};
+
+#endif
@@ -12,56 +12,169 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/dnn.hpp>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+#include "frame_arena.hpp"
+#include "input_controller.hpp"
 
 using namespace cv;
 using namespace dnn;
 using namespace std;
 
+// per-frame Mat temporaries, larger frames fall back to the OpenCV allocator
+#define YOLO_ARENA_SIZE (8 << 20)
+
 struct Net_config
 {
 	float confThreshold; // Confidence threshold
 	float nmsThreshold;  // Non-maximum suppression threshold
 	int inpWidth;  // Width of network's input image
-	int inpHeight; // Height of network's input image
+	int inpHeight; // Height of network's input image, 0 = derived from the camera aspect
 	string classesFile;
 	string modelConfiguration;
 	string modelWeights;
 	string netname;
+	bool keepAspect; // letterbox the frame instead of stretching it to the input size
+	vector<int> inputWidths; // other input widths allowed to hold latencyBudget (ex: 256, 416), same weights
+	float latencyBudget;     // ms per detect(), 0 = always inpWidth
+};
+
+// cfg and weights read once, several nets are then parsed from the same bytes (YOLOPool)
+struct ModelBuffers
+{
+	vector<uchar> cfg;
+	vector<uchar> weights;
+	bool read(const string& modelConfiguration, const string& modelWeights);
+};
+
+// One box after NMS, in frame pixels
+struct Detection
+{
+	int classId;
+	float confidence;
+	Rect box;
+};
+
+// Precomputed frame -> network input coordinate tables for one (camera size, input size) pair
+struct LetterboxMap
+{
+	Size frameSize;
+	Size inputSize;
+	float scaleX; // input pixels per frame pixel
+	float scaleY;
+	int padX;     // letterbox border in input pixels
+	int padY;
+	Mat map1;     // fixed point remap tables (CV_16SC2 + CV_16UC1)
+	Mat map2;
+};
+
+// Buffers reused by every detect(), sized by the first frame after a model or frame size change
+struct InferenceContext
+{
+	Mat blob;                 // network input, NCHW float
+	Mat inputFloat;           // letterboxed frame scaled to [0, 1]
+	vector<String> outNames;  // getUnconnectedOutLayersNames() of the current net
+	vector<Mat> outs;         // headers on the network output blobs
+	vector<int> classIds;     // postprocess candidates
+	vector<float> confidences;
+	vector<Rect> boxes;
+	vector<int> order;        // candidates by decreasing confidence for NMS
+	bool warm;                // one frame already ran with the current net and input size
 };
 
 class YOLO
 {
 	public:
-		YOLO(Net_config config);
-		void detect(Mat& frame);
+		YOLO(Net_config config, const ModelBuffers* model = NULL);
+		~YOLO();
+		// detection only, drawing is left to draw() so it can run on another thread
+		void detect(const Mat& frame, vector<Detection>& detections);
+		void draw(Mat& frame, const vector<Detection>& detections, double inferenceTime) const;
+		double getInferenceTime() const { return inferenceTime; } // ms, last detect()
+		double getDetectTime() const { return detectTime; }       // ms, last detect() including pre/post processing
+		Size getInputSize() const { return letterboxes[level].inputSize; }
+		unsigned long getInputSwitches() const { return controller.getSwitches(); }
+		void setLatencyBudget(float budgetMs) { controller.setBudget(budgetMs); }
+		// live updates, safe to call from any thread, used from the next detect()
+		void setThresholds(float confThreshold, float nmsThreshold);
+		// load cfg/weights on a background thread, detect() keeps the current net until the new one is ready
+		bool reloadAsync(const string& modelConfiguration, const string& modelWeights);
+		bool isReloading() const { return reloading; }
+		// Mat allocations of detect() that did not fit in the frame arena
+		unsigned long getArenaFallbacks() const { return arena.getFallbacks(); }
+		size_t getArenaPeak() const { return arena.getPeak(); }
+		static Size aspectInputSize(Size frameSize, int inpWidth);
+		// detect() stages, public for the benchmarks
+		void preprocess(const Mat& frame, Mat& blob);
+		void postprocess(const vector<Mat>& outs, vector<Detection>& detections);
 	private:
-		float confThreshold;
-		float nmsThreshold;
+		atomic<float> confThreshold;
+		atomic<float> nmsThreshold;
 		int inpWidth;
 		int inpHeight;
+		bool keepAspect;
 		char netname[20];
 		vector<string> classes;
-		Net net;
-		void postprocess(Mat& frame, const vector<Mat>& outs);
-		void drawPred(int classId, float conf, int left, int top, int right, int bottom, Mat& frame);
+		// before the nets and the context: destroyed after everything that may hold one of its blocks
+		FrameArena arena;
+		unsigned long arenaSkips;  // frames allocated normally because a block outlived its frame
+		double arenaWarning;       // tick of the last message about it
+		// one net per input size, all at their own shape, so a switch costs no reallocation
+		vector<int> levelWidths;
+		vector<Net> nets;
+		vector<LetterboxMap> letterboxes;
+		int level;
+		InputSizeController controller;
+		Mat inputImage;
+		InferenceContext context;
+		double inferenceTime;
+		double detectTime;
+		// model reload: the loader fills pendingNets, detect() swaps them in between two frames
+		thread loader;
+		mutex pendingLock;
+		vector<Net> pendingNets;
+		vector<Size> warmupSizes; // letterbox input sizes published by detect() for the loader
+		atomic<bool> pendingReady;
+		atomic<bool> reloading;
+		static Net loadNet(const string& modelConfiguration, const string& modelWeights);
+		static Net loadNet(const ModelBuffers& model);
+		vector<Net> loadNets(const string& modelConfiguration, const string& modelWeights, const ModelBuffers* model) const;
+		Size levelInputSize(Size frameSize, int width) const;
+		void buildLetterbox(LetterboxMap& lb, Size frameSize, Size inputSize);
+		void buildLetterboxes(Size frameSize);
+		static void warmup(Net& net, Size inputSize);
+		void resetContext();
+		void drawPred(int classId, float conf, int left, int top, int right, int bottom, Mat& frame) const;
 };
 
 Net_config yolo_net = {
-	0.5, 0.4, 320, 320,
+	0.9, 0.4, 320, 0,
 	"/home/ydm/Codes/yaotongv2.0/yolo/voc.names", 
 	"/home/ydm/Codes/yaotongv2.0/yolo/yolo-fastest.cfg", 
 	"/home/ydm/Codes/yaotongv2.0/yolo/yolo-fastest_last.weights", 
-	"yolo-fastest"
-
+	"yolo-fastest",
+	true,
+	vector<int>(),
+	0
 };
 
-YOLO::YOLO(Net_config config)
+YOLO::YOLO(Net_config config, const ModelBuffers* model) : arena(YOLO_ARENA_SIZE)
 {
 	cout << "Net use " << config.netname << endl;
 	this->confThreshold = config.confThreshold;
 	this->nmsThreshold = config.nmsThreshold;
 	this->inpWidth = config.inpWidth;
 	this->inpHeight = config.inpHeight;
+	this->keepAspect = config.keepAspect;
+	this->inferenceTime = 0;
+	this->detectTime = 0;
+	this->arenaSkips = 0;
+	this->arenaWarning = 0;
+	this->pendingReady = false;
+	this->reloading = false;
 	strcpy(this->netname, config.netname.c_str());
 
 	ifstream ifs(config.classesFile.c_str());
@@ -69,16 +182,251 @@ YOLO::YOLO(Net_config config)
 	while (getline(ifs, line))
 		this->classes.push_back(line);
 
-	this->net = readNetFromDarknet(config.modelConfiguration, config.modelWeights);
-	this->net.setPreferableBackend(DNN_BACKEND_OPENCV);
-	this->net.setPreferableTarget(DNN_TARGET_CPU);
+	// input sizes smallest first, the controller starts at inpWidth
+	this->levelWidths = config.inputWidths;
+	this->levelWidths.push_back(config.inpWidth);
+	sort(this->levelWidths.begin(), this->levelWidths.end());
+	this->levelWidths.erase(unique(this->levelWidths.begin(), this->levelWidths.end()), this->levelWidths.end());
+	this->level = find(this->levelWidths.begin(), this->levelWidths.end(), config.inpWidth) - this->levelWidths.begin();
+	this->letterboxes.resize(this->levelWidths.size());
+	this->warmupSizes.resize(this->levelWidths.size());
+	this->controller.setBudget(config.latencyBudget);
+	// swap cv::Mat's default allocator now, not on the first warm detect() while other threads make Mats
+	ArenaMatAllocator::instance();
+
+	this->nets = this->loadNets(config.modelConfiguration, config.modelWeights, model);
+	this->resetContext();
 }
 
-void YOLO::postprocess(Mat &frame, const vector<Mat> &outs) // Remove the bounding boxes with low confidence using non-maxima suppression
+YOLO::~YOLO()
 {
-	vector<int> classIds;
-	vector<float> confidences;
-	vector<Rect> boxes;
+	if (this->loader.joinable())
+		this->loader.join();
+}
+
+static bool readFileBytes(const string& path, vector<uchar>& bytes)
+{
+	ifstream ifs(path.c_str(), ios::binary);
+	if (!ifs)
+	{
+		cout << "Cannot read " << path << endl;
+		return false;
+	}
+	bytes.assign(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+	return true;
+}
+
+bool ModelBuffers::read(const string& modelConfiguration, const string& modelWeights)
+{
+	return readFileBytes(modelConfiguration, this->cfg) && readFileBytes(modelWeights, this->weights);
+}
+
+Net YOLO::loadNet(const string& modelConfiguration, const string& modelWeights)
+{
+	Net net = readNetFromDarknet(modelConfiguration, modelWeights);
+	net.setPreferableBackend(DNN_BACKEND_OPENCV);
+	net.setPreferableTarget(DNN_TARGET_CPU);
+	return net;
+}
+
+Net YOLO::loadNet(const ModelBuffers& model)
+{
+	Net net = readNetFromDarknet(model.cfg, model.weights);
+	net.setPreferableBackend(DNN_BACKEND_OPENCV);
+	net.setPreferableTarget(DNN_TARGET_CPU);
+	return net;
+}
+
+vector<Net> YOLO::loadNets(const string& modelConfiguration, const string& modelWeights, const ModelBuffers* model) const
+{
+	vector<Net> nets;
+	ModelBuffers buffers;
+	if (!model && this->levelWidths.size() > 1 && buffers.read(modelConfiguration, modelWeights))
+		model = &buffers;
+	for (size_t i = 0; i < this->levelWidths.size(); ++i)
+		nets.push_back(model ? loadNet(*model) : loadNet(modelConfiguration, modelWeights));
+	return nets;
+}
+
+// the first forward allocates the layers for this input shape
+void YOLO::warmup(Net& net, Size inputSize)
+{
+	Mat blob = blobFromImage(Mat(inputSize, CV_8UC3, Scalar(127, 127, 127)), 1 / 255.0, Size(), Scalar(0, 0, 0), true, false);
+	net.setInput(blob);
+	vector<Mat> outs;
+	net.forward(outs, net.getUnconnectedOutLayersNames());
+}
+
+void YOLO::setThresholds(float confThreshold, float nmsThreshold)
+{
+	this->confThreshold = confThreshold;
+	this->nmsThreshold = nmsThreshold;
+	cout << "Thresholds conf " << confThreshold << " nms " << nmsThreshold << endl;
+}
+
+bool YOLO::reloadAsync(const string& modelConfiguration, const string& modelWeights)
+{
+	if (this->reloading)
+	{
+		cout << "Reload of " << modelWeights << " ignored, a model is already loading" << endl;
+		return false;
+	}
+	if (this->loader.joinable())
+		this->loader.join();
+	this->reloading = true;
+	this->loader = thread([this, modelConfiguration, modelWeights]() {
+		double start = (double)getTickCount();
+		vector<Net> nets;
+		// letterboxes belong to the worker running detect(), only its published copy is read here
+		vector<Size> warmupSizes;
+		{
+			lock_guard<mutex> lock(this->pendingLock);
+			warmupSizes = this->warmupSizes;
+		}
+		try
+		{
+			nets = this->loadNets(modelConfiguration, modelWeights, NULL);
+			// allocate the layers here rather than on a live frame
+			for (size_t i = 0; i < nets.size(); ++i)
+			{
+				if (warmupSizes[i].area() > 0)
+					warmup(nets[i], warmupSizes[i]);
+			}
+		}
+		catch (const cv::Exception& e)
+		{
+			cout << "Cannot load " << modelWeights << ": " << e.what() << endl;
+			this->reloading = false;
+			return;
+		}
+		{
+			lock_guard<mutex> lock(this->pendingLock);
+			this->pendingNets.swap(nets);
+			this->pendingReady = true;
+		}
+		this->reloading = false;
+		cout << "Loaded " << modelWeights << " in " << ((double)getTickCount() - start) * 1000 / getTickFrequency() << " ms" << endl;
+	});
+	return true;
+}
+
+// The next frame sizes the buffers again, outside the arena since they are kept across frames
+void YOLO::resetContext()
+{
+	InferenceContext &ctx = this->context;
+	ctx.outNames = this->nets[0].getUnconnectedOutLayersNames();
+	ctx.classIds.reserve(256);
+	ctx.confidences.reserve(256);
+	ctx.boxes.reserve(256);
+	ctx.order.reserve(256);
+	ctx.warm = false;
+}
+
+// Network input matching the frame aspect, both sides a multiple of the 32 pixel network stride
+Size YOLO::aspectInputSize(Size frameSize, int inpWidth)
+{
+	int width = max(32, (inpWidth + 16) / 32 * 32);
+	int height = (int)((double)width * frameSize.height / frameSize.width / 32 + 0.5) * 32;
+	return Size(width, max(32, height));
+}
+
+// Input size of one level: inpWidth x inpHeight scaled to the level width, or the camera aspect
+Size YOLO::levelInputSize(Size frameSize, int width) const
+{
+	if (this->inpHeight <= 0)
+		return aspectInputSize(frameSize, width);
+	if (width == this->inpWidth)
+		return Size(this->inpWidth, this->inpHeight);
+	int height = (int)((double)width * this->inpHeight / this->inpWidth / 32 + 0.5) * 32;
+	return Size(width, max(32, height));
+}
+
+// Build the remap tables once per (camera size, input size) pair, they are reused for every frame
+void YOLO::buildLetterbox(LetterboxMap &lb, Size frameSize, Size inputSize)
+{
+	lb.frameSize = frameSize;
+	lb.inputSize = inputSize;
+
+	lb.scaleX = (float)lb.inputSize.width / frameSize.width;
+	lb.scaleY = (float)lb.inputSize.height / frameSize.height;
+	lb.padX = 0;
+	lb.padY = 0;
+	if (this->keepAspect)
+	{
+		lb.scaleX = lb.scaleY = min(lb.scaleX, lb.scaleY);
+		lb.padX = (lb.inputSize.width - (int)(frameSize.width * lb.scaleX + 0.5f)) / 2;
+		lb.padY = (lb.inputSize.height - (int)(frameSize.height * lb.scaleY + 0.5f)) / 2;
+	}
+
+	Mat mapX(lb.inputSize, CV_32FC1);
+	Mat mapY(lb.inputSize, CV_32FC1);
+	for (int y = 0; y < lb.inputSize.height; ++y)
+	{
+		float *px = mapX.ptr<float>(y);
+		float *py = mapY.ptr<float>(y);
+		float sy = (y + 0.5f - lb.padY) / lb.scaleY - 0.5f;
+		for (int x = 0; x < lb.inputSize.width; ++x)
+		{
+			px[x] = (x + 0.5f - lb.padX) / lb.scaleX - 0.5f;
+			py[x] = sy;
+		}
+	}
+	convertMaps(mapX, mapY, lb.map1, lb.map2, CV_16SC2);
+
+	cout << "Net input " << lb.inputSize.width << "x" << lb.inputSize.height << " for frame " << frameSize.width << "x" << frameSize.height << endl;
+}
+
+// Every input size is ready before the controller may switch to it: tables built and net allocated
+void YOLO::buildLetterboxes(Size frameSize)
+{
+	vector<double> costs;
+	for (size_t i = 0; i < this->letterboxes.size(); ++i)
+	{
+		this->buildLetterbox(this->letterboxes[i], frameSize, this->levelInputSize(frameSize, this->levelWidths[i]));
+		costs.push_back(this->letterboxes[i].inputSize.area());
+		if (this->letterboxes.size() > 1)
+			warmup(this->nets[i], this->letterboxes[i].inputSize);
+	}
+	this->controller.configure(costs, this->level);
+	this->context.warm = false;
+	lock_guard<mutex> lock(this->pendingLock);
+	for (size_t i = 0; i < this->letterboxes.size(); ++i)
+		this->warmupSizes[i] = this->letterboxes[i].inputSize;
+}
+
+void YOLO::preprocess(const Mat &frame, Mat &blob)
+{
+	if (frame.size() != this->letterboxes[this->level].frameSize)
+		this->buildLetterboxes(frame.size());
+	const LetterboxMap &lb = this->letterboxes[this->level];
+
+	// resize and letterbox in a single pass, the border is darknet's 0.5 gray
+	remap(frame, this->inputImage, lb.map1, lb.map2, INTER_LINEAR, BORDER_CONSTANT, Scalar(127, 127, 127));
+
+	// blobFromImage(inputImage, blob, 1 / 255.0, Size(), Scalar(0, 0, 0), true, false) without its per call temporaries:
+	// scale into a kept float image, then split straight into the RGB planes of the blob
+	int rows = this->inputImage.rows;
+	int cols = this->inputImage.cols;
+	this->inputImage.convertTo(this->context.inputFloat, CV_32F, 1 / 255.0);
+	int sizes[4] = { 1, 3, rows, cols };
+	blob.create(4, sizes, CV_32F);
+	Mat planes[3];
+	for (int c = 0; c < 3; ++c)
+		planes[2 - c] = Mat(rows, cols, CV_32F, blob.ptr<float>(0, c));
+	split(this->context.inputFloat, planes);
+}
+
+void YOLO::postprocess(const vector<Mat> &outs, vector<Detection> &detections) // Remove the bounding boxes with low confidence using non-maxima suppression
+{
+	vector<int> &classIds = this->context.classIds;
+	vector<float> &confidences = this->context.confidences;
+	vector<Rect> &boxes = this->context.boxes;
+	classIds.clear();
+	confidences.clear();
+	boxes.clear();
+	// one value for the whole frame even if setThresholds is called meanwhile
+	float confThreshold = this->confThreshold;
+	float nmsThreshold = this->nmsThreshold;
 
 	for (size_t i = 0; i < outs.size(); ++i)
 	{
@@ -88,41 +436,67 @@ void YOLO::postprocess(Mat &frame, const vector<Mat> &outs) // Remove the boundi
 		float *data = (float *)outs[i].data;
 		for (int j = 0; j < outs[i].rows; ++j, data += outs[i].cols)
 		{
-			Mat scores = outs[i].row(j).colRange(5, outs[i].cols);
-			Point classIdPoint;
-			double confidence;
 			// Get the value and location of the maximum score
-			minMaxLoc(scores, 0, &confidence, 0, &classIdPoint);
-			if (confidence > /*this->confThreshold*/ 0.9)
+			int classId = 0;
+			float confidence = data[5];
+			for (int k = 6; k < outs[i].cols; ++k)
+			{
+				if (data[k] > confidence)
+				{
+					confidence = data[k];
+					classId = k - 5;
+				}
+			}
+			if (confidence > confThreshold)
 			{
-				int centerX = (int)(data[0] * frame.cols);
-				int centerY = (int)(data[1] * frame.rows);
-				int width = (int)(data[2] * frame.cols);
-				int height = (int)(data[3] * frame.rows);
+				// outputs are relative to the network input, undo the letterbox to get frame pixels
+				const LetterboxMap &lb = this->letterboxes[this->level];
+				int centerX = (int)((data[0] * lb.inputSize.width - lb.padX) / lb.scaleX);
+				int centerY = (int)((data[1] * lb.inputSize.height - lb.padY) / lb.scaleY);
+				int width = (int)(data[2] * lb.inputSize.width / lb.scaleX);
+				int height = (int)(data[3] * lb.inputSize.height / lb.scaleY);
 				int left = centerX - width / 2;
 				int top = centerY - height / 2;
 
-				classIds.push_back(classIdPoint.x);
-				confidences.push_back((float)confidence);
+				classIds.push_back(classId);
+				confidences.push_back(confidence);
 				boxes.push_back(Rect(left, top, width, height));
 			}
 		}
 	}
 
 	// Perform non maximum suppression to eliminate redundant overlapping boxes with
-	// lower confidences
-	vector<int> indices;
-	NMSBoxes(boxes, confidences, this->confThreshold, this->nmsThreshold, indices);
-	for (size_t i = 0; i < indices.size(); ++i)
+	// lower confidences, same greedy order and overlap test as NMSBoxes but on the kept buffers
+	vector<int> &order = this->context.order;
+	order.resize(boxes.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = (int)i;
+	sort(order.begin(), order.end(), [&confidences](int a, int b) {
+		return confidences[a] > confidences[b] || (confidences[a] == confidences[b] && a < b);
+	});
+	detections.clear();
+	for (size_t i = 0; i < order.size(); ++i)
 	{
-		int idx = indices[i];
-		Rect box = boxes[idx];
-		this->drawPred(classIds[idx], confidences[idx], box.x, box.y,
-							box.x + box.width, box.y + box.height, frame);
+		int idx = order[i];
+		const Rect &box = boxes[idx];
+		bool keep = true;
+		for (size_t k = 0; k < detections.size() && keep; ++k)
+		{
+			const Rect &kept = detections[k].box;
+			float areas = (float)box.area() + kept.area();
+			float inter = (float)(box & kept).area();
+			float overlap = areas > 0 ? inter / (areas - inter) : 1.f;
+			keep = overlap <= nmsThreshold;
+		}
+		if (keep)
+		{
+			Detection detection = { classIds[idx], confidences[idx], box };
+			detections.push_back(detection);
+		}
 	}
 }
 
-void YOLO::drawPred(int classId, float conf, int left, int top, int right, int bottom, Mat &frame) // Draw the predicted bounding box
+void YOLO::drawPred(int classId, float conf, int left, int top, int right, int bottom, Mat &frame) const // Draw the predicted bounding box
 {
 	//Draw a rectangle displaying the bounding box
 	rectangle(frame, Point(left, top), Point(right, bottom), Scalar(0, 0, 255), 3);
@@ -143,19 +517,73 @@ void YOLO::drawPred(int classId, float conf, int left, int top, int right, int b
 	putText(frame, label, Point(left, top), FONT_HERSHEY_SIMPLEX, 1, Scalar(0, 255, 0), 1);
 }
 
-void YOLO::detect(Mat &frame)
+void YOLO::detect(const Mat &frame, vector<Detection> &detections)
 {
-	Mat blob;
-	blobFromImage(frame, blob, 1 / 255.0, Size(this->inpWidth, this->inpHeight), Scalar(0, 0, 0), true, false);
-	this->net.setInput(blob);
-	vector<Mat> outs;
-	this->net.forward(outs, this->net.getUnconnectedOutLayersNames());
-	this->postprocess(frame, outs);
+	if (this->pendingReady)
+	{
+		// swap between two frames, the old net is released here
+		lock_guard<mutex> lock(this->pendingLock);
+		this->nets.swap(this->pendingNets);
+		this->pendingNets.clear();
+		this->pendingReady = false;
+		this->resetContext();
+	}
+	// tables and nets for a new camera size are kept, build them outside the arena
+	if (frame.size() != this->letterboxes[this->level].frameSize)
+		this->buildLetterboxes(frame.size());
+	if (this->controller.getLevel() != this->level)
+	{
+		// the net of the new size is already allocated, only the context buffers change size
+		this->level = this->controller.getLevel();
+		this->context.warm = false;
+		const Size &input = this->letterboxes[this->level].inputSize;
+		cout << "Net input " << input.width << "x" << input.height << " for a " << this->controller.getBudget() << " ms budget" << endl;
+	}
+	// the first frame after a model or size change allocates the buffers kept by the net and the context,
+	// the next ones only make temporaries, taken from the arena and all released before the next frame
+	FrameArena *frameArena = NULL;
+	if (this->context.warm && this->arena.reset())
+	{
+		frameArena = &this->arena;
+	}
+	else if (this->context.warm)
+	{
+		// a Mat of an earlier frame is still held: rewinding would overwrite it, growing would fill the arena
+		this->arenaSkips++;
+		double now = (double)getTickCount();
+		if ((now - this->arenaWarning) > getTickFrequency())
+		{
+			this->arenaWarning = now;
+			cout << "Frame arena still in use, " << this->arenaSkips << " frames allocated without it" << endl;
+		}
+	}
+	ArenaScope scope(frameArena);
+
+	InferenceContext &ctx = this->context;
+	Net &net = this->nets[this->level];
+	double start = (double)getTickCount();
+	this->preprocess(frame, ctx.blob);
+	double forwardStart = (double)getTickCount();
+	net.setInput(ctx.blob);
+	net.forward(ctx.outs, ctx.outNames);
+	// wall time of the forward pass, getPerfProfile copies the per layer timings every call
+	this->inferenceTime = ((double)getTickCount() - forwardStart) * 1000 / getTickFrequency();
+	this->postprocess(ctx.outs, detections);
+	this->detectTime = ((double)getTickCount() - start) * 1000 / getTickFrequency();
+	ctx.warm = true;
+	// the size for the next frame, applied before its arena scope
+	this->controller.update(this->detectTime);
+}
 
-	vector<double> layersTimes;
-	double freq = getTickFrequency() / 1000;
-	double t = net.getPerfProfile(layersTimes) / freq;
-	string label = format("%s Inference time : %.2f ms", this->netname, t);
+void YOLO::draw(Mat &frame, const vector<Detection> &detections, double inferenceTime) const
+{
+	for (size_t i = 0; i < detections.size(); ++i)
+	{
+		const Rect &box = detections[i].box;
+		this->drawPred(detections[i].classId, detections[i].confidence, box.x, box.y,
+							box.x + box.width, box.y + box.height, frame);
+	}
+	string label = format("%s Inference time : %.2f ms", this->netname, inferenceTime);
 	putText(frame, label, Point(0, 30), FONT_HERSHEY_SIMPLEX, 1, Scalar(0, 0, 255), 2);
 	//imwrite(format("%s_out.jpg", this->netname), frame);
 }
@@ -0,0 +1,256 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** yolo_pool.hpp
+**
+** Frame-parallel detection: N nets on N threads, results in submission order
+**
+** -------------------------------------------------------------------------*/
+
+#ifndef YOLO_POOL
+#define YOLO_POOL
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <condition_variable>
+
+#include "yolo.hpp"
+
+// One detected frame, handed to the callback in the order the frames were submitted
+struct PoolResult
+{
+	Mat frame;
+	uint64_t timestamp;       // capture time, us
+	unsigned int sequence;    // capture sequence
+	vector<Detection> detections;
+	double inferenceTime;     // ms, forward pass of this frame
+	int worker;
+};
+
+/*
+ * 每个工作线程有自己的YOLO(网络不能被多个线程同时forward)，cfg和weights文件只读一次，
+ * 每个网络从同一份内存解析。
+ * 帧按提交顺序进入一个共享队列，空闲的线程取下一帧，相当于轮流分配但慢的线程不会拖住别的线程。
+ * 完成的帧按提交顺序交给回调: 前面的帧没完成时后面的先等着，回调同一时刻只在一个线程里执行。
+ * maxInFlight 是提交了还没交给回调的帧数上限，用来限制排队带来的延迟:
+ *   waitReady 等到可以再提交一帧，然后再去取最新的一帧，而不是拿着旧帧排队。
+ * workers = 1, maxInFlight = 1 时和直接调用 detect 一样，只多一次线程切换。
+ */
+class YOLOPool
+{
+	public:
+		typedef function<void(const PoolResult&)> ResultCallback;
+		typedef function<void(int worker)> WorkerInit;
+
+		YOLOPool(Net_config config, int workers, int maxInFlight, ResultCallback onResult, WorkerInit onStart = WorkerInit());
+		~YOLOPool();
+
+		// true when a frame can be submitted without exceeding maxInFlight
+		bool waitReady(int timeoutMs);
+		void submit(const Mat& frame, uint64_t timestamp, unsigned int sequence);
+		// stop the workers, frames not detected yet are dropped, no callback after this returns
+		void stop();
+
+		int size() const { return (int)models.size(); }
+		// thresholds and classes are the same for every worker, model(0) is enough to draw()
+		const YOLO& model(int worker) const { return *models[worker]; }
+		void setThresholds(float confThreshold, float nmsThreshold);
+		void setLatencyBudget(float budgetMs);
+		bool reloadAsync(const string& modelConfiguration, const string& modelWeights);
+		unsigned long getArenaFallbacks() const;
+
+	private:
+		YOLOPool(const YOLOPool&);
+		YOLOPool& operator=(const YOLOPool&);
+		void workerLoop(int worker);
+		void complete(uint64_t ticket, PoolResult& result);
+
+		struct Job
+		{
+			uint64_t ticket;
+			Mat frame;
+			uint64_t timestamp;
+			unsigned int sequence;
+		};
+
+		vector<YOLO*> models;
+		vector<thread> threads;
+		ResultCallback onResult;
+		WorkerInit onStart;
+		int maxInFlight;
+		mutex lock;
+		condition_variable jobReady;     // workers wait for a job
+		condition_variable slotFree;     // waitReady waits for a delivered frame
+		deque<Job> jobs;
+		vector<PoolResult> done;         // reorder ring, maxInFlight entries indexed by ticket
+		vector<bool> isDone;
+		uint64_t submitted;              // next ticket
+		uint64_t delivered;              // next ticket to hand to the callback
+		bool delivering;                 // a worker is running the callbacks
+		bool stopping;
+};
+
+YOLOPool::YOLOPool(Net_config config, int workers, int maxInFlight, ResultCallback onResult, WorkerInit onStart)
+	: onResult(onResult), onStart(onStart), maxInFlight(max(1, maxInFlight)), submitted(0), delivered(0), delivering(false), stopping(false)
+{
+	workers = max(1, workers);
+	ModelBuffers buffers;
+	bool shared = (workers > 1) && buffers.read(config.modelConfiguration, config.modelWeights);
+	for (int i = 0; i < workers; ++i)
+		this->models.push_back(new YOLO(config, shared ? &buffers : NULL));
+	this->done.resize(this->maxInFlight);
+	this->isDone.resize(this->maxInFlight, false);
+	for (int i = 0; i < workers; ++i)
+		this->threads.push_back(thread(&YOLOPool::workerLoop, this, i));
+	cout << "Detection on " << workers << " threads, " << this->maxInFlight << " frames in flight" << endl;
+}
+
+YOLOPool::~YOLOPool()
+{
+	this->stop();
+	for (size_t i = 0; i < this->models.size(); ++i)
+		delete this->models[i];
+}
+
+void YOLOPool::stop()
+{
+	{
+		lock_guard<mutex> guard(this->lock);
+		this->stopping = true;
+	}
+	this->jobReady.notify_all();
+	this->slotFree.notify_all();
+	for (size_t i = 0; i < this->threads.size(); ++i)
+	{
+		if (this->threads[i].joinable())
+			this->threads[i].join();
+	}
+}
+
+bool YOLOPool::waitReady(int timeoutMs)
+{
+	unique_lock<mutex> guard(this->lock);
+	return this->slotFree.wait_for(guard, chrono::milliseconds(timeoutMs), [this] {
+		return this->stopping || (this->submitted - this->delivered) < (uint64_t)this->maxInFlight;
+	}) && !this->stopping;
+}
+
+void YOLOPool::submit(const Mat& frame, uint64_t timestamp, unsigned int sequence)
+{
+	{
+		unique_lock<mutex> guard(this->lock);
+		// a single submitter calls waitReady first, this wait only guards against misuse
+		this->slotFree.wait(guard, [this] {
+			return this->stopping || (this->submitted - this->delivered) < (uint64_t)this->maxInFlight;
+		});
+		if (this->stopping)
+			return;
+		Job job = { this->submitted++, frame, timestamp, sequence };
+		this->jobs.push_back(job);
+	}
+	this->jobReady.notify_one();
+}
+
+void YOLOPool::setThresholds(float confThreshold, float nmsThreshold)
+{
+	for (size_t i = 0; i < this->models.size(); ++i)
+		this->models[i]->setThresholds(confThreshold, nmsThreshold);
+}
+
+void YOLOPool::setLatencyBudget(float budgetMs)
+{
+	for (size_t i = 0; i < this->models.size(); ++i)
+		this->models[i]->setLatencyBudget(budgetMs);
+}
+
+bool YOLOPool::reloadAsync(const string& modelConfiguration, const string& modelWeights)
+{
+	// all or none: a worker refusing after others started would leave the pool running two models
+	for (size_t i = 0; i < this->models.size(); ++i)
+	{
+		if (this->models[i]->isReloading())
+		{
+			cout << "Reload of " << modelWeights << " ignored, worker " << i << " is still loading" << endl;
+			return false;
+		}
+	}
+	// each worker swaps its own net between two of its frames, only this thread starts reloads
+	for (size_t i = 0; i < this->models.size(); ++i)
+		this->models[i]->reloadAsync(modelConfiguration, modelWeights);
+	return true;
+}
+
+unsigned long YOLOPool::getArenaFallbacks() const
+{
+	unsigned long fallbacks = 0;
+	for (size_t i = 0; i < this->models.size(); ++i)
+		fallbacks += this->models[i]->getArenaFallbacks();
+	return fallbacks;
+}
+
+void YOLOPool::workerLoop(int worker)
+{
+	if (this->onStart)
+		this->onStart(worker);
+	YOLO* yolo = this->models[worker];
+	PoolResult result;
+	while (true)
+	{
+		Job job;
+		{
+			unique_lock<mutex> guard(this->lock);
+			this->jobReady.wait(guard, [this] { return this->stopping || !this->jobs.empty(); });
+			if (this->stopping)
+				break;
+			job = this->jobs.front();
+			this->jobs.pop_front();
+		}
+		try
+		{
+			yolo->detect(job.frame, result.detections);
+		}
+		catch (const cv::Exception& e)
+		{
+			// keep the order: the frame is delivered without detections
+			cout << "Detection failed on frame " << job.sequence << ": " << e.what() << endl;
+			result.detections.clear();
+		}
+		result.frame = job.frame;
+		result.timestamp = job.timestamp;
+		result.sequence = job.sequence;
+		result.inferenceTime = yolo->getInferenceTime();
+		result.worker = worker;
+		this->complete(job.ticket, result);
+	}
+}
+
+void YOLOPool::complete(uint64_t ticket, PoolResult& result)
+{
+	unique_lock<mutex> guard(this->lock);
+	size_t index = ticket % this->maxInFlight;
+	// swap keeps the detections capacity of both sides, no allocation in steady state
+	swap(this->done[index], result);
+	this->isDone[index] = true;
+	if (this->delivering)
+		return; // the worker already delivering will reach this frame
+	this->delivering = true;
+	while (!this->stopping && this->isDone[this->delivered % this->maxInFlight])
+	{
+		size_t next = this->delivered % this->maxInFlight;
+		swap(this->done[next], result);
+		this->isDone[next] = false;
+		// the callback runs unlocked so the other workers can complete meanwhile
+		guard.unlock();
+		this->onResult(result);
+		result.frame.release();
+		guard.lock();
+		this->delivered++;
+		this->slotFree.notify_all();
+	}
+	this->delivering = false;
+}
+
+#endif